@@ -0,0 +1,164 @@
+/*
+    NexDome Beaver Controller - Shutter Battery Estimator
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_battery.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr const size_t BatteryEstimator::WINDOW;
+constexpr const double BatteryEstimator::AVERAGE_TAU_S;
+constexpr const double BatteryEstimator::SLOT_S;
+constexpr const double BatteryEstimator::RESOLUTION_V;
+constexpr const double BatteryEstimator::NEAR_V;
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+void BatteryEstimator::add(double volts, TimePoint when, bool shutterMoving)
+{
+    if (m_Count == 0)
+    {
+        m_Origin = when;
+        m_Average = volts;
+    }
+    else
+    {
+        const double dt = std::chrono::duration<double>(when - m_Last).count();
+        m_Average += (1 - exp(-std::max(0.0, dt) / AVERAGE_TAU_S)) * (volts - m_Average);
+    }
+    m_Last = when;
+
+    // Fast reads (shutter moving) would squeeze the window to a few seconds,
+    // so the fit takes readings at most about one per slot
+    const double t = seconds(when);
+    if (m_Count > 0 && t - m_Samples[(m_Next + WINDOW - 1) % WINDOW].t < SLOT_S / 2)
+        return;
+
+    m_Samples[m_Next] = {t, volts, shutterMoving ? 1.0 : 0.0};
+    m_Next = (m_Next + 1) % WINDOW;
+    m_Count = std::min(m_Count + 1, WINDOW);
+    fit();
+}
+
+void BatteryEstimator::reset()
+{
+    m_Count = 0;
+    m_Next = 0;
+    m_Average = 0;
+    m_Level = 0;
+    m_Slope = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Least squares over the window. With no motion in the window the sag term
+/// drops out and it is a straight line fit.
+/////////////////////////////////////////////////////////////////////////////
+void BatteryEstimator::fit()
+{
+    // centre t on the window mean to keep the sums well conditioned
+    double tMean = 0;
+    for (size_t i = 0; i < m_Count; i++)
+        tMean += m_Samples[i].t;
+    tMean /= m_Count;
+
+    double n = 0, st = 0, sm = 0, stt = 0, stm = 0, smm = 0, sv = 0, stv = 0, smv = 0;
+    for (size_t i = 0; i < m_Count; i++)
+    {
+        const double t = m_Samples[i].t - tMean;
+        const double m = m_Samples[i].moving;
+        const double v = m_Samples[i].volts;
+        n += 1;
+        st += t;
+        sm += m;
+        stt += t * t;
+        stm += t * m;
+        smm += m * m;
+        sv += v;
+        stv += t * v;
+        smv += m * v;
+    }
+
+    double level = sv / n, slope = 0;
+    // 3x3 normal equations by Cramer's rule
+    const double det = n * (stt * smm - stm * stm) - st * (st * smm - stm * sm) + sm * (st * stm - stt * sm);
+    if (sm > 0 && sm < n && fabs(det) > 1e-9)
+    {
+        level = (sv * (stt * smm - stm * stm) - st * (stv * smm - stm * smv) + sm * (stv * stm - stt * smv)) / det;
+        slope = (n * (stv * smm - stm * smv) - sv * (st * smm - stm * sm) + sm * (st * smv - stv * sm)) / det;
+    }
+    else
+    {
+        // every sample at rest (or every one moving): straight line
+        const double d = n * stt - st * st;
+        if (fabs(d) > 1e-9)
+        {
+            slope = (n * stv - st * sv) / d;
+            level = (sv - slope * st) / n;
+        }
+    }
+
+    // level is at the window mean, move it to t = 0
+    m_Slope = slope;
+    m_Level = level - slope * tMean;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Forecasts
+/////////////////////////////////////////////////////////////////////////////
+double BatteryEstimator::level() const
+{
+    if (m_Count == 0)
+        return 0;
+    if (m_Count < WINDOW)
+        return m_Average;
+    return m_Level + m_Slope * seconds(m_Last);
+}
+
+double BatteryEstimator::trend() const
+{
+    return m_Count < WINDOW ? 0 : m_Slope * 3600;
+}
+
+double BatteryEstimator::hoursTo(double volts) const
+{
+    const double perHour = trend();
+    if (perHour >= 0)
+        return -1;
+    return std::max(0.0, (level() - volts) / -perHour);
+}
+
+double BatteryEstimator::readInterval(double volts, double minS, double maxS) const
+{
+    if (m_Count == 0 || level() - volts < NEAR_V)
+        return minS;
+    // filling the window
+    if (m_Count < WINDOW)
+        return std::max(minS, std::min(maxS, SLOT_S));
+
+    const double perSecond = fabs(m_Slope);
+    if (perSecond <= 0)
+        return maxS;
+    return std::max(minS, std::min(maxS, RESOLUTION_V / perSecond));
+}
+
+double BatteryEstimator::seconds(TimePoint when) const
+{
+    return std::chrono::duration<double>(when - m_Origin).count();
+}
@@ -0,0 +1,90 @@
+/*
+    NexDome Beaver Controller - Shutter Battery Estimator
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+///////////////////////////////////////////////////////////////////////////////
+/// Constant memory estimate of the shutter battery. Keeps an EWMA of the
+/// readings and fits voltage = level + trend * t + sag * moving over the last
+/// WINDOW readings, so the motor load while the shutter moves does not show
+/// up as discharge. The trend then gives the time until a voltage is reached
+/// and how often the voltage is worth reading.
+///////////////////////////////////////////////////////////////////////////////
+class BatteryEstimator
+{
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        void add(double volts, TimePoint when, bool shutterMoving);
+        void reset();
+
+        bool isValid() const
+        {
+            return m_Count > 0;
+        }
+        // EWMA of all readings, volts
+        double average() const
+        {
+            return m_Average;
+        }
+        // Resting voltage now according to the fit
+        double level() const;
+        // Volts per hour at rest, 0 until the window is full
+        double trend() const;
+        // Hours until the resting voltage falls to volts, negative if it is not falling
+        double hoursTo(double volts) const;
+        // Seconds until the next reading says something new, within [minS, maxS]
+        double readInterval(double volts, double minS, double maxS) const;
+
+    private:
+        static constexpr const size_t WINDOW {64};
+        // EWMA time constant
+        static constexpr const double AVERAGE_TAU_S {120};
+        // Readings kept in the window are at least about this far apart, so a
+        // full window covers five minutes or more
+        static constexpr const double SLOT_S {300.0 / WINDOW};
+        // About the smallest change the controller reports
+        static constexpr const double RESOLUTION_V {0.02};
+        // Read at the fastest rate this close above the target voltage
+        static constexpr const double NEAR_V {0.3};
+
+        struct Sample
+        {
+            double t;
+            double volts;
+            double moving;
+        };
+
+        void fit();
+        double seconds(TimePoint when) const;
+
+        Sample m_Samples[WINDOW];
+        size_t m_Count {0};
+        size_t m_Next {0};
+        TimePoint m_Origin;
+        TimePoint m_Last;
+        double m_Average {0};
+
+        // fit results, t relative to m_Origin
+        double m_Level {0};
+        double m_Slope {0};
+};
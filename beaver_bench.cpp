@@ -0,0 +1,936 @@
+/*
+    NexDome Beaver Controller - Benchmarks
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_protocol.h"
+#include "beaver_sim_model.h"
+#include "beaver_slaving.h"
+#include "beaver_trace.h"
+#include "beaver_transport.h"
+#include "config.h"
+
+#include "indicom.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// Same sizes and timing as the driver
+const size_t DRIVER_LEN = 128;
+const size_t PIPELINE_DEPTH = 4;
+const std::chrono::milliseconds STATUS_TIMEOUT(400);
+const uint32_t POLL_FAST_MS = 250;
+
+// Replies seen during one TimerHit with the shutter online
+const char *POLL_REPLIES[] =
+{
+    "!dome getaz:123.45",
+    "!dome status:2432",
+    "!dome atpark:0",
+    "!dome shutterisup:1",
+    "!dome status:2432",
+    "!dome getshutterbatvoltage:12.87",
+};
+const size_t POLL_REPLY_COUNT = sizeof(POLL_REPLIES) / sizeof(POLL_REPLIES[0]);
+
+// Commands the driver encodes with an argument
+const BeaverProtocol::Command COMMAND_FORMATS[] =
+{
+    BeaverProtocol::CMD_GOTOAZ,
+    BeaverProtocol::CMD_SETMAXSPEED,
+    BeaverProtocol::CMD_SETACCELERATION,
+    BeaverProtocol::CMD_SETSHUTTERSAFEVOLTAGE,
+};
+const size_t COMMAND_FORMAT_COUNT = sizeof(COMMAND_FORMATS) / sizeof(COMMAND_FORMATS[0]);
+
+// Handshake: what echo() and readSettings() ask for, pipelined
+const char *ECHO_QUERIES[] = {"!dome getaz#", "!dome shutterisup#", "!dome status#"};
+const char *SETTINGS_QUERIES[] =
+{
+    "!dome shutterisup#", "!dome status#", "!domerot gethome#", "!domerot getpark#", "!domerot getmaxspeed#",
+    "!domerot getminspeed#", "!domerot getacceleration#", "!domerot getmaxfullrotsecs#", "!dome getshuttermaxspeed#",
+    "!dome getshutterminspeed#", "!dome getshutteracceleration#", "!dome getshuttertimeoutopenclose#",
+    "!dome getshuttersafevoltage#"
+};
+
+volatile double g_Sink = 0;
+
+/////////////////////////////////////////////////////////////////////////////
+/// The decoder beaver_dome.cpp used before BeaverProtocol
+/////////////////////////////////////////////////////////////////////////////
+bool regexDecode(const char *response, double &res)
+{
+    std::regex rgx(R"(.*:((-*\d+(\.\d*)*)))");
+    std::smatch match;
+    std::string input(response);
+
+    if (std::regex_search(input, match, rgx))
+    {
+        try
+        {
+            res = std::stof(match.str(1));
+            return true;
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool protocolDecode(const char *response, double &res)
+{
+    BeaverProtocol::Reply reply;
+    if (!BeaverProtocol::parseReply(response, strlen(response), reply) || reply.type != BeaverProtocol::Reply::REPLY_NUMBER)
+        return false;
+    res = reply.value;
+    return true;
+}
+
+double cpuSeconds(clockid_t clock = CLOCK_PROCESS_CPUTIME_ID)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Decode "polls" full poll ticks and return CPU ns per tick
+/////////////////////////////////////////////////////////////////////////////
+double benchPollDecode(bool (*decode)(const char *, double &), int polls)
+{
+    const double start = cpuSeconds();
+    for (int i = 0; i < polls; i++)
+    {
+        for (size_t j = 0; j < POLL_REPLY_COUNT; j++)
+        {
+            double value = 0;
+            if (!decode(POLL_REPLIES[j], value))
+            {
+                fprintf(stderr, "decode failed: %s\n", POLL_REPLIES[j]);
+                exit(1);
+            }
+            g_Sink += value;
+        }
+    }
+    return (cpuSeconds() - start) * 1e9 / polls;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Encode every driver command "count" times, CPU ns per command
+/////////////////////////////////////////////////////////////////////////////
+double benchFormat(int count)
+{
+    BeaverProtocol::Request request;
+    const double start = cpuSeconds();
+    for (int i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < COMMAND_FORMAT_COUNT; j++)
+        {
+            const double value = 123.45 + i % 100;
+            BeaverProtocol::encode(request, COMMAND_FORMATS[j], &value, 1);
+            g_Sink += request.text[8];
+        }
+    }
+    return (cpuSeconds() - start) * 1e9 / (static_cast<double>(count) * COMMAND_FORMAT_COUNT);
+}
+
+double benchParseVersion(int count)
+{
+    const char *response = "!seletek tversion:2:1.1.1";
+    const double start = cpuSeconds();
+    for (int i = 0; i < count; i++)
+    {
+        BeaverProtocol::Reply reply;
+        BeaverProtocol::parseVersion(response, strlen(response), reply);
+        g_Sink += reply.version[2];
+    }
+    return (cpuSeconds() - start) * 1e9 / count;
+}
+
+double benchMatchRequest(int count)
+{
+    const char *response = "!dome getshutterbatvoltage:12.87";
+    const size_t len = strlen(response);
+    const double start = cpuSeconds();
+    for (int i = 0; i < count; i++)
+        g_Sink += BeaverProtocol::matchesRequest("!dome getshutterbatvoltage#", response, len);
+    return (cpuSeconds() - start) * 1e9 / count;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Slaving geometry, computed and looked up for the same mount positions,
+/// CPU ns per position. The error is the worst distance between the two
+/// answers along the dome, in degrees of arc.
+/////////////////////////////////////////////////////////////////////////////
+struct GeometryResult
+{
+    double directNs {0};
+    double lookupNs {0};
+    double buildMs {0};
+    double maxErrorDeg {0};
+};
+
+GeometryResult benchGeometry(int count)
+{
+    // a NexDome with a German mount a little off center, at 45 degrees north
+    DomeGeometry geometry;
+    geometry.radius = 1.1;
+    geometry.shutterWidth = 0.6;
+    geometry.north = 0.1;
+    geometry.east = -0.05;
+    geometry.up = 0.3;
+    geometry.otaOffset = 0.35;
+    geometry.latitude = 45;
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> ha(-12, 12), dec(-40, 90);
+    std::vector<std::pair<double, double>> positions(count);
+    for (std::pair<double, double> &position : positions)
+        position = std::make_pair(ha(rng), dec(rng));
+
+    GeometryResult result;
+    SlavingTarget target;
+    double start = cpuSeconds();
+    for (const std::pair<double, double> &position : positions)
+    {
+        BeaverSlaving::directTarget(geometry, position.first, position.second, position.first > 0 ? -1 : 1, target);
+        g_Sink += target.az;
+    }
+    result.directNs = (cpuSeconds() - start) * 1e9 / count;
+
+    SlavingTable table;
+    table.configure(geometry);
+    start = cpuSeconds();
+    table.lookup(0, 0, -1, target);
+    table.lookup(0, 0, 1, target);
+    result.buildMs = (cpuSeconds() - start) * 1e3 / 2;
+
+    start = cpuSeconds();
+    for (const std::pair<double, double> &position : positions)
+    {
+        table.lookup(position.first, position.second, position.first > 0 ? -1 : 1, target);
+        g_Sink += target.az;
+    }
+    result.lookupNs = (cpuSeconds() - start) * 1e9 / count;
+
+    for (const std::pair<double, double> &position : positions)
+    {
+        const int side = position.first > 0 ? -1 : 1;
+        SlavingTarget direct, lookup;
+        if (!BeaverSlaving::directTarget(geometry, position.first, position.second, side, direct) ||
+                !table.lookup(position.first, position.second, side, lookup))
+            continue;
+        const double error = fabs(remainder(direct.az - lookup.az, 360)) * cos(direct.alt * M_PI / 180);
+        result.maxErrorDeg = std::max(result.maxErrorDeg, error);
+    }
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Wall and thread CPU time of repeated runs of one operation
+/////////////////////////////////////////////////////////////////////////////
+struct Samples
+{
+    std::vector<double> values;
+
+    double mean() const
+    {
+        double sum = 0;
+        for (double value : values)
+            sum += value;
+        return values.empty() ? 0 : sum / values.size();
+    }
+    double percentile(double p) const
+    {
+        if (values.empty())
+            return 0;
+        std::vector<double> sorted(values);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+    }
+    double max() const
+    {
+        return values.empty() ? 0 : *std::max_element(values.begin(), values.end());
+    }
+};
+
+struct Timing
+{
+    Samples wallUS;
+    Samples cpuUS;
+    uint64_t roundTrips {0};
+    uint64_t failures {0};
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// Simulated controller on the far end of a socket pair, on its own thread.
+/// Answers from the firmware model, or from a recorded trace.
+/////////////////////////////////////////////////////////////////////////////
+class SimController
+{
+    public:
+        explicit SimController(double latencyMs, TraceReplay *replay = nullptr) :
+            m_LatencyUS(static_cast<useconds_t>(latencyMs * 1000)), m_Replay(replay) {}
+        ~SimController()
+        {
+            stop();
+        }
+
+        bool start()
+        {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            {
+                perror("socketpair");
+                return false;
+            }
+            m_Client = fds[0];
+            m_Server = fds[1];
+            m_Thread = std::thread(&SimController::run, this);
+            return true;
+        }
+        void stop()
+        {
+            m_Stop = true;
+            if (m_Thread.joinable())
+                m_Thread.join();
+            if (m_Client >= 0)
+                close(m_Client);
+            if (m_Server >= 0)
+                close(m_Server);
+            m_Client = m_Server = -1;
+        }
+        // The driver end
+        int fd() const
+        {
+            return m_Client;
+        }
+
+    private:
+        void run();
+        void reply(const char *request, size_t len);
+
+        BeaverSimModel m_Model;
+        const useconds_t m_LatencyUS;
+        TraceReplay *m_Replay;
+        int m_Client {-1};
+        int m_Server {-1};
+        std::thread m_Thread;
+        std::atomic<bool> m_Stop {false};
+};
+
+void SimController::run()
+{
+    char buf[256];
+    size_t len = 0;
+    Clock::time_point last = Clock::now();
+    while (!m_Stop)
+    {
+        pollfd pfd;
+        pfd.fd = m_Server;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, 10);
+
+        const Clock::time_point now = Clock::now();
+        m_Model.step(std::chrono::duration<double>(now - last).count());
+        last = now;
+        if (!(pfd.revents & POLLIN))
+            continue;
+
+        char chunk[256];
+        const ssize_t n = read(m_Server, chunk, sizeof(chunk));
+        if (n <= 0)
+            continue;
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (len < sizeof(buf))
+                buf[len++] = chunk[i];
+            if (chunk[i] != '#')
+                continue;
+            reply(buf, len);
+            len = 0;
+        }
+    }
+}
+
+void SimController::reply(const char *request, size_t len)
+{
+    std::string out;
+    if (m_Replay)
+    {
+        // as fast as possible, the recorded latency is not what is measured
+        double delayS = 0;
+        if (!m_Replay->handle(request, len, out, delayS))
+            return;
+    }
+    else
+    {
+        char buf[160];
+        out.assign(buf, m_Model.handle(request, len, buf, sizeof(buf)));
+    }
+
+    if (m_LatencyUS > 0)
+        usleep(m_LatencyUS);
+    size_t written = 0;
+    while (written < out.size())
+    {
+        const ssize_t n = write(m_Server, out.data() + written, out.size() - written);
+        if (n <= 0)
+            return;
+        written += static_cast<size_t>(n);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// The driver's request path: drain, write, read until the reply that
+/// echoes the request, decode. Same transport and protocol code.
+/////////////////////////////////////////////////////////////////////////////
+class BenchLink
+{
+    public:
+        explicit BenchLink(int fd) : m_Transport('#')
+        {
+            m_Transport.attach(fd);
+        }
+
+        bool raw(const char *cmd, char *response, int &nbytes)
+        {
+            m_Transport.drain();
+            const Clock::time_point deadline = Clock::now() + STATUS_TIMEOUT;
+            if (m_Transport.write(cmd, deadline) != TTY_OK)
+                return false;
+            m_RoundTrips++;
+            for (;;)
+            {
+                if (m_Transport.readFrame(response, DRIVER_LEN, deadline, nbytes) != TTY_OK)
+                    return false;
+                if (BeaverProtocol::matchesRequest(cmd, response, nbytes - 1))
+                    return true;
+            }
+        }
+
+        bool command(const char *cmd, double &value)
+        {
+            char response[DRIVER_LEN] = {0};
+            int nbytes = 0;
+            BeaverProtocol::Reply reply;
+            if (!raw(cmd, response, nbytes) || !BeaverProtocol::parseReply(response, nbytes - 1, reply) ||
+                    reply.type != BeaverProtocol::Reply::REPLY_NUMBER)
+                return false;
+            value = reply.value;
+            return true;
+        }
+
+        // Up to PIPELINE_DEPTH requests on the wire, as sendPipelined()
+        bool pipelined(const char *const *cmds, size_t count, double *values)
+        {
+            m_Transport.drain();
+            size_t sent = 0, answered = 0;
+            while (answered < count)
+            {
+                while (sent < count && sent - answered < PIPELINE_DEPTH)
+                {
+                    if (m_Transport.write(cmds[sent], Clock::now() + STATUS_TIMEOUT) != TTY_OK)
+                        return false;
+                    m_RoundTrips++;
+                    sent++;
+                }
+
+                char response[DRIVER_LEN] = {0};
+                int nbytes = 0;
+                if (m_Transport.readFrame(response, DRIVER_LEN, Clock::now() + STATUS_TIMEOUT, nbytes) != TTY_OK)
+                    return false;
+                size_t match = answered;
+                while (match < sent && !BeaverProtocol::matchesRequest(cmds[match], response, nbytes - 1))
+                    match++;
+                if (match == sent)
+                    continue;
+
+                BeaverProtocol::Reply reply;
+                if (!BeaverProtocol::parseReply(response, nbytes - 1, reply) || reply.type != BeaverProtocol::Reply::REPLY_NUMBER)
+                    return false;
+                values[match] = reply.value;
+                answered = match + 1;
+            }
+            return true;
+        }
+
+        uint64_t roundTrips() const
+        {
+            return m_RoundTrips;
+        }
+
+    private:
+        BeaverTransport m_Transport;
+        uint64_t m_RoundTrips {0};
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// Runs op "iterations" times after a few warm up runs
+/////////////////////////////////////////////////////////////////////////////
+template <typename Op>
+Timing measure(BenchLink &link, int iterations, Op op)
+{
+    for (int i = 0; i < std::max(1, iterations / 10); i++)
+        op(i);
+
+    Timing timing;
+    const uint64_t roundTrips = link.roundTrips();
+    for (int i = 0; i < iterations; i++)
+    {
+        const Clock::time_point wall = Clock::now();
+        const double cpu = cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+        if (!op(i))
+            timing.failures++;
+        timing.cpuUS.values.push_back((cpuSeconds(CLOCK_THREAD_CPUTIME_ID) - cpu) * 1e6);
+        timing.wallUS.values.push_back(std::chrono::duration<double, std::micro>(Clock::now() - wall).count());
+    }
+    timing.roundTrips = (link.roundTrips() - roundTrips) / iterations;
+    return timing;
+}
+
+// readSnapshot(): position, status, shutterisup on a comms flag, battery
+bool pollTick(BenchLink &link)
+{
+    double az = 0, status = 0, value = 0;
+    bool ok = link.command("!dome getaz#", az);
+    ok = link.command("!dome status#", status) && ok;
+    if (static_cast<uint16_t>(status) & BeaverSimModel::DOME_STATUS_SHUTTER_COMM)
+        ok = link.command("!dome shutterisup#", value) && ok;
+    ok = link.command("!dome getshutterbatvoltage#", value) && ok;
+    return ok;
+}
+
+// echo() and readSettings(), as run by a connect without a settings cache
+bool handshake(BenchLink &link)
+{
+    char response[DRIVER_LEN] = {0};
+    int nbytes = 0;
+    BeaverProtocol::Reply reply;
+    if (!link.raw("!seletek tversion#", response, nbytes) || !BeaverProtocol::parseVersion(response, nbytes - 1, reply))
+        return false;
+
+    const size_t echoCount = sizeof(ECHO_QUERIES) / sizeof(ECHO_QUERIES[0]);
+    const size_t settingsCount = sizeof(SETTINGS_QUERIES) / sizeof(SETTINGS_QUERIES[0]);
+    double values[settingsCount];
+    return link.pipelined(ECHO_QUERIES, echoCount, values) && link.pipelined(SETTINGS_QUERIES, settingsCount, values);
+}
+
+// rotatorSetSettings() with every value changed, then the flash commit
+bool settingsApply(BenchLink &link, int i)
+{
+    static const BeaverProtocol::Command commands[] = {BeaverProtocol::CMD_SETMAXSPEED, BeaverProtocol::CMD_SETMINSPEED,
+                                                       BeaverProtocol::CMD_SETACCELERATION, BeaverProtocol::CMD_SETMAXFULLROTSECS
+                                                      };
+    const double values[] = {800.0 - i % 2, 400.0 - i % 2, 500.0 - i % 2, 83.0 - i % 2};
+    BeaverProtocol::Request request;
+    double res = 0;
+    bool ok = true;
+    for (size_t j = 0; j < 4; j++)
+    {
+        BeaverProtocol::encode(request, commands[j], &values[j], 1);
+        ok = link.command(request.text, res) && ok;
+    }
+    return link.command("!seletek savefs#", res) && ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Slaving: polls at the fast rate and a new goto each second as the
+/// telescope moves on
+/////////////////////////////////////////////////////////////////////////////
+struct SlavingResult
+{
+    double seconds {0};
+    uint64_t ticks {0};
+    uint64_t overruns {0};
+    uint64_t roundTrips {0};
+    uint64_t failures {0};
+    Timing tick;
+};
+
+SlavingResult benchSlaving(BenchLink &link, double seconds)
+{
+    SlavingResult result;
+    const uint64_t roundTrips = link.roundTrips();
+    const Clock::time_point start = Clock::now();
+    const std::chrono::milliseconds period(POLL_FAST_MS);
+    Clock::time_point next = start;
+    double target = 10;
+
+    while (Clock::now() - start < std::chrono::duration<double>(seconds))
+    {
+        const Clock::time_point wall = Clock::now();
+        const double cpu = cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+        bool ok = true;
+        if (result.ticks % (1000 / POLL_FAST_MS) == 0)
+        {
+            target = fmod(target + 2, 360);
+            const BeaverProtocol::Request request = BeaverProtocol::request<BeaverProtocol::CMD_GOTOAZ>(target);
+            double res = 0;
+            ok = link.command(request.text, res);
+        }
+        ok = pollTick(link) && ok;
+        if (!ok)
+            result.failures++;
+        result.tick.cpuUS.values.push_back((cpuSeconds(CLOCK_THREAD_CPUTIME_ID) - cpu) * 1e6);
+        result.tick.wallUS.values.push_back(std::chrono::duration<double, std::micro>(Clock::now() - wall).count());
+        result.ticks++;
+
+        // fixed rate like the driver's poll deadlines
+        next += period;
+        if (Clock::now() > next)
+        {
+            result.overruns++;
+            next = Clock::now();
+        }
+        else
+            std::this_thread::sleep_until(next);
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.roundTrips = link.roundTrips() - roundTrips;
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Every request of a recorded session, replayed as fast as possible
+/////////////////////////////////////////////////////////////////////////////
+struct ReplayResult
+{
+    uint64_t requests {0};
+    uint64_t answered {0};
+    double seconds {0};
+    double cpuSeconds {0};
+};
+
+ReplayResult benchReplay(const std::vector<TraceFrame> &frames, double latencyMs)
+{
+    TraceReplay replay(frames);
+    SimController sim(latencyMs, &replay);
+    ReplayResult result;
+    if (!sim.start())
+        return result;
+
+    BenchLink link(sim.fd());
+    const Clock::time_point start = Clock::now();
+    const double cpu = cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+    char response[DRIVER_LEN] = {0};
+    for (const TraceFrame &frame : frames)
+    {
+        if (frame.direction != BeaverTrace::TRACE_TX)
+            continue;
+        int nbytes = 0;
+        result.requests++;
+        if (link.raw(frame.data.c_str(), response, nbytes))
+            result.answered++;
+    }
+    result.cpuSeconds = cpuSeconds(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// UDP framing check: 33 byte replies sent in 35 byte datagrams, so the ring
+/// is never empty at a reply boundary before it wraps and datagrams land
+/// across the wrap point. Every reply has to come out whole. Returns the
+/// replies lost or damaged.
+/////////////////////////////////////////////////////////////////////////////
+int checkDatagramFraming(int replies)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0)
+    {
+        perror("socketpair");
+        return replies;
+    }
+    BeaverTransport transport('#');
+    transport.attach(fds[0]);
+
+    std::string stream;
+    char reply[DRIVER_LEN];
+    for (int i = 0; i < replies; i++)
+    {
+        snprintf(reply, sizeof(reply), "!dome getshutterbatvoltage:%5.2f#", 10 + i * 0.01);
+        stream += reply;
+    }
+    const size_t replyLen = stream.size() / replies;
+    const size_t DATAGRAM_LEN = 35;
+
+    int whole = 0;
+    size_t offset = 0, next = 0;
+    while (offset < stream.size())
+    {
+        const size_t len = std::min(DATAGRAM_LEN, stream.size() - offset);
+        if (send(fds[1], stream.data() + offset, len, 0) != static_cast<ssize_t>(len))
+        {
+            perror("send");
+            break;
+        }
+        offset += len;
+
+        char frame[DRIVER_LEN];
+        int nbytes = 0;
+        while (transport.readFrame(frame, DRIVER_LEN, Clock::now() + std::chrono::milliseconds(1), nbytes) == TTY_OK)
+        {
+            if (static_cast<size_t>(nbytes) == replyLen && next + replyLen <= stream.size() &&
+                    memcmp(frame, stream.data() + next, replyLen) == 0)
+                whole++;
+            next += replyLen;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return replies - whole;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// JSON
+/////////////////////////////////////////////////////////////////////////////
+void jsonSamples(FILE *fp, const char *name, const Samples &samples)
+{
+    fprintf(fp, "\"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"max\": %.3f}", name, samples.mean(),
+            samples.percentile(0.5), samples.percentile(0.95), samples.max());
+}
+
+void jsonTiming(FILE *fp, const char *name, const Timing &timing)
+{
+    fprintf(fp, "    \"%s\": {", name);
+    jsonSamples(fp, "wall_us", timing.wallUS);
+    fprintf(fp, ", ");
+    jsonSamples(fp, "cpu_us", timing.cpuUS);
+    fprintf(fp, ", \"round_trips\": %llu, \"failures\": %llu}", static_cast<unsigned long long>(timing.roundTrips),
+            static_cast<unsigned long long>(timing.failures));
+}
+
+void printTiming(const char *name, const Timing &timing)
+{
+    printf("  %-16s: %9.1f us wall (p95 %9.1f), %7.1f us CPU, %llu round trips%s\n", name, timing.wallUS.mean(),
+           timing.wallUS.percentile(0.95), timing.cpuUS.mean(), static_cast<unsigned long long>(timing.roundTrips),
+           timing.failures ? ", FAILURES" : "");
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n polls  decode iterations (default 20000)\n"
+            "  -i count  iterations of each controller benchmark (default 200)\n"
+            "  -l ms     simulated controller reply latency (default 0)\n"
+            "  -s secs   slaving run time, 0 skips it (default 5)\n"
+            "  -R trace  also replay a recorded serial trace as fast as possible\n"
+            "  -j file   write the results as JSON, - for stdout\n", name);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int polls = 20000;
+    int iterations = 200;
+    double latencyMs = 0;
+    double slavingSecs = 5;
+    const char *tracePath = nullptr;
+    const char *jsonPath = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:l:s:R:j:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                polls = atoi(optarg);
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'l':
+                latencyMs = atof(optarg);
+                break;
+            case 's':
+                slavingSecs = atof(optarg);
+                break;
+            case 'R':
+                tracePath = optarg;
+                break;
+            case 'j':
+                jsonPath = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (polls <= 0 || iterations <= 0 || latencyMs < 0 || slavingSecs < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceFrame> frames;
+    if (tracePath && !loadTrace(tracePath, frames))
+    {
+        fprintf(stderr, "%s: not a Beaver serial trace\n", tracePath);
+        return 1;
+    }
+
+    // The transport has to get UDP replies right before anything is timed
+    const int datagramReplies = 200;
+    const int damaged = checkDatagramFraming(datagramReplies);
+    if (damaged > 0)
+    {
+        fprintf(stderr, "Datagram framing: %d of %d replies lost or damaged\n", damaged, datagramReplies);
+        return 1;
+    }
+
+    // Micro: command formatting and reply decoding
+    benchPollDecode(regexDecode, polls / 10 + 1);
+    benchPollDecode(protocolDecode, polls / 10 + 1);
+    const double regexNs = benchPollDecode(regexDecode, polls);
+    const double protocolNs = benchPollDecode(protocolDecode, polls);
+    const double formatNs = benchFormat(polls);
+    const double versionNs = benchParseVersion(polls);
+    const double matchNs = benchMatchRequest(polls);
+    const GeometryResult geometry = benchGeometry(polls);
+
+    // Macro: the driver's request sequences against the simulated controller
+    SimController sim(latencyMs);
+    if (!sim.start())
+        return 1;
+    BenchLink link(sim.fd());
+    const Timing tick = measure(link, iterations, [&link](int)
+    {
+        return pollTick(link);
+    });
+    const Timing connect = measure(link, iterations, [&link](int)
+    {
+        return handshake(link);
+    });
+    const Timing apply = measure(link, iterations, [&link](int i)
+    {
+        return settingsApply(link, i);
+    });
+    SlavingResult slaving;
+    if (slavingSecs > 0)
+        slaving = benchSlaving(link, slavingSecs);
+    sim.stop();
+
+    ReplayResult replay;
+    if (tracePath)
+        replay = benchReplay(frames, latencyMs);
+
+    FILE *out = stdout;
+    const bool text = jsonPath == nullptr || strcmp(jsonPath, "-") != 0;
+    if (text)
+    {
+        printf("Reply decoding, %zu replies per poll, %d polls\n", POLL_REPLY_COUNT, polls);
+        printf("  std::regex + stof : %10.1f ns CPU per poll\n", regexNs);
+        printf("  BeaverProtocol    : %10.1f ns CPU per poll\n", protocolNs);
+        printf("  saved             : %10.1f ns CPU per poll (%.1fx)\n", regexNs - protocolNs, regexNs / protocolNs);
+        printf("  command encode    : %10.1f ns CPU per command\n", formatNs);
+        printf("  parseVersion      : %10.1f ns CPU\n", versionNs);
+        printf("  matchesRequest    : %10.1f ns CPU\n", matchNs);
+        printf("Slaving geometry, %d mount positions\n", polls);
+        printf("  direct            : %10.1f ns CPU per position\n", geometry.directNs);
+        printf("  table lookup      : %10.1f ns CPU per position (%.1fx), max error %.4f deg\n", geometry.lookupNs,
+               geometry.directNs / geometry.lookupNs, geometry.maxErrorDeg);
+        printf("  table build       : %10.2f ms CPU per OTA side\n", geometry.buildMs);
+        printf("Simulated controller, %.1f ms latency, %d iterations\n", latencyMs, iterations);
+        printTiming("poll tick", tick);
+        printTiming("handshake", connect);
+        printTiming("settings apply", apply);
+        if (slavingSecs > 0)
+            printf("  slaving         : %.0f round trips per minute, %llu ticks, %llu overruns, tick %.1f us wall (p95 %.1f)\n",
+                   slaving.roundTrips * 60 / slaving.seconds, static_cast<unsigned long long>(slaving.ticks),
+                   static_cast<unsigned long long>(slaving.overruns), slaving.tick.wallUS.mean(),
+                   slaving.tick.wallUS.percentile(0.95));
+        if (tracePath)
+            printf("  trace replay    : %llu of %llu requests answered, %.0f requests/s, %.1f us CPU per request\n",
+                   static_cast<unsigned long long>(replay.answered), static_cast<unsigned long long>(replay.requests),
+                   replay.requests / std::max(replay.seconds, 1e-9), replay.cpuSeconds * 1e6 / std::max<uint64_t>(replay.requests, 1));
+    }
+    if (jsonPath == nullptr)
+        return 0;
+    if (strcmp(jsonPath, "-") != 0 && (out = fopen(jsonPath, "w")) == nullptr)
+    {
+        perror(jsonPath);
+        return 1;
+    }
+
+    char stamp[32];
+    const time_t now = time(nullptr);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+    fprintf(out, "{\n  \"driver_version\": \"%d.%d\",\n  \"time\": \"%s\",\n", BEAVER_VERSION_MAJOR, BEAVER_VERSION_MINOR, stamp);
+    fprintf(out, "  \"config\": {\"polls\": %d, \"iterations\": %d, \"latency_ms\": %.3f, \"slaving_s\": %.3f},\n", polls,
+            iterations, latencyMs, slavingSecs);
+    fprintf(out, "  \"micro\": {\n");
+    fprintf(out, "    \"decode_regex_ns_per_poll\": %.1f,\n    \"decode_protocol_ns_per_poll\": %.1f,\n", regexNs, protocolNs);
+    fprintf(out, "    \"format_ns_per_command\": %.1f,\n    \"parse_version_ns\": %.1f,\n    \"match_request_ns\": %.1f,\n",
+            formatNs, versionNs, matchNs);
+    fprintf(out, "    \"geometry_direct_ns\": %.1f,\n    \"geometry_lookup_ns\": %.1f,\n    \"geometry_build_ms\": %.3f,\n"
+            "    \"geometry_max_error_deg\": %.5f\n  },\n", geometry.directNs, geometry.lookupNs, geometry.buildMs,
+            geometry.maxErrorDeg);
+    fprintf(out, "  \"macro\": {\n");
+    jsonTiming(out, "poll_tick", tick);
+    fprintf(out, ",\n");
+    jsonTiming(out, "handshake", connect);
+    fprintf(out, ",\n");
+    jsonTiming(out, "settings_apply", apply);
+    if (slavingSecs > 0)
+    {
+        fprintf(out, ",\n    \"slaving\": {\"seconds\": %.3f, \"round_trips_per_minute\": %.1f, \"ticks\": %llu, \"overruns\": %llu, "
+                "\"failures\": %llu, ", slaving.seconds, slaving.roundTrips * 60 / slaving.seconds,
+                static_cast<unsigned long long>(slaving.ticks), static_cast<unsigned long long>(slaving.overruns),
+                static_cast<unsigned long long>(slaving.failures));
+        jsonSamples(out, "tick_wall_us", slaving.tick.wallUS);
+        fprintf(out, ", ");
+        jsonSamples(out, "tick_cpu_us", slaving.tick.cpuUS);
+        fprintf(out, "}");
+    }
+    if (tracePath)
+        fprintf(out, ",\n    \"trace_replay\": {\"requests\": %llu, \"answered\": %llu, \"seconds\": %.6f, \"cpu_seconds\": %.6f}",
+                static_cast<unsigned long long>(replay.requests), static_cast<unsigned long long>(replay.answered),
+                replay.seconds, replay.cpuSeconds);
+    fprintf(out, "\n  }\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
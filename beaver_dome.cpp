@@ -21,29 +21,50 @@
 */
 
 #include "beaver_dome.h"
+#include "beaver_protocol.h"
 
 #include "indicom.h"
 #include "connectionplugins/connectiontcp.h"
 #include "connectionplugins/connectionserial.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <map>
 #include <memory>
-#include <regex>
 
 #include <termios.h>
 #include <unistd.h>
 #include "config.h"
 
-static std::unique_ptr<Beaver> dome(new Beaver());
+// One instance per dome, each with its own device name, config, port and I/O thread
+static std::vector<std::unique_ptr<Beaver>> domes = Beaver::createDomes();
 
-Beaver::Beaver()
+// odr-used through std::chrono and std::min, need a definition in C++11
+constexpr const uint32_t Beaver::POLL_FAST_MS;
+constexpr const uint32_t Beaver::POLL_PARKED_FACTOR;
+constexpr const uint32_t Beaver::POLL_PARKED_MAX_MS;
+constexpr const uint32_t Beaver::POLL_STATS_INTERVAL_MS;
+constexpr const int Beaver::MAX_DOMES;
+constexpr const uint32_t Beaver::UDP_RETRANSMITS;
+constexpr const uint32_t Beaver::WATCHDOG_HEARTBEAT_MS;
+constexpr const uint32_t Beaver::RECONNECT_MAX_MS;
+
+Beaver::Beaver(int index)
 {
+    // the first dome keeps the name existing setups are configured for
+    if (index > 0)
+        setDeviceName((std::string(getDefaultName()) + " " + std::to_string(index + 1)).c_str());
     setVersion(BEAVER_VERSION_MAJOR, BEAVER_VERSION_MINOR);
     SetDomeCapability(DOME_CAN_ABORT | DOME_CAN_ABS_MOVE | DOME_CAN_REL_MOVE | DOME_CAN_PARK);
 
     setDomeConnection(CONNECTION_TCP | CONNECTION_SERIAL);
+    m_Transport.setTrace(&m_Trace);
 }
 
 bool Beaver::initProperties()
@@ -60,6 +81,11 @@ bool Beaver::initProperties()
     RotatorStatusTP[0].fill("RSTATUS", "Status", "Idle");
     RotatorStatusTP.fill(getDeviceName(), "ROTATORSTATUS", "Dome", MAIN_CONTROL_TAB, IP_RO, 60, IPS_IDLE);
 
+    // Rotator move prediction
+    RotatorMotionNP[ROTATOR_MOTION_TARGET].fill("ROTATOR_MOTION_TARGET", "Target (deg)", "%.2f", 0, 360, 0, 0);
+    RotatorMotionNP[ROTATOR_MOTION_ETA].fill("ROTATOR_MOTION_ETA", "Time to target (s)", "%.1f", 0, 1000, 0, 0);
+    RotatorMotionNP.fill(getDeviceName(), "ROTATOR_MOTION", "Rotator", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
+
     // Shutter status
     ShutterStatusTP[0].fill("SSTATUS", "Status", "Idle");
     ShutterStatusTP.fill(getDeviceName(), "SHUTTERSTATUS", "Shutter", MAIN_CONTROL_TAB, IP_RO, 60, IPS_IDLE);
@@ -68,9 +94,14 @@ bool Beaver::initProperties()
     ShutterVoltsNP[0].fill("SHUTTERvolts", "Volts", "%.2f", 0.00, 15.00, 0.00, 0.00);
     ShutterVoltsNP.fill(getDeviceName(), "SHUTTERVOLTS", "Shutter", MAIN_CONTROL_TAB, IP_RO, 60, IPS_OK);
 
+    ShutterBatteryNP[BATTERY_AVERAGE].fill("BATTERY_AVERAGE", "Average (V)", "%.2f", 0, 15, 0, 0);
+    ShutterBatteryNP[BATTERY_TREND].fill("BATTERY_TREND", "Trend (V/h)", "%.3f", -15, 15, 0, 0);
+    ShutterBatteryNP[BATTERY_HOURS_TO_SAFE].fill("BATTERY_HOURS_TO_SAFE", "Hours to safe (-1 never)", "%.2f", -1, 1000, 0, -1);
+    ShutterBatteryNP.fill(getDeviceName(), "SHUTTER_BATTERY", "Battery", MAIN_CONTROL_TAB, IP_RO, 60, IPS_IDLE);
+
     // Rotator Home
     GotoHomeSP[0].fill("ROTATOR_HOME_GOTO", "Home", ISS_OFF);
-    GotoHomeSP.fill(getDefaultName(), "ROTATOR_GOTO_Home", "Rotator", MAIN_CONTROL_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+    GotoHomeSP.fill(getDeviceName(), "ROTATOR_GOTO_Home", "Rotator", MAIN_CONTROL_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // Rototor settings tab
@@ -88,7 +119,7 @@ bool Beaver::initProperties()
     // Rotator Calibrations
     RotatorCalibrationSP[ROTATOR_HOME_FIND].fill("ROTATOR_HOME_FIND", "Find Home", ISS_OFF);
     RotatorCalibrationSP[ROTATOR_HOME_MEASURE].fill("ROTATOR_HOME_MEASURE", "Measure Home", ISS_OFF);
-    RotatorCalibrationSP.fill(getDefaultName(), "ROTATOR_CALIBRATION", "Rotator", ROTATOR_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+    RotatorCalibrationSP.fill(getDeviceName(), "ROTATOR_CALIBRATION", "Rotator", ROTATOR_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
     // Rotator Settings
     RotatorSettingsNP[ROTATOR_MAX_SPEED].fill("ROTATOR_MAX_SPEED", "Max Speed (m/s)", "%.f", 1, 1000, 10, 800);
@@ -97,6 +128,11 @@ bool Beaver::initProperties()
     RotatorSettingsNP[ROTATOR_TIMEOUT].fill("ROTATOR_TIMEOUT", "Timeout (s)", "%.f", 1, 1000, 10, 83);
     RotatorSettingsNP.fill(getDeviceName(), "ROTATOR_SETTINGS", "Settings", ROTATOR_TAB, IP_RW, 60, IPS_IDLE);
 
+    // Goto coalescing, driver side
+    GotoCoalesceNP[GOTO_TOLERANCE].fill("GOTO_TOLERANCE", "Tolerance (deg)", "%.2f", 0, 10, 0.1, 0.5);
+    GotoCoalesceNP[GOTO_INTERVAL].fill("GOTO_INTERVAL", "Min interval (s)", "%.1f", 0, 30, 0.5, 2);
+    GotoCoalesceNP.fill(getDeviceName(), "GOTO_COALESCE", "Re-targeting", ROTATOR_TAB, IP_RW, 60, IPS_IDLE);
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // Shutter settings tab
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -121,6 +157,78 @@ bool Beaver::initProperties()
     VersionTP[0].fill("CVERSION", "Controller", "");
     VersionTP.fill(getDeviceName(), "DOME_FIRMWARE", "Version", CONNECTION_TAB, IP_RO, 0, IPS_IDLE);
 
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Diagnostics Tab
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Poll scheduler
+    PollStatsNP[POLL_PERIOD].fill("POLL_PERIOD", "Period (ms)", "%.f", 0, 60000, 0, 0);
+    PollStatsNP[POLL_DURATION].fill("POLL_DURATION", "Duration (ms)", "%.1f", 0, 60000, 0, 0);
+    PollStatsNP[POLL_JITTER].fill("POLL_JITTER", "Jitter (ms)", "%.1f", 0, 60000, 0, 0);
+    PollStatsNP[POLL_JITTER_MAX].fill("POLL_JITTER_MAX", "Max Jitter (ms)", "%.1f", 0, 60000, 0, 0);
+    PollStatsNP[POLL_OVERRUNS].fill("POLL_OVERRUNS", "Overruns", "%.f", 0, 1e9, 0, 0);
+    PollStatsNP.fill(getDeviceName(), "POLL_STATS", "Polling", DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Change-only publication
+    PublishStatsNP[PUBLISH_SENT].fill("PUBLISH_SENT", "Sent", "%.f", 0, 1e12, 0, 0);
+    PublishStatsNP[PUBLISH_SUPPRESSED].fill("PUBLISH_SUPPRESSED", "Suppressed", "%.f", 0, 1e12, 0, 0);
+    PublishStatsNP.fill(getDeviceName(), "PUBLISH_STATS", "Updates", DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Command statistics
+    for (int i = 0; i < BeaverProtocol::CLASS_COUNT; i++)
+    {
+        const std::string label = BeaverProtocol::commandClassName(static_cast<BeaverProtocol::CommandClass>(i));
+        std::string name = label;
+        for (char &c : name)
+            c = static_cast<char>(toupper(c));
+        const int base = i * COMMAND_STAT_COUNT;
+        CommandStatsNP[base + COMMAND_TIMEOUTS].fill((name + "_TIMEOUTS").c_str(), (label + " timeouts").c_str(), "%.f", 0, 1e9, 0, 0);
+        CommandStatsNP[base + COMMAND_RETRIES].fill((name + "_RETRIES").c_str(), (label + " retries").c_str(), "%.f", 0, 1e9, 0, 0);
+        CommandStatsNP[base + COMMAND_FAILURES].fill((name + "_FAILURES").c_str(), (label + " failures").c_str(), "%.f", 0, 1e9, 0, 0);
+    }
+    CommandStatsNP.fill(getDeviceName(), "COMMAND_STATS", "Commands", DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Link statistics
+    LinkStatsNP[LINK_DESYNCS].fill("LINK_DESYNCS", "Desyncs", "%.f", 0, 1e9, 0, 0);
+    LinkStatsNP[LINK_STALE_BYTES].fill("LINK_STALE_BYTES", "Stale bytes", "%.f", 0, 1e12, 0, 0);
+    LinkStatsNP[LINK_REQUESTS].fill("LINK_REQUESTS", "Requests", "%.f", 0, 1e12, 0, 0);
+    LinkStatsNP[LINK_LOST].fill("LINK_LOST", "Lost", "%.f", 0, 1e12, 0, 0);
+    LinkStatsNP[LINK_LOSS].fill("LINK_LOSS", "Loss (%)", "%.2f", 0, 100, 0, 0);
+    LinkStatsNP[LINK_RETRANSMITS].fill("LINK_RETRANSMITS", "Retransmits", "%.f", 0, 1e12, 0, 0);
+    LinkStatsNP[LINK_SRTT].fill("LINK_SRTT", "Smoothed RTT (ms)", "%.1f", 0, 1e5, 0, 0);
+    LinkStatsNP[LINK_RTTVAR].fill("LINK_RTTVAR", "RTT variation (ms)", "%.1f", 0, 1e5, 0, 0);
+    LinkStatsNP[LINK_RTO].fill("LINK_RTO", "Retransmit timeout (ms)", "%.f", 0, 1e5, 0, 0);
+    LinkStatsNP.fill(getDeviceName(), "LINK_STATS", "Link", DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
+
+    LinkRecoveryNP[RECOVERY_OUTAGES].fill("RECOVERY_OUTAGES", "Outages", "%.f", 0, 1e9, 0, 0);
+    LinkRecoveryNP[RECOVERY_COUNT].fill("RECOVERY_COUNT", "Recovered", "%.f", 0, 1e9, 0, 0);
+    LinkRecoveryNP[RECOVERY_LAST].fill("RECOVERY_LAST", "Last recovery (s)", "%.1f", 0, 1e9, 0, 0);
+    LinkRecoveryNP[RECOVERY_MEAN].fill("RECOVERY_MEAN", "Mean time to recover (s)", "%.1f", 0, 1e9, 0, 0);
+    LinkRecoveryNP.fill(getDeviceName(), "LINK_RECOVERY", "Recovery", DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
+
+    GotoStatsNP[GOTO_SENT].fill("GOTO_SENT", "Sent", "%.f", 0, 1e12, 0, 0);
+    GotoStatsNP[GOTO_COVERED].fill("GOTO_COVERED", "Covered", "%.f", 0, 1e12, 0, 0);
+    GotoStatsNP[GOTO_SUPERSEDED].fill("GOTO_SUPERSEDED", "Superseded", "%.f", 0, 1e12, 0, 0);
+    GotoStatsNP.fill(getDeviceName(), "GOTO_STATS", "Gotos", DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // Telemetry recording
+    TelemetrySP[TELEMETRY_ON].fill("TELEMETRY_ON", "On", ISS_ON);
+    TelemetrySP[TELEMETRY_OFF].fill("TELEMETRY_OFF", "Off", ISS_OFF);
+    TelemetrySP.fill(getDeviceName(), "TELEMETRY", "Telemetry", DIAGNOSTICS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    // Shared memory status
+    StatusExportSP[STATUS_EXPORT_ON].fill("STATUS_EXPORT_ON", "On", ISS_ON);
+    StatusExportSP[STATUS_EXPORT_OFF].fill("STATUS_EXPORT_OFF", "Off", ISS_OFF);
+    StatusExportSP.fill(getDeviceName(), "STATUS_EXPORT", "Shared memory", DIAGNOSTICS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    // Serial trace, defined while disconnected so the handshake can be recorded too
+    TraceSP[TRACE_ON].fill("TRACE_ON", "On", ISS_OFF);
+    TraceSP[TRACE_OFF].fill("TRACE_OFF", "Off", ISS_ON);
+    TraceSP.fill(getDeviceName(), "SERIAL_TRACE", "Serial trace", DIAGNOSTICS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+    m_Publisher.setDeadband(DomeAbsPosNP.name, AZ_DEADBAND);
+    m_Publisher.setDeadband(ShutterVoltsNP.getName(), VOLTS_DEADBAND);
+    m_Publisher.setDeadband(ShutterBatteryNP.getName(), VOLTS_DEADBAND);
+    m_Publisher.setDeadband(RotatorMotionNP.getName(), ETA_DEADBAND);
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // Communication
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -128,7 +236,6 @@ bool Beaver::initProperties()
     tcpConnection->setDefaultHost("192.168.1.1");
     tcpConnection->setDefaultPort(10000);
     tcpConnection->setConnectionType(Connection::TCP::TYPE_UDP);
-    tty_set_generic_udp_format(1);
     addDebugControl();
     return true;
 }
@@ -139,9 +246,8 @@ bool Beaver::updateProperties()
 
     if (isConnected())
     {
-        double curPark;
-        if (!sendCommand("!domerot getpark#", curPark))
-            return false;
+        // park as read (or cached) by the handshake
+        const double curPark = m_Settings.park;
         if (InitPark())
         {
             SetAxis1ParkDefault(curPark);
@@ -151,7 +257,18 @@ bool Beaver::updateProperties()
             SetAxis1Park(curPark);
             SetAxis1ParkDefault(curPark);
         }
+        setRotatorOperation(isParked() ? BeaverState::ROTATOR_OP_PARKED : BeaverState::ROTATOR_OP_IDLE,
+                            std::chrono::steady_clock::time_point());
+        setShutterActivity(BeaverState::SHUTTER_ACT_IDLE, std::chrono::steady_clock::time_point());
+        m_Battery.reset();
+        m_NextVoltsRead = std::chrono::steady_clock::time_point();
+        m_Publisher.reset();
         TimerHit();
+        startWatchdog();
+        if (m_RevalidateSettings) {
+            m_RevalidateSettings = false;
+            revalidateSettings();
+        }
 
         defineProperty(&VersionTP);
         defineProperty(&HomePositionNP);
@@ -159,13 +276,30 @@ bool Beaver::updateProperties()
         defineProperty(&RotatorCalibrationSP);
         defineProperty(&GotoHomeSP);
         defineProperty(&RotatorSettingsNP);
+        defineProperty(&GotoCoalesceNP);
+        loadConfig(true, GotoCoalesceNP.getName());
+        configureGotoCoalescing();
         defineProperty(&RotatorStatusTP);
-        if (shutterOnLine()) {
+        defineProperty(&RotatorMotionNP);
+        defineProperty(&PollStatsNP);
+        defineProperty(&PublishStatsNP);
+        defineProperty(&CommandStatsNP);
+        defineProperty(&LinkStatsNP);
+        defineProperty(&LinkRecoveryNP);
+        defineProperty(&GotoStatsNP);
+        defineProperty(&TelemetrySP);
+        if (TelemetrySP[TELEMETRY_ON].getState() == ISS_ON)
+            startTelemetry();
+        defineProperty(&StatusExportSP);
+        if (StatusExportSP[STATUS_EXPORT_ON].getState() == ISS_ON)
+            startStatusExport();
+        if (m_Settings.shutterValid) {
             defineProperty(&ShutterCalibrationSP);
             defineProperty(&ShutterSettingsNP);
             defineProperty(&ShutterSettingsTimeoutNP);
             defineProperty(&ShutterStatusTP);
             defineProperty(&ShutterVoltsNP);
+            defineProperty(&ShutterBatteryNP);
         }
     }
     else
@@ -176,26 +310,73 @@ bool Beaver::updateProperties()
         deleteProperty(HomePositionNP.getName());
         deleteProperty(HomeOptionsSP.getName());
         deleteProperty(RotatorSettingsNP.getName());
+        deleteProperty(GotoCoalesceNP.getName());
         deleteProperty(ShutterSettingsTimeoutNP.getName());
         deleteProperty(RotatorStatusTP.getName());
+        deleteProperty(RotatorMotionNP.getName());
         deleteProperty(ShutterCalibrationSP.getName());
         deleteProperty(ShutterSettingsNP.getName());
         deleteProperty(ShutterStatusTP.getName());
         deleteProperty(ShutterVoltsNP.getName());
+        deleteProperty(ShutterBatteryNP.getName());
+        deleteProperty(PollStatsNP.getName());
+        deleteProperty(PublishStatsNP.getName());
+        deleteProperty(CommandStatsNP.getName());
+        deleteProperty(LinkStatsNP.getName());
+        deleteProperty(LinkRecoveryNP.getName());
+        deleteProperty(GotoStatsNP.getName());
+        deleteProperty(TelemetrySP.getName());
+        deleteProperty(StatusExportSP.getName());
 
     }
     return true;
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+///
+//////////////////////////////////////////////////////////////////////////////
+void Beaver::ISGetProperties(const char *dev)
+{
+    INDI::Dome::ISGetProperties(dev);
+    defineProperty(&TraceSP);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 ///  Handshake
 //////////////////////////////////////////////////////////////////////////////
 bool Beaver::Handshake()
 {
+    // the last session's port is still open for its flash save
+    if (m_ClosingPort) {
+        LOG_WARN("Still saving settings from the last session, connect again in a moment");
+        return false;
+    }
+
+    m_Transport.attach(PortFD);
+    m_AbortPending = false;
+    m_Transport.clearInterrupt();
+    // the TCP plugin may be set to either TCP or UDP, the socket knows which
+    m_Datagram = m_Transport.isDatagram();
+    m_Rtt.reset();
+    updateLinkTiming();
+    // a trace goes on across a reconnect
+    if (TraceSP[TRACE_ON].getState() == ISS_ON && !m_Reconnecting)
+        startTrace();
+    // Same controller as before the link dropped, reconnectTimer reads its status
+    if (m_Reconnecting)
+        return true;
+
+    if (!m_IO.start()) {
+        LOG_ERROR("Failed to start I/O thread");
+        return false;
+    }
+
+    invalidateConfirmedSettings();
+
     if (echo()) {
-        // Check if shutter is online
-        if (shutterOnLine()) {
+        // Shutter online state as found by the handshake
+        if (m_Settings.shutterValid) {
             LOG_DEBUG("Shutter in online, enabling Dome has shutter property");
             SetDomeCapability(GetDomeCapability() | DOME_HAS_SHUTTER);
             return true;
@@ -203,9 +384,70 @@ bool Beaver::Handshake()
         return true;
     }
 
+    m_IO.stop();
+    stopTrace();
     return false;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+/// Disconnect: stop the I/O thread before the port goes away
+//////////////////////////////////////////////////////////////////////////////
+bool Beaver::Disconnect()
+{
+    stopWatchdog();
+    m_PollInFlight = false;
+    if (m_PollTimerID >= 0)
+        RemoveTimer(m_PollTimerID);
+    m_PollTimerID = -1;
+    m_PollDeadline = std::chrono::steady_clock::time_point();
+    stopMotionModel();
+    cancelGoto();
+    m_Telemetry.stop();
+    m_StatusExport.stop();
+
+    // A pending settings change would not survive a controller power cycle.
+    // The port stays open until the save went out, its completion closes it.
+    if (m_SaveFSTimerID >= 0) {
+        IERmTimer(m_SaveFSTimerID);
+        m_SaveFSTimerID = -1;
+        m_ClosingPort = true;
+        if (sendCommandAsync(BeaverProtocol::request<BeaverProtocol::CMD_SAVEFS>(), [this](bool rc, double)
+        {
+            if (!rc)
+                LOG_ERROR("dome could not savefs");
+            closePort();
+            INDI::Dome::Disconnect();
+        }))
+            return true;
+        m_ClosingPort = false;
+        LOG_ERROR("dome could not savefs");
+    }
+
+    closePort();
+    return INDI::Dome::Disconnect();
+}
+
+void Beaver::closePort()
+{
+    m_ClosingPort = false;
+    m_IO.stop();
+    stopTrace();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// BEAVER_DOMES=<n> in the driver's environment hosts n domes in this process
+//////////////////////////////////////////////////////////////////////////////
+std::vector<std::unique_ptr<Beaver>> Beaver::createDomes()
+{
+    const char *count = getenv("BEAVER_DOMES");
+    const int n = count ? std::max(1, std::min(atoi(count), MAX_DOMES)) : 1;
+
+    std::vector<std::unique_ptr<Beaver>> domes;
+    for (int i = 0; i < n; i++)
+        domes.emplace_back(new Beaver(i));
+    return domes;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 /// Set default name
 //////////////////////////////////////////////////////////////////////////////
@@ -219,51 +461,57 @@ const char *Beaver::getDefaultName()
 //////////////////////////////////////////////////////////////////////////////
 bool Beaver::echo()
 {
-    double res = 0;
-
     // retrieve the controller version from the dome
     char result[DRIVER_LEN] = {0};
-    if (!sendRawCommand("!seletek tversion#", result)) {
+    if (!sendRawCommand(BeaverProtocol::request<BeaverProtocol::CMD_VERSION>(), result)) {
         LOG_ERROR("Error getting version info");
         return false;
     }
-    std::string resString = result;
-    LOGF_DEBUG("Version string returned %s", resString.c_str());
-    std::regex e(R"(.*:\d*:(.*))");
-    std::sregex_iterator iter(resString.begin(), resString.end(), e);
-    VersionTP[0].setText((*iter)[1]);
-
-    // retrieve the current az from the dome
-    if (rotatorGetAz())
-        LOGF_INFO("Dome reports az: %.1f", DomeAbsPosN[0].value);
-    else
-        return false;
-
-    // retrieve the current home offset from the dome
-    if (!sendCommand("!domerot gethome#", res))
+    LOGF_DEBUG("Version string returned %s", result);
+    BeaverProtocol::Reply reply;
+    if (!BeaverProtocol::parseVersion(result, strlen(result), reply) || reply.type != BeaverProtocol::Reply::REPLY_VERSION)
+    {
+        LOGF_ERROR("Failed to process version: %s.", result);
         return false;
-    else {
-        HomePositionNP[0].setValue(res);
-        LOGF_INFO("Dome reports home offset: %f", res);
     }
+    VersionTP[0].setText(std::string(reply.payload, reply.payloadLen));
+    LOGF_DEBUG("Controller version %d.%d.%d", reply.version[0], reply.version[1], reply.version[2]);
 
-    // retrieve the current park position from the dome
-    if (!sendCommand("!domerot getpark#", res))
+    // retrieve the current az and whether the shutter is online, in one go
+    double az = 0, shutterIsUp = 0, status = 0;
+    std::vector<PipelinedQuery> queries =
+    {
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETAZ>(), &az, "Problem getting rotator position"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_SHUTTERISUP>(), &shutterIsUp, "Shutter status cmd errored out"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_STATUS>(), &status, "Status cmd errored out"}
+    };
+    if (!sendPipelined(queries)) {
+        for (const PipelinedQuery &query : queries) {
+            if (!query.ok)
+                LOG_ERROR(query.error);
+        }
         return false;
-    else {
-        SetAxis1Park(res);
-        LOGF_INFO("Dome reports park: %.1f", res);
+    }
+    DomeAbsPosN[0].value = az;
+    LOGF_INFO("Dome reports az: %.1f", az);
+    const bool shutterIsOnLine = shutterOnLine(static_cast<bool>(shutterIsUp), static_cast<uint16_t>(status));
+
+    // Same firmware on the same port: publish what we had, read it back once connected.
+    // Until then nothing counts as confirmed, every settings write goes out.
+    ControllerSettings settings;
+    if (loadSettingsCache(settings) && settings.shutterValid == shutterIsOnLine) {
+        LOG_INFO("Using cached controller settings");
+        invalidateConfirmedSettings();
+        applySettings(settings, false);
+        m_RevalidateSettings = true;
+        return true;
     }
 
-    // get current rotator settings
-    if (!rotatorGetSettings())
+    // home offset, park, rotator and shutter settings
+    if (!readSettings(settings))
         return false;
-
-    // get current shutter settings
-    if (shutterOnLine()) {
-        if (!shutterGetSettings())
-            return false;
-    }
+    applySettings(settings, true);
+    saveSettingsCache();
     return true;
 }
 
@@ -317,43 +565,96 @@ bool Beaver::ISNewSwitch(const char *dev, const char *name, ISState *states, cha
         {
             HomeOptionsSP.update(states, names, n);
             bool rc = false;
-            double newAz, curHome;
+            // Completes from the I/O thread
+            BeaverCommandQueue::Completion done = [this](bool ok)
+            {
+                HomeOptionsSP.setState(ok ? IPS_OK : IPS_ALERT);
+                HomeOptionsSP.apply();
+            };
             switch (HomeOptionsSP.findOnSwitchIndex())
             {
                 case HOMECURRENT:
-                    if (!sendCommand("!domerot getpark#", curHome))
-                        return false;
-                    newAz = 360.0 - curHome + rotatorGetAz();
-                    rc = rotatorSetHome(newAz);
-                    LOGF_DEBUG("New home az %.1f (from  360 - %1f + %1f)", newAz, curHome, rotatorGetAz());
-                    HomeOptionsSP.setState(rc ? IPS_BUSY : IPS_ALERT);
+                    rc = rotatorSetHomeCurrent(done);
                     break;
 
                 case HOMEDEFAULT:
-                    rc = rotatorSetHome(0.0);
-                    HomeOptionsSP.setState(rc ? IPS_OK : IPS_ALERT);
+                    rc = rotatorSetHome(0.0, done);
                     break;
             }
+            HomeOptionsSP.setState(rc ? IPS_BUSY : IPS_ALERT);
             HomeOptionsSP.apply();
             return true;
         }
 
+        /////////////////////////////////////////////
+        // Telemetry recording
+        /////////////////////////////////////////////
+        if (TelemetrySP.isNameMatch(name))
+        {
+            TelemetrySP.update(states, names, n);
+            if (TelemetrySP[TELEMETRY_ON].getState() == ISS_ON)
+                startTelemetry();
+            else {
+                m_Telemetry.stop();
+                TelemetrySP.setState(IPS_IDLE);
+            }
+            TelemetrySP.apply();
+            return true;
+        }
+
+        /////////////////////////////////////////////
+        // Shared memory status
+        /////////////////////////////////////////////
+        if (StatusExportSP.isNameMatch(name))
+        {
+            StatusExportSP.update(states, names, n);
+            if (StatusExportSP[STATUS_EXPORT_ON].getState() == ISS_ON)
+                startStatusExport();
+            else {
+                m_StatusExport.stop();
+                StatusExportSP.setState(IPS_IDLE);
+            }
+            StatusExportSP.apply();
+            return true;
+        }
+
+        /////////////////////////////////////////////
+        // Serial trace
+        /////////////////////////////////////////////
+        if (TraceSP.isNameMatch(name))
+        {
+            TraceSP.update(states, names, n);
+            if (TraceSP[TRACE_ON].getState() == ISS_ON) {
+                // otherwise it starts with the handshake
+                if (isConnected())
+                    startTrace();
+            }
+            else {
+                stopTrace();
+                TraceSP.setState(IPS_IDLE);
+            }
+            TraceSP.apply();
+            return true;
+        }
+
         /////////////////////////////////////////////
         // Shutter Calibration
         /////////////////////////////////////////////
         if (ShutterCalibrationSP.isNameMatch(name))
         {  //TEST
             ShutterCalibrationSP.update(states, names, n);
+            // Completes from the I/O thread
             bool rc = shutterFindHome();
-            if (rc)
-                setShutterState(SHUTTER_MOVING);
             ShutterCalibrationSP.setState(rc ? IPS_BUSY : IPS_ALERT);
             ShutterCalibrationSP.apply();
             return true;
         }
     }
 
-    return INDI::Dome::ISNewSwitch(dev, name, states, names, n);
+    // Park, abort and motion switches change the dome state, which sends the position itself
+    const bool rc = INDI::Dome::ISNewSwitch(dev, name, states, names, n);
+    m_Publisher.forget(DomeAbsPosNP.name);
+    return rc;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -369,26 +670,39 @@ bool Beaver::ISNewNumber(const char *dev, const char *name, double values[], cha
         if (RotatorSettingsNP.isNameMatch(name))
         {
             RotatorSettingsNP.update(values, names, n);
+            // Completes from the I/O thread unless nothing changed
             RotatorSettingsNP.setState(rotatorSetSettings(RotatorSettingsNP[ROTATOR_MAX_SPEED].getValue(),
                                                           RotatorSettingsNP[ROTATOR_MIN_SPEED].getValue(),
                                                           RotatorSettingsNP[ROTATOR_ACCELERATION].getValue(),
-                                                          RotatorSettingsNP[ROTATOR_TIMEOUT].getValue()
-                                                          ) ? IPS_OK : IPS_ALERT);
+                                                          RotatorSettingsNP[ROTATOR_TIMEOUT].getValue()));
             RotatorSettingsNP.apply();
             return true;
         }
 
+        /////////////////////////////////////////////
+        // Goto coalescing
+        /////////////////////////////////////////////
+        if (GotoCoalesceNP.isNameMatch(name))
+        {
+            GotoCoalesceNP.update(values, names, n);
+            configureGotoCoalescing();
+            GotoCoalesceNP.setState(IPS_OK);
+            GotoCoalesceNP.apply();
+            saveConfig(true, GotoCoalesceNP.getName());
+            return true;
+        }
+
         /////////////////////////////////////////////
         // Shutter Settings
         /////////////////////////////////////////////
         if (ShutterSettingsNP.isNameMatch(name))
         {
             ShutterSettingsNP.update(values, names, n);
+            // Completes from the I/O thread unless nothing changed
             ShutterSettingsNP.setState(shutterSetSettings(ShutterSettingsNP[SHUTTER_MAX_SPEED].getValue(),
                                                           ShutterSettingsNP[SHUTTER_MIN_SPEED].getValue(),
                                                           ShutterSettingsNP[SHUTTER_ACCELERATION].getValue(),
-                                                          ShutterSettingsNP[SHUTTER_SAFE_VOLTAGE].getValue()
-                                                          ) ? IPS_OK : IPS_ALERT);
+                                                          ShutterSettingsNP[SHUTTER_SAFE_VOLTAGE].getValue()));
             ShutterSettingsNP.apply();
             return true;
         }
@@ -399,12 +713,15 @@ bool Beaver::ISNewNumber(const char *dev, const char *name, double values[], cha
         if (HomePositionNP.isNameMatch(name))
         {
             HomePositionNP.update(values, names, n);
-            if (rotatorSetHome(HomePositionNP[0].getValue())) {
+            // Completes from the I/O thread
+            const bool rc = rotatorSetHome(HomePositionNP[0].getValue(), [this](bool ok)
+            {
+                HomePositionNP.setState(ok ? IPS_OK : IPS_ALERT);
                 HomePositionNP.apply();
-                return true;
-            }
-            else
-                return false;
+            });
+            HomePositionNP.setState(rc ? IPS_BUSY : IPS_ALERT);
+            HomePositionNP.apply();
+            return true;
         }
 
         ///////////////////////////////////////////////////////////////////////////////
@@ -412,19 +729,23 @@ bool Beaver::ISNewNumber(const char *dev, const char *name, double values[], cha
         ///////////////////////////////////////////////////////////////////////////////
         if (strcmp(name, ParkPositionNP.name) == 0) {
             IUUpdateNumber(&ParkPositionNP, values, names, n);
-            if (rotatorSetPark(ParkPositionN[AXIS_RA].value)) {
-                ParkPositionNP.s = IPS_OK;
-                SetAxis1Park(ParkPositionN[AXIS_RA].value);
+            // Completes from the I/O thread
+            const bool rc = rotatorSetPark(ParkPositionN[AXIS_RA].value, [this](bool ok)
+            {
+                ParkPositionNP.s = ok ? IPS_OK : IPS_ALERT;
                 IDSetNumber(&ParkPositionNP, nullptr);
-                return true;
-            }
-            else
-                return false;
+            });
+            ParkPositionNP.s = rc ? IPS_BUSY : IPS_ALERT;
+            IDSetNumber(&ParkPositionNP, nullptr);
+            return true;
         }
 
     }
 
-    return INDI::Dome::ISNewNumber(dev, name, values, names, n);
+    // The base class answers a position request by sending the position itself
+    const bool rc = INDI::Dome::ISNewNumber(dev, name, values, names, n);
+    m_Publisher.forget(DomeAbsPosNP.name);
+    return rc;
 
 }
 
@@ -433,323 +754,1284 @@ bool Beaver::ISNewNumber(const char *dev, const char *name, double values[], cha
 ///////////////////////////////////////////////////////////////////////////
 void Beaver::TimerHit()
 {
+    m_PollTimerID = -1;
     if (!isConnected()) {
         return;
     }
 
-    // Get Position and sets az pos field
-    rotatorGetAz();
-    LOGF_DEBUG("Rotator position: %f", DomeAbsPosN[0].value);
-
-    // Query rotator status
-    uint16_t domeStatus = 0;
-    if (!getDomeStatus(domeStatus)) {
-        LOG_ERROR("Could not get dome status");
-    }
-
-    ////////////////////////////////////////////
-    // Test for general dome errors
-    ////////////////////////////////////////////
-    if (domeStatus & DOME_STATUS_UNSAFE_CW) {
-        LOG_ERROR("CW Unsafe Error");
-        setDomeState(DOME_ERROR);
-        RotatorStatusTP.apply();
-    }
-    if (domeStatus & DOME_STATUS_UNSAFE_RG) {
-        LOG_ERROR("RGx Unsafe Error");
-        setDomeState(DOME_ERROR);
-        RotatorStatusTP.apply();
-    }
+    // the poll in flight re-arms the timer when it completes
+    if (m_PollInFlight)
+        return;
 
-    ////////////////////////////////////////////
-    // Test rotator and set status
-    ////////////////////////////////////////////
+    // Lateness against the fixed-rate deadline
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (m_PollDeadline == std::chrono::steady_clock::time_point())
+        m_PollDeadline = now;
+    const double jitter = fabs(std::chrono::duration<double, std::milli>(now - m_PollDeadline).count());
+    m_PollJitterMS += 0.1 * (jitter - m_PollJitterMS);
+    m_PollJitterMaxMS = std::max(m_PollJitterMaxMS, jitter);
+    m_PollStarted = now;
+
+    // Queries run on the I/O thread, the results are applied on the INDI thread
+    std::shared_ptr<DomeSnapshot> snapshot = std::make_shared<DomeSnapshot>();
+    // the voltage is read at the rate it changes, and every poll while the shutter moves
+    snapshot->readVolts = now >= m_NextVoltsRead || m_ShutterActivity == BeaverState::SHUTTER_ACT_OPENING ||
+                          m_ShutterActivity == BeaverState::SHUTTER_ACT_CLOSING ||
+                          m_ShutterActivity == BeaverState::SHUTTER_ACT_MOVING;
+    snapshot->parking = m_RotatorOp == BeaverState::ROTATOR_OP_PARKING;
+    m_PollInFlight = m_IO.submit([this, snapshot]()
+    {
+        return readSnapshot(*snapshot);
+    },
+    [this, snapshot](bool)
+    {
+        m_PollInFlight = false;
+        if (!isConnected())
+            return;
+        applySnapshot(*snapshot);
+        schedulePoll(pollPeriod(*snapshot));
+    });
+
+    if (!m_PollInFlight)
+        schedulePoll(getCurrentPollingPeriod());
+}
 
-    // Is rotator idle?
-    if (!(domeStatus & DOME_STATUS_ROTATOR_MOVING)) {
+///////////////////////////////////////////////////////////////////////////
+/// Poll fast while moving, back off while parked and closed
+///////////////////////////////////////////////////////////////////////////
+uint32_t Beaver::pollPeriod(const DomeSnapshot &snapshot)
+{
+    const uint32_t base = getCurrentPollingPeriod();
+    const uint16_t moving = DOME_STATUS_ROTATOR_MOVING | DOME_STATUS_SHUTTER_MOVING |
+                            DOME_STATUS_SHUTTER_OPENING | DOME_STATUS_SHUTTER_CLOSING;
 
-        // Dome Parked
-        if (rotatorIsParked() & (getDomeState() == DOME_PARKING))  {
-            SetParked(true);
-            //setDomeState(DOME_PARKED);
-            RotatorStatusTP[0].setText("Parked");
-            RotatorStatusTP.setState(IPS_OK);
-            LOG_DEBUG("Dome is parked.");
-        }
-        // Measuring Home completed
-        else if (!strcmp(RotatorStatusTP[0].getText(), "Measuring Home")) {
-            setDomeState(DOME_IDLE);
-            RotatorCalibrationSP.setState(IPS_OK);
-            RotatorCalibrationSP.apply();
-            RotatorStatusTP[0].setText("Home");
-            RotatorStatusTP.setState(IPS_OK);
-        }
-        // Finding Home completed
-        else if (!strcmp(RotatorStatusTP[0].getText(), "Finding Home")) {
-            setDomeState(DOME_IDLE);
-            RotatorCalibrationSP.setState(IPS_OK);
-            RotatorCalibrationSP.apply();
-            RotatorStatusTP[0].setText("Home");
-            RotatorStatusTP.setState(IPS_OK);
-        }
-        // Homing completed
-        else if (!strcmp(RotatorStatusTP[0].getText(), "Homing")) {
-            setDomeState(DOME_IDLE);
-            RotatorStatusTP[0].setText("Home");
-            RotatorStatusTP.setState(IPS_OK);
-            GotoHomeSP.setState(IPS_OK);
-            GotoHomeSP.apply();
-            LOG_DEBUG("Dome at home");
-        }
-        // Move completed
-        else if (getDomeState() == DOME_MOVING) {
-            RotatorStatusTP.apply();
-            setDomeState(DOME_IDLE);
-            RotatorCalibrationSP.setState(IPS_OK);
-            RotatorCalibrationSP.apply();
-            RotatorStatusTP[0].setText("Idle");
-            RotatorStatusTP.setState(IPS_OK);
-            LOG_DEBUG("Dome reached target position.");
+    if ((snapshot.status & moving) || getDomeState() == DOME_MOVING || getDomeState() == DOME_PARKING ||
+            getShutterState() == SHUTTER_MOVING)
+    {
+        // A slew the model can follow only needs fast polls near arrival
+        const uint16_t shutterMoving = DOME_STATUS_SHUTTER_MOVING | DOME_STATUS_SHUTTER_OPENING |
+                                       DOME_STATUS_SHUTTER_CLOSING;
+        if (m_Motion.isActive() && !(snapshot.status & shutterMoving) && getShutterState() != SHUTTER_MOVING)
+        {
+            const uint32_t etaMS = static_cast<uint32_t>(m_Motion.eta(std::chrono::steady_clock::now()) * 1000);
+            return std::min(base, std::max(POLL_FAST_MS, etaMS / 2));
         }
-        RotatorStatusTP.apply();
+        return std::min(base, POLL_FAST_MS);
     }
 
-    ////////////////////////////////////////////
-    // Test Shutter and set status
-    ////////////////////////////////////////////
-    if (shutterOnLine()) {
+    const uint16_t errors = DOME_STATUS_ROTATOR_ERROR | DOME_STATUS_SHUTTER_ERROR | DOME_STATUS_UNSAFE_CW |
+                            DOME_STATUS_UNSAFE_RG;
+    const bool parked = (snapshot.status & DOME_STATUS_ROTATOR_PARKED) && isParked();
+    const bool closed = !snapshot.shutterOnLine() || (snapshot.status & DOME_STATUS_SHUTTER_CLOSED);
+    if (snapshot.statusValid && parked && closed && !(snapshot.status & errors))
+        return std::max(base, std::min(base * POLL_PARKED_FACTOR, POLL_PARKED_MAX_MS));
 
-        // Test for shutter error
-        if (domeStatus & DOME_STATUS_SHUTTER_ERROR) {
-            LOG_ERROR("Shutter Mechanical Error");
-            ShutterStatusTP[0].setText("Mechanical Error");
-            ShutterStatusTP.apply();
-            setShutterState(SHUTTER_ERROR);
-        }
+    return base;
+}
 
-        // If moving, set status
-        if (getShutterState() == SHUTTER_MOVING) {
+///////////////////////////////////////////////////////////////////////////
+/// Arm the timer for the next fixed-rate deadline
+///////////////////////////////////////////////////////////////////////////
+void Beaver::schedulePoll(uint32_t periodMS)
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const std::chrono::milliseconds period(periodMS);
+
+    // Deadlines advance by whole periods so the poll time does not add up as drift.
+    // If the poll overran, skip to the next slot rather than firing back to back.
+    std::chrono::steady_clock::time_point next = m_PollDeadline + period;
+    bool overrun = false;
+    if (next <= now) {
+        overrun = true;
+        m_PollOverruns++;
+        while (next <= now)
+            next += period;
+    }
+    m_PollDeadline = next;
 
-            if (domeStatus & DOME_STATUS_SHUTTER_OPENING) {
-                setShutterState(SHUTTER_MOVING);
-                ShutterStatusTP[0].setText("Opening");
-                LOG_DEBUG("Shutter state set to Opening");
-            }
-            else if (domeStatus & DOME_STATUS_SHUTTER_CLOSING) {
-                setShutterState(SHUTTER_MOVING);
-                ShutterStatusTP[0].setText("Closing");
-                LOG_DEBUG("Shutter state set to Closing");
-            }
-            else if (domeStatus & DOME_STATUS_SHUTTER_MOVING) {
-                setShutterState(SHUTTER_MOVING);
-                ShutterStatusTP[0].setText("Moving");
-                LOG_DEBUG("Shutter is moving");
-            }
+    PollStatsNP[POLL_PERIOD].setValue(periodMS);
+    PollStatsNP[POLL_DURATION].setValue(std::chrono::duration<double, std::milli>(now - m_PollStarted).count());
+    // a desync is reported straight away
+    publishPollStats(overrun || m_Desyncs != LinkStatsNP[LINK_DESYNCS].getValue());
 
-        }
+    const long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+    m_PollTimerID = SetTimer(static_cast<uint32_t>(std::max(1LL, wait)));
+}
 
-        // if stopped, test if opened or closed
-        if (domeStatus & DOME_STATUS_SHUTTER_OPENED) {
-            setShutterState(SHUTTER_OPENED);
-            ShutterStatusTP[0].setText("Open");
-            LOG_DEBUG("Shutter state set to OPEN");
-        }
-        if (domeStatus & DOME_STATUS_SHUTTER_CLOSED) {
-            setShutterState(SHUTTER_CLOSED);
-            ShutterStatusTP[0].setText("Closed");
-            LOG_DEBUG("Shutter state set to CLOSED");
-        }
-        ShutterStatusTP.apply();
+///////////////////////////////////////////////////////////////////////////
+///
+///////////////////////////////////////////////////////////////////////////
+void Beaver::pollSoon()
+{
+    // a poll in flight picks the fast rate from the dome state when it completes
+    if (m_PollInFlight || m_PollTimerID < 0)
+        return;
 
-        // Update shutter voltage
-        double res;
-        // ignoring a random get voltage cmd error here and just reporting successful status
-        if (sendCommand("!dome getshutterbatvoltage#", res)) {
-            LOGF_DEBUG("Shutter voltage currently is: %.2f", res);
-            ShutterVoltsNP[0].setValue(res);
-            (res < ShutterSettingsNP[SHUTTER_SAFE_VOLTAGE].getValue()) ? ShutterVoltsNP.setState(IPS_ALERT) : ShutterVoltsNP.setState(IPS_OK);
-            ShutterVoltsNP.apply();
-        }
-    }
+    const std::chrono::steady_clock::time_point soon = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(POLL_FAST_MS);
+    if (soon >= m_PollDeadline)
+        return;
 
-    SetTimer(getCurrentPollingPeriod());
+    RemoveTimer(m_PollTimerID);
+    m_PollDeadline = soon;
+    m_PollTimerID = SetTimer(POLL_FAST_MS);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-/// Rotator absolute move
-//////////////////////////////////////////////////////////////////////////////
-IPState Beaver::MoveAbs(double az)
+///////////////////////////////////////////////////////////////////////////
+/// Link watchdog: a dead port is closed and reopened with backoff, and what
+/// the dome was doing when it dropped is put back
+///////////////////////////////////////////////////////////////////////////
+void Beaver::startWatchdog()
 {
-    if (rotatorGotoAz(az))
-    {
-        m_TargetRotatorAz = az;
-        setDomeState(DOME_MOVING);
-        RotatorStatusTP[0].setText("Moving");
-        RotatorStatusTP.apply();
-        return IPS_BUSY;
-    }
-    return IPS_ALERT;
+    m_ConsecutiveFailures = 0;
+    m_LastReplyNS = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (m_WatchdogTimerID < 0)
+        m_WatchdogTimerID = IEAddTimer(WATCHDOG_PERIOD_MS, watchdogTimerHelper, this);
+    publishLinkRecovery();
 }
 
-//////////////////////////////////////////////////////////////////////////////
-/// Rotator relative move (calc's offset and calles abs move)
-//////////////////////////////////////////////////////////////////////////////
-IPState Beaver::MoveRel(double azDiff)
+void Beaver::stopWatchdog()
 {
-
-    azDiff = domeDir * azDiff;
-    m_TargetRotatorAz = DomeAbsPosN[0].value + azDiff;
-
-    if (m_TargetRotatorAz < DomeAbsPosN[0].min)
-        m_TargetRotatorAz += DomeAbsPosN[0].max;
-    if (m_TargetRotatorAz > DomeAbsPosN[0].max)
-        m_TargetRotatorAz -= DomeAbsPosN[0].max;
-    LOGF_DEBUG("Requested rel move of %.1f", azDiff);
-    lastAzDiff = fabs(azDiff);
-    return MoveAbs(m_TargetRotatorAz);
+    if (m_WatchdogTimerID >= 0)
+        IERmTimer(m_WatchdogTimerID);
+    m_WatchdogTimerID = -1;
+    if (m_ReconnectTimerID >= 0)
+        IERmTimer(m_ReconnectTimerID);
+    m_ReconnectTimerID = -1;
+    m_LinkDown = false;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-/// Rotator move (calc's offset and calles abs move)
-//////////////////////////////////////////////////////////////////////////////
-IPState Beaver::Move(DomeDirection dir, DomeMotionCommand operation)
- {
-    LOG_DEBUG("Re-implemented move was called");
-     if (operation == MOTION_START)
-     {
-         if (dir == DOME_CW) {
-             domeDir = 1;
-         }
-         else {
-             domeDir = -1;
-         }
-         MoveRel(lastAzDiff);
-
-     }
-     return IPS_OK;
- }
+void Beaver::watchdogTimerHelper(void *context)
+{
+    static_cast<Beaver *>(context)->watchdogTimer();
+}
 
-//////////////////////////////////////////////////////////////////////////////
-/// open or close the shutter (will not show if shutter is not present)
-//////////////////////////////////////////////////////////////////////////////
-IPState Beaver::ControlShutter(ShutterOperation operation)
+void Beaver::watchdogTimer()
 {
-    double res = 0;
-    if (operation == SHUTTER_OPEN)
-    {
-        if (sendCommand("!dome openshutter#", res)) {
-            setShutterState(SHUTTER_MOVING);
-            return IPS_BUSY;
-        }
-        else
-            return IPS_ALERT;
+    m_WatchdogTimerID = -1;
+    if (!isConnected() || m_LinkDown)
+        return;
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::time_point lastReply(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(m_LastReplyNS)));
+    const uint32_t failures = m_ConsecutiveFailures;
+    const std::chrono::milliseconds heartbeat(std::max<uint32_t>(WATCHDOG_HEARTBEAT_MS,
+            3 * static_cast<uint32_t>(PollStatsNP[POLL_PERIOD].getValue())));
+    if (failures >= WATCHDOG_FAILURES) {
+        LOGF_WARN("Controller link lost, %u commands failed in a row. Reconnecting...", failures);
+        linkLost(lastReply);
+        return;
     }
-    else if (operation == SHUTTER_CLOSE)
-    {
-        if (sendCommand("!dome closeshutter#", res)) {
-            setShutterState(SHUTTER_MOVING);
-            return IPS_BUSY;
-        }
-        else
-            return IPS_ALERT;
+    if (now - lastReply > heartbeat) {
+        LOGF_WARN("Controller link lost, no reply for %.0f s. Reconnecting...",
+                  std::chrono::duration<double>(now - lastReply).count());
+        linkLost(lastReply);
+        return;
     }
-    return IPS_ALERT;
+    m_WatchdogTimerID = IEAddTimer(WATCHDOG_PERIOD_MS, watchdogTimerHelper, this);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-/// INDI save config
-//////////////////////////////////////////////////////////////////////////////
-bool Beaver::saveConfigItems(FILE *fp)
+void Beaver::linkLost(std::chrono::steady_clock::time_point outageStart)
 {
-    INDI::Dome::saveConfigItems(fp);
-    return true;
+    m_LinkDown = true;
+    m_LinkDownSince = outageStart;
+    m_LinkOutages++;
+    m_ReconnectAttempts = 0;
+    m_ReconnectDelayMS = RECONNECT_MIN_MS;
+
+    // Queued commands are dropped; the driver state they were for is kept.
+    // The exchange that hung is cut short so the join does not wait out its deadline.
+    m_Transport.interrupt();
+    m_IO.stop();
+    m_PollInFlight = false;
+    if (m_PollTimerID >= 0)
+        RemoveTimer(m_PollTimerID);
+    m_PollTimerID = -1;
+    stopMotionModel();
+    cancelGoto();
+    getActiveConnection()->Disconnect();
+    m_Transport.detach();
+
+    publishLinkRecovery();
+    m_ReconnectTimerID = IEAddTimer(0, reconnectTimerHelper, this);
 }
 
-/////////////////////////////////////////////////////////////////////////////
-/// tells rotator to goto az pos
-/////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorGotoAz(double az)
+void Beaver::reconnectTimerHelper(void *context)
 {
-    char cmd[DRIVER_LEN] = {0};
-    double res = 0;
-    snprintf(cmd, DRIVER_LEN, "!dome gotoaz %.2f#", az);
-    setDomeState(DOME_MOVING);
-    RotatorStatusTP[0].setText("Moving");
-    RotatorStatusTP.apply();
-    return sendCommand(cmd, res);
+    static_cast<Beaver *>(context)->reconnectTimer();
 }
 
-/////////////////////////////////////////////////////////////////////////////
-/// get rotator az position
-/////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorGetAz()
+void Beaver::reconnectTimer()
 {
-    double res = 0;
-    if (sendCommand("!dome getaz#", res))
+    m_ReconnectTimerID = -1;
+    if (!isConnected() || !m_LinkDown)
+        return;
+
+    // The connection plugin reopens the port and calls Handshake, which only attaches it.
+    // Opening the serial port or the UDP socket does not block, the status read does and
+    // goes to the I/O thread. Commands submitted meanwhile queue up behind it.
+    m_ReconnectAttempts++;
+    m_Reconnecting = true;
+    const bool opened = getActiveConnection()->Connect();
+    m_Reconnecting = false;
+    if (!opened) {
+        m_Transport.detach();
+        reconnectLater();
+        return;
+    }
+
+    const unsigned generation = m_MotionGeneration;
+    if (!m_IO.start() || !m_IO.submit([this]()
     {
-        DomeAbsPosN[0].value = res;
-        IDSetNumber(&DomeAbsPosNP, nullptr);
-        return true;
+        m_ResumeSnapshot = DomeSnapshot();
+        m_ResumeSnapshot.readVolts = false;
+        return readSnapshot(m_ResumeSnapshot);
+    },
+    [this, generation](bool connected)
+    {
+        if (connected) {
+            // An abort during the outage wins over resuming what it stopped
+            restoreLink(generation != m_MotionGeneration);
+            return;
+        }
+        // Nothing queued may run until the port is back
+        m_IO.stop();
+        getActiveConnection()->Disconnect();
+        m_Transport.detach();
+        reconnectLater();
+    }))
+    {
+        LOG_ERROR("Failed to start I/O thread");
+        getActiveConnection()->Disconnect();
+        m_Transport.detach();
+        reconnectLater();
     }
-    return false;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-/// Set home offset
-/////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorSetHome(double az)
+void Beaver::reconnectLater()
 {
-    char cmd[DRIVER_LEN] = {0};
-    double res = 0;
-    snprintf(cmd, DRIVER_LEN, "!domerot sethome %.2f#", az);
-    if (sendCommand(cmd, res)) {
-        LOGF_INFO("Home is set to: %.1f", az);
-        return true;
-    }
-    return false;
+    LOGF_DEBUG("Reconnect attempt %u failed, next in %u ms", m_ReconnectAttempts, m_ReconnectDelayMS);
+    m_ReconnectTimerID = IEAddTimer(m_ReconnectDelayMS, reconnectTimerHelper, this);
+    m_ReconnectDelayMS = std::min(m_ReconnectDelayMS * 2, RECONNECT_MAX_MS);
 }
 
-/////////////////////////////////////////////////////////////////////////////
-/// Rotator park
-/////////////////////////////////////////////////////////////////////////////
-IPState Beaver::Park()
+void Beaver::restoreLink(bool aborted)
 {
-    double res;
-    if (sendCommand("!dome gopark#", res)) {
-        RotatorStatusTP[0].setText("Parking");
-        RotatorStatusTP.apply();
-        // check shutter policy
-        if (shutterOnLine() && (ShutterParkPolicyS[SHUTTER_CLOSE_ON_PARK].s == ISS_ON)) {
-            if(ControlShutter(SHUTTER_CLOSE)) {
-                DomeShutterS[SHUTTER_OPEN].s = ISS_OFF;
-                DomeShutterS[SHUTTER_CLOSE].s = ISS_ON;
-                setShutterState(SHUTTER_MOVING);
-            }
-            else
-                return IPS_ALERT;
+    const double recoveryS = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_LinkDownSince).count();
+    m_LinkDown = false;
+    m_LinkRecoveries++;
+    m_LinkRecoveryTotalS += recoveryS;
+    LinkRecoveryNP[RECOVERY_LAST].setValue(recoveryS);
+    LOGF_INFO("Controller link restored after %.1f s, %u reconnect attempts", recoveryS, m_ReconnectAttempts);
+
+    // Queued before the first poll, which would otherwise conclude the interrupted operations are over
+    const DomeSnapshot &snapshot = m_ResumeSnapshot;
+    const uint16_t status = snapshot.status;
+    if (aborted)
+        LOG_INFO("Aborted during the outage, nothing to resume");
+    else if (!(status & DOME_STATUS_ROTATOR_MOVING)) {
+        if (m_RotatorOp == BeaverState::ROTATOR_OP_MOVING) {
+            LOGF_INFO("Resuming rotator goto %.2f", m_TargetRotatorAz);
+            if (!rotatorGotoAz(m_TargetRotatorAz))
+                LOG_ERROR("Could not resume the rotator goto");
         }
+        else if ((m_RotatorOp == BeaverState::ROTATOR_OP_PARKING || isParked()) &&
+                 !(status & DOME_STATUS_ROTATOR_PARKED)) {
+            LOG_INFO("Resuming park");
+            BeaverCommandQueue::Completion done = [this](bool rc)
+            {
+                if (!rc)
+                    LOG_ERROR("Could not resume parking");
+            };
+            if (!rotatorCommand(BeaverProtocol::request<BeaverProtocol::CMD_GOPARK>(), BeaverState::ROTATOR_OP_PARKING, done))
+                done(false);
+        }
+    }
+    const uint16_t shutterMoving = DOME_STATUS_SHUTTER_MOVING | DOME_STATUS_SHUTTER_OPENING | DOME_STATUS_SHUTTER_CLOSING;
+    if (!aborted && snapshot.shutterOnLine() && !(status & shutterMoving)) {
+        if (m_ShutterActivity == BeaverState::SHUTTER_ACT_OPENING && !(status & DOME_STATUS_SHUTTER_OPENED)) {
+            LOG_INFO("Resuming shutter open");
+            ControlShutter(SHUTTER_OPEN);
+        }
+        else if (m_ShutterActivity == BeaverState::SHUTTER_ACT_CLOSING && !(status & DOME_STATUS_SHUTTER_CLOSED)) {
+            LOG_INFO("Resuming shutter close");
+            ControlShutter(SHUTTER_CLOSE);
+        }
+    }
+    m_Publisher.flush();
+
+    publishLinkRecovery();
+    m_PollDeadline = std::chrono::steady_clock::time_point();
+    TimerHit();
+    m_WatchdogTimerID = IEAddTimer(WATCHDOG_PERIOD_MS, watchdogTimerHelper, this);
+}
+
+void Beaver::publishLinkRecovery()
+{
+    LinkRecoveryNP[RECOVERY_OUTAGES].setValue(m_LinkOutages);
+    LinkRecoveryNP[RECOVERY_COUNT].setValue(m_LinkRecoveries);
+    LinkRecoveryNP[RECOVERY_MEAN].setValue(m_LinkRecoveries > 0 ? m_LinkRecoveryTotalS / m_LinkRecoveries : 0);
+    LinkRecoveryNP.setState(m_LinkDown ? IPS_ALERT : IPS_OK);
+    LinkRecoveryNP.apply();
+}
+
+///////////////////////////////////////////////////////////////////////////
+///
+///////////////////////////////////////////////////////////////////////////
+void Beaver::publishPollStats(bool force)
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!force && now - m_PollStatsPublished < std::chrono::milliseconds(POLL_STATS_INTERVAL_MS))
+        return;
+
+    m_PollStatsPublished = now;
+    PollStatsNP[POLL_JITTER].setValue(m_PollJitterMS);
+    PollStatsNP[POLL_JITTER_MAX].setValue(m_PollJitterMaxMS);
+    PollStatsNP[POLL_OVERRUNS].setValue(m_PollOverruns);
+    PollStatsNP.setState(m_PollOverruns > 0 ? IPS_BUSY : IPS_OK);
+    PollStatsNP.apply();
+
+    PublishStatsNP[PUBLISH_SENT].setValue(m_Publisher.sent());
+    PublishStatsNP[PUBLISH_SUPPRESSED].setValue(m_Publisher.suppressed());
+    PublishStatsNP.setState(IPS_OK);
+    PublishStatsNP.apply();
+
+    publishCommandStats();
+
+    const uint32_t desyncs = m_Desyncs;
+    LinkStatsNP.setState(desyncs != LinkStatsNP[LINK_DESYNCS].getValue() ? IPS_ALERT : IPS_OK);
+    LinkStatsNP[LINK_DESYNCS].setValue(desyncs);
+    LinkStatsNP[LINK_STALE_BYTES].setValue(m_StaleBytes);
+    const uint64_t requests = m_LinkRequests, lost = m_LinkLost;
+    LinkStatsNP[LINK_REQUESTS].setValue(requests);
+    LinkStatsNP[LINK_LOST].setValue(lost);
+    LinkStatsNP[LINK_LOSS].setValue(requests > 0 ? 100.0 * lost / requests : 0);
+    LinkStatsNP[LINK_RETRANSMITS].setValue(m_LinkRetransmits);
+    LinkStatsNP[LINK_SRTT].setValue(m_LinkSRTT);
+    LinkStatsNP[LINK_RTTVAR].setValue(m_LinkRTTVAR);
+    LinkStatsNP[LINK_RTO].setValue(m_LinkRTO);
+    LinkStatsNP.apply();
+
+    GotoStatsNP[GOTO_SENT].setValue(m_Goto.sent());
+    GotoStatsNP[GOTO_COVERED].setValue(m_Goto.covered());
+    GotoStatsNP[GOTO_SUPERSEDED].setValue(m_Goto.superseded());
+    GotoStatsNP.setState(IPS_OK);
+    GotoStatsNP.apply();
+}
+
+// Copied out of the estimator for the INDI thread (I/O thread)
+void Beaver::updateLinkTiming()
+{
+    m_LinkSRTT = m_Rtt.srtt();
+    m_LinkRTTVAR = m_Rtt.rttvar();
+    m_LinkRTO = m_Rtt.timeout();
+}
+
+void Beaver::publishCommandStats()
+{
+    bool failures = false;
+    for (int i = 0; i < BeaverProtocol::CLASS_COUNT; i++)
+    {
+        const int base = i * COMMAND_STAT_COUNT;
+        CommandStatsNP[base + COMMAND_TIMEOUTS].setValue(m_CommandStats[i].timeouts);
+        CommandStatsNP[base + COMMAND_RETRIES].setValue(m_CommandStats[i].retries);
+        CommandStatsNP[base + COMMAND_FAILURES].setValue(m_CommandStats[i].failures);
+        failures = failures || m_CommandStats[i].failures > 0;
+    }
+    CommandStatsNP.setState(failures ? IPS_BUSY : IPS_OK);
+    CommandStatsNP.apply();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Change-only publication
+///////////////////////////////////////////////////////////////////////////
+void Beaver::publish(INDI::PropertyNumber &property)
+{
+    std::vector<double> values(property.size());
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = property[i].getValue();
+    m_Publisher.update(property.getName(), property.getState(), values, [&property]()
+    {
+        property.apply();
+    });
+}
+
+void Beaver::publish(INDI::PropertyText &property)
+{
+    std::string text;
+    for (size_t i = 0; i < property.size(); i++)
+        text.append(property[i].getText()).push_back(0);
+    m_Publisher.update(property.getName(), property.getState(), text, [&property]()
+    {
+        property.apply();
+    });
+}
+
+void Beaver::publish(INumberVectorProperty &property)
+{
+    std::vector<double> values(property.nnp);
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = property.np[i].value;
+    m_Publisher.update(property.name, property.s, values, [&property]()
+    {
+        IDSetNumber(&property, nullptr);
+    });
+}
+
+void Beaver::updateDomeState(const DomeState &state)
+{
+    setDomeState(state);
+    // sent the position around the publisher
+    m_Publisher.forget(DomeAbsPosNP.name);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Motion model speeds come straight from the controller settings
+///////////////////////////////////////////////////////////////////////////
+void Beaver::configureMotionModel()
+{
+    m_Motion.configure(RotatorSettingsNP[ROTATOR_MAX_SPEED].getValue(), RotatorSettingsNP[ROTATOR_MIN_SPEED].getValue(),
+                       RotatorSettingsNP[ROTATOR_ACCELERATION].getValue(), RotatorSettingsNP[ROTATOR_TIMEOUT].getValue());
+}
+
+///////////////////////////////////////////////////////////////////////////
+///
+///////////////////////////////////////////////////////////////////////////
+void Beaver::stopMotionModel()
+{
+    if (m_MotionTimerID >= 0)
+        IERmTimer(m_MotionTimerID);
+    m_MotionTimerID = -1;
+
+    if (!m_Motion.isActive())
+        return;
+    m_Motion.stop();
+    RotatorMotionNP[ROTATOR_MOTION_ETA].setValue(0);
+    RotatorMotionNP.setState(IPS_IDLE);
+    publish(RotatorMotionNP);
+    m_Publisher.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////
+///
+///////////////////////////////////////////////////////////////////////////
+void Beaver::publishMotion(std::chrono::steady_clock::time_point now)
+{
+    RotatorMotionNP[ROTATOR_MOTION_TARGET].setValue(m_Motion.targetAz());
+    RotatorMotionNP[ROTATOR_MOTION_ETA].setValue(m_Motion.eta(now));
+    RotatorMotionNP.setState(IPS_BUSY);
+    publish(RotatorMotionNP);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Predicted azimuth between polls, the next reading corrects it
+///////////////////////////////////////////////////////////////////////////
+void Beaver::motionTimerHelper(void *context)
+{
+    static_cast<Beaver *>(context)->motionTimer();
+}
+
+void Beaver::motionTimer()
+{
+    m_MotionTimerID = -1;
+    if (!isConnected() || !m_Motion.isActive())
+        return;
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    DomeAbsPosN[0].value = m_Motion.predictAz(now);
+    publish(DomeAbsPosNP);
+    publishMotion(now);
+    m_Publisher.flush();
+    m_MotionTimerID = IEAddTimer(POLL_FAST_MS, motionTimerHelper, this);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Deferred gotos, newest target only
+///////////////////////////////////////////////////////////////////////////
+void Beaver::configureGotoCoalescing()
+{
+    m_Goto.configure(GotoCoalesceNP[GOTO_TOLERANCE].getValue(), GotoCoalesceNP[GOTO_INTERVAL].getValue());
+}
+
+void Beaver::scheduleGoto()
+{
+    if (m_GotoTimerID >= 0)
+        return;
+    const std::chrono::steady_clock::duration wait = m_Goto.pendingDue() - std::chrono::steady_clock::now();
+    const long long waitMS = std::chrono::duration_cast<std::chrono::milliseconds>(wait).count();
+    m_GotoTimerID = IEAddTimer(static_cast<int>(std::max(1LL, waitMS)), gotoTimerHelper, this);
+}
+
+void Beaver::gotoTimerHelper(void *context)
+{
+    static_cast<Beaver *>(context)->gotoTimer();
+}
+
+void Beaver::gotoTimer()
+{
+    m_GotoTimerID = -1;
+    double az = 0;
+    if (!isConnected() || !m_Goto.takePending(az))
+        return;
+    LOGF_DEBUG("Sending deferred rotator goto %.2f", az);
+    if (!rotatorGotoAz(az)) {
+        DomeAbsPosNP.s = IPS_ALERT;
+        publish(DomeAbsPosNP);
+        m_Publisher.flush();
+    }
+}
+
+void Beaver::cancelGoto()
+{
+    m_Goto.reset();
+    if (m_GotoTimerID >= 0)
+        IERmTimer(m_GotoTimerID);
+    m_GotoTimerID = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Publish one poll snapshot (INDI thread)
+///////////////////////////////////////////////////////////////////////////
+void Beaver::applySnapshot(const DomeSnapshot &snapshot)
+{
+    if (snapshot.azValid) {
+        DomeAbsPosN[0].value = snapshot.az;
+        publish(DomeAbsPosNP);
+        m_Motion.correct(snapshot.az, snapshot.timestamp);
+    }
+
+    if (!snapshot.statusValid) {
+        LOG_ERROR("Could not get dome status");
+        m_Publisher.flush();
+        return;
+    }
+
+    if (m_Motion.isActive()) {
+        if (snapshot.status & DOME_STATUS_ROTATOR_MOVING)
+            publishMotion(snapshot.timestamp);
+        else
+            stopMotionModel();
+    }
+
+    // Rotator and shutter decisions are made on the same readings
+    m_Snapshot = snapshot;
+
+    updateRotatorState(snapshot);
+
+    if (snapshot.shutterOnLine())
+        updateShutterState(snapshot);
+
+    recordTelemetry(snapshot);
+    exportStatus(snapshot);
+    m_Publisher.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// One fixed size record per poll, nothing formatted or allocated here
+///////////////////////////////////////////////////////////////////////////
+void Beaver::recordTelemetry(const DomeSnapshot &snapshot)
+{
+    if (!m_Telemetry.isRunning())
+        return;
+
+    TelemetryRecord record;
+    memset(&record, 0, sizeof(record));
+    record.timeUS = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.az = snapshot.az;
+    record.targetAz = m_TargetRotatorAz;
+    record.shutterVolts = snapshot.shutterVolts;
+    record.status = snapshot.status;
+    record.rotatorOp = static_cast<uint8_t>(m_RotatorOp);
+    record.shutterActivity = static_cast<uint8_t>(m_ShutterActivity);
+    record.flags = (snapshot.azValid ? TelemetryRecord::AZ_VALID : 0) |
+                   (snapshot.statusValid ? TelemetryRecord::STATUS_VALID : 0) |
+                   (snapshot.shutterVoltsValid ? TelemetryRecord::VOLTS_VALID : 0) |
+                   (snapshot.shutterOnLine() ? TelemetryRecord::SHUTTER_ONLINE : 0);
+    m_Telemetry.record(record);
+}
+
+void Beaver::startTelemetry()
+{
+    const char *home = getenv("HOME");
+    const std::string path = std::string(home ? home : "/tmp") + "/.indi/" + getDeviceName() + "_telemetry";
+    if (m_Telemetry.start(path)) {
+        LOGF_INFO("Recording telemetry to %s", path.c_str());
+        TelemetrySP.setState(IPS_OK);
+    }
+    else {
+        LOGF_ERROR("Could not open telemetry file %s: %s", path.c_str(), strerror(errno));
+        TelemetrySP.setState(IPS_ALERT);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Same readings as the telemetry record, for readers on this machine
+///////////////////////////////////////////////////////////////////////////
+void Beaver::exportStatus(const DomeSnapshot &snapshot)
+{
+    if (!m_StatusExport.isRunning())
+        return;
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    BeaverShmStatus status;
+    memset(&status, 0, sizeof(status));
+    status.timeUS = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+    status.tick = ++m_StatusExportTick;
+    status.az = snapshot.az;
+    status.targetAz = m_TargetRotatorAz;
+    status.etaS = m_Motion.isActive() ? m_Motion.eta(now) : 0;
+    status.shutterVolts = snapshot.shutterVolts;
+    status.status = snapshot.status;
+    status.rotatorOp = static_cast<uint8_t>(m_RotatorOp);
+    status.shutterActivity = static_cast<uint8_t>(m_ShutterActivity);
+    status.flags = BeaverShmStatus::CONNECTED |
+                   (snapshot.azValid ? BeaverShmStatus::AZ_VALID : 0) |
+                   (snapshot.statusValid ? BeaverShmStatus::STATUS_VALID : 0) |
+                   (snapshot.shutterVoltsValid ? BeaverShmStatus::VOLTS_VALID : 0) |
+                   (snapshot.shutterOnLine() ? BeaverShmStatus::SHUTTER_ONLINE : 0);
+    m_StatusExport.publish(status);
+}
+
+void Beaver::startStatusExport()
+{
+    m_StatusExportTick = 0;
+    if (m_StatusExport.start(getDeviceName())) {
+        LOGF_INFO("Publishing status to shared memory %s", BeaverShm::segmentName(getDeviceName()).c_str());
+        StatusExportSP.setState(IPS_OK);
+    }
+    else {
+        LOGF_ERROR("Could not create shared memory %s: %s", BeaverShm::segmentName(getDeviceName()).c_str(), strerror(errno));
+        StatusExportSP.setState(IPS_ALERT);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Serial trace, a new file per connection or per switch on
+///////////////////////////////////////////////////////////////////////////
+void Beaver::startTrace()
+{
+    const char *home = getenv("HOME");
+    char stamp[32];
+    const time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &local);
+    const std::string path = std::string(home ? home : "/tmp") + "/.indi/" + getDeviceName() + "_" + stamp + ".trace";
+
+    stopTrace();
+    std::shared_ptr<int> error = std::make_shared<int>(0);
+    const BeaverCommandQueue::Work openTrace = [this, path, error]()
+    {
+        const bool rc = m_Trace.open(path);
+        *error = errno;
+        return rc;
+    };
+    const BeaverCommandQueue::Completion opened = [this, path, error](bool rc)
+    {
+        if (rc) {
+            LOGF_INFO("Recording serial trace to %s", path.c_str());
+            TraceSP.setState(IPS_OK);
+        }
+        else {
+            LOGF_ERROR("Could not open serial trace %s: %s", path.c_str(), strerror(*error));
+            if (m_TracePath == path)
+                m_TracePath.clear();
+            TraceSP.setState(IPS_ALERT);
+        }
+        TraceSP.apply();
+    };
+
+    // set now so a stop queued behind the open closes it
+    m_TracePath = path;
+    TraceSP.setState(IPS_BUSY);
+    // the I/O thread owns the trace while it runs
+    if (!m_IO.isRunning() || !m_IO.submit(openTrace, opened))
+        opened(openTrace());
+}
+
+void Beaver::stopTrace()
+{
+    const std::string path = m_TracePath;
+    m_TracePath.clear();
+    if (path.empty()) {
+        // a close still queued when the I/O thread stopped went with the queue
+        if (!m_IO.isRunning())
+            m_Trace.close();
+        return;
+    }
+
+    std::shared_ptr<uint64_t> frames = std::make_shared<uint64_t>(0);
+    const BeaverCommandQueue::Work closeTrace = [this, frames]()
+    {
+        *frames = m_Trace.frames();
+        m_Trace.close();
+        return true;
+    };
+    const BeaverCommandQueue::Completion closed = [this, path, frames](bool)
+    {
+        LOGF_INFO("Serial trace of %llu frames saved to %s", static_cast<unsigned long long>(*frames), path.c_str());
+    };
+    if (!m_IO.isRunning() || !m_IO.submit(closeTrace, closed))
+        closed(closeTrace());
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Query everything a poll tick needs, each at most once (I/O thread)
+///////////////////////////////////////////////////////////////////////////
+bool Beaver::readSnapshot(DomeSnapshot &snapshot)
+{
+    // Get Position
+    if (sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_GETAZ>(), snapshot.az)) {
+        snapshot.azValid = true;
+        LOGF_DEBUG("Rotator position: %f", snapshot.az);
+    }
+
+    // Query rotator status
+    snapshot.statusValid = getDomeStatus(snapshot.status);
+    snapshot.timestamp = std::chrono::steady_clock::now();
+    if (!snapshot.statusValid)
+        return false;
+
+    // shutterisup only matters when the controller flags a comms problem
+    if (snapshot.status & DOME_STATUS_SHUTTER_COMM) {
+        double res = 0;
+        if (sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_SHUTTERISUP>(), res))
+            snapshot.shutterIsUp = static_cast<bool>(res);
+        else
+            LOG_ERROR("Shutter status cmd errored out");
+    }
+
+    if (snapshot.shutterOnLine() && snapshot.readVolts) {
+        // ignoring a random get voltage cmd error here and just reporting successful status
+        double res = 0;
+        if (sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_GETSHUTTERBATVOLTAGE>(), res)) {
+            snapshot.shutterVolts = res;
+            snapshot.shutterVoltsValid = true;
+        }
+    }
+
+    // Stopped while parking without the parked bit, only now is atpark worth a query
+    if (snapshot.parking && (BeaverState::rotatorTransition(BeaverState::ROTATOR_OP_PARKING,
+                             rotatorEvents(snapshot.status)).actions & BeaverState::ROTATOR_ACTION_CHECK_PARK)) {
+        double res = 0;
+        snapshot.atParkValid = sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_ATPARK>(), res);
+        snapshot.atPark = snapshot.atParkValid && res == 1;
+        if (!snapshot.atParkValid)
+            LOG_ERROR("Error checking park");
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Rotator status from the poll snapshot
+///////////////////////////////////////////////////////////////////////////
+void Beaver::updateRotatorState(const DomeSnapshot &snapshot)
+{
+    // read before the current operation was started
+    if (snapshot.timestamp < m_RotatorOpSince)
+        return;
+
+    const BeaverState::RotatorTransition &transition =
+        BeaverState::rotatorTransition(m_RotatorOp, rotatorEvents(snapshot.status));
+    BeaverState::RotatorOperation next = transition.next;
+    unsigned actions = transition.actions;
+
+    // Stopped while parking without the parked bit, atpark was read with the snapshot.
+    // Without an answer the rotator stays parking and the next poll asks again.
+    if (actions & BeaverState::ROTATOR_ACTION_CHECK_PARK) {
+        if (!snapshot.atParkValid) {
+            next = m_RotatorOp;
+            actions = BeaverState::ROTATOR_ACTION_NONE;
+        }
+        else if (snapshot.atPark) {
+            next = BeaverState::ROTATOR_OP_PARKED;
+            actions = BeaverState::ROTATOR_ACTION_SET_PARKED;
+        }
+        else {
+            LOG_WARN("Rotator stopped short of the park position");
+            next = BeaverState::ROTATOR_OP_IDLE;
+            actions = BeaverState::ROTATOR_ACTION_DOME_IDLE;
+        }
+    }
+
+    if (actions & BeaverState::ROTATOR_ACTION_DOME_ERROR) {
+        if (snapshot.status & DOME_STATUS_UNSAFE_CW)
+            LOG_ERROR("CW Unsafe Error");
+        if (snapshot.status & DOME_STATUS_UNSAFE_RG)
+            LOG_ERROR("RGx Unsafe Error");
+        updateDomeState(DOME_ERROR);
+    }
+    if (actions & BeaverState::ROTATOR_ACTION_SET_PARKED) {
+        SetParked(true);
+        LOG_DEBUG("Dome is parked.");
+    }
+    if (actions & BeaverState::ROTATOR_ACTION_DOME_IDLE)
+        updateDomeState(DOME_IDLE);
+    if (actions & BeaverState::ROTATOR_ACTION_CALIBRATION_OK) {
+        RotatorCalibrationSP.setState(IPS_OK);
+        RotatorCalibrationSP.apply();
+    }
+    if (actions & BeaverState::ROTATOR_ACTION_GOTO_HOME_OK) {
+        GotoHomeSP.setState(IPS_OK);
+        GotoHomeSP.apply();
+        LOG_DEBUG("Dome at home");
+    }
+
+    if (next != m_RotatorOp) {
+        LOGF_DEBUG("Rotator %s -> %s", BeaverState::rotatorText(m_RotatorOp), BeaverState::rotatorText(next));
+        setRotatorOperation(next, snapshot.timestamp);
+    }
+    publish(RotatorStatusTP);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Shutter status from the poll snapshot
+///////////////////////////////////////////////////////////////////////////
+void Beaver::updateShutterState(const DomeSnapshot &snapshot)
+{
+    if (snapshot.timestamp >= m_ShutterActivitySince) {
+        const BeaverState::ShutterActivity next =
+            BeaverState::shutterTransition(m_ShutterActivity, shutterEvents(snapshot.status));
+        if (next != m_ShutterActivity)
+            setShutterActivity(next, snapshot.timestamp);
+    }
+    publish(ShutterStatusTP);
+
+    // Update shutter voltage
+    if (snapshot.shutterVoltsValid) {
+        LOGF_DEBUG("Shutter voltage currently is: %.2f", snapshot.shutterVolts);
+        ShutterVoltsNP[0].setValue(snapshot.shutterVolts);
+        (snapshot.shutterVolts < ShutterSettingsNP[SHUTTER_SAFE_VOLTAGE].getValue()) ? ShutterVoltsNP.setState(IPS_ALERT) : ShutterVoltsNP.setState(IPS_OK);
+        publish(ShutterVoltsNP);
+        updateBattery(snapshot);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Battery trend and forecast, and when the voltage is next worth reading
+///////////////////////////////////////////////////////////////////////////
+void Beaver::updateBattery(const DomeSnapshot &snapshot)
+{
+    const uint16_t shutterMoving = DOME_STATUS_SHUTTER_MOVING | DOME_STATUS_SHUTTER_OPENING |
+                                   DOME_STATUS_SHUTTER_CLOSING;
+    const double safe = ShutterSettingsNP[SHUTTER_SAFE_VOLTAGE].getValue();
+    m_Battery.add(snapshot.shutterVolts, snapshot.timestamp, snapshot.status & shutterMoving);
+
+    const double interval = m_Battery.readInterval(safe, getCurrentPollingPeriod() / 1000.0, BATTERY_READ_MAX_S);
+    m_NextVoltsRead = snapshot.timestamp + std::chrono::milliseconds(static_cast<int64_t>(interval * 1000));
+
+    const double hours = m_Battery.hoursTo(safe);
+    ShutterBatteryNP[BATTERY_AVERAGE].setValue(m_Battery.average());
+    ShutterBatteryNP[BATTERY_TREND].setValue(m_Battery.trend());
+    ShutterBatteryNP[BATTERY_HOURS_TO_SAFE].setValue(hours);
+
+    IPState state = IPS_OK;
+    if (m_Battery.level() < safe)
+        state = IPS_ALERT;
+    else if (hours >= 0 && hours < BATTERY_WARN_HOURS)
+        state = IPS_BUSY;
+    if (state == IPS_BUSY && ShutterBatteryNP.getState() == IPS_OK)
+        LOGF_WARN("Shutter battery forecast to reach %.2f V in %.0f minutes", safe, hours * 60);
+    ShutterBatteryNP.setState(state);
+    publish(ShutterBatteryNP);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Status word bits the transition tables are indexed by
+///////////////////////////////////////////////////////////////////////////
+unsigned Beaver::rotatorEvents(uint16_t domeStatus)
+{
+    unsigned events = 0;
+    if (domeStatus & DOME_STATUS_ROTATOR_MOVING)
+        events |= BeaverState::ROTATOR_EVENT_MOVING;
+    if (domeStatus & (DOME_STATUS_UNSAFE_CW | DOME_STATUS_UNSAFE_RG))
+        events |= BeaverState::ROTATOR_EVENT_UNSAFE;
+    if (domeStatus & DOME_STATUS_ROTATOR_PARKED)
+        events |= BeaverState::ROTATOR_EVENT_PARKED;
+    if (domeStatus & DOME_STATUS_ROTATOR_HOME)
+        events |= BeaverState::ROTATOR_EVENT_HOME;
+    return events;
+}
+
+unsigned Beaver::shutterEvents(uint16_t domeStatus)
+{
+    unsigned events = 0;
+    if (domeStatus & DOME_STATUS_SHUTTER_ERROR)
+        events |= BeaverState::SHUTTER_EVENT_ERROR;
+    if (domeStatus & DOME_STATUS_SHUTTER_MOVING)
+        events |= BeaverState::SHUTTER_EVENT_MOVING;
+    if (domeStatus & DOME_STATUS_SHUTTER_OPENING)
+        events |= BeaverState::SHUTTER_EVENT_OPENING;
+    if (domeStatus & DOME_STATUS_SHUTTER_CLOSING)
+        events |= BeaverState::SHUTTER_EVENT_CLOSING;
+    if (domeStatus & DOME_STATUS_SHUTTER_OPENED)
+        events |= BeaverState::SHUTTER_EVENT_OPENED;
+    if (domeStatus & DOME_STATUS_SHUTTER_CLOSED)
+        events |= BeaverState::SHUTTER_EVENT_CLOSED;
+    return events;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Status text comes from the operation, queued with the tick
+///////////////////////////////////////////////////////////////////////////
+void Beaver::setRotatorOperation(BeaverState::RotatorOperation op, std::chrono::steady_clock::time_point since)
+{
+    m_RotatorOp = op;
+    m_RotatorOpSince = since;
+    RotatorStatusTP[0].setText(BeaverState::rotatorText(op));
+    RotatorStatusTP.setState(BeaverState::rotatorState(op));
+    publish(RotatorStatusTP);
+}
+
+void Beaver::setShutterActivity(BeaverState::ShutterActivity activity, std::chrono::steady_clock::time_point since)
+{
+    m_ShutterActivity = activity;
+    m_ShutterActivitySince = since;
+    switch (activity) {
+        case BeaverState::SHUTTER_ACT_OPENING:
+        case BeaverState::SHUTTER_ACT_CLOSING:
+        case BeaverState::SHUTTER_ACT_MOVING:
+            setShutterState(SHUTTER_MOVING);
+            break;
+        case BeaverState::SHUTTER_ACT_OPEN:
+            setShutterState(SHUTTER_OPENED);
+            break;
+        case BeaverState::SHUTTER_ACT_CLOSED:
+            setShutterState(SHUTTER_CLOSED);
+            break;
+        case BeaverState::SHUTTER_ACT_ERROR:
+            LOG_ERROR("Shutter Mechanical Error");
+            setShutterState(SHUTTER_ERROR);
+            break;
+        default:
+            break;
+    }
+    LOGF_DEBUG("Shutter state set to %s", BeaverState::shutterText(activity));
+    ShutterStatusTP[0].setText(BeaverState::shutterText(activity));
+    publish(ShutterStatusTP);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Rotator absolute move
+//////////////////////////////////////////////////////////////////////////////
+IPState Beaver::MoveAbs(double az)
+{
+    // Slaving re-targets often, most of them while the last goto is still running
+    switch (m_Goto.offer(az, m_RotatorOp == BeaverState::ROTATOR_OP_MOVING, std::chrono::steady_clock::now()))
+    {
+        case GotoCoalescer::GOTO_COVERED:
+            LOGF_DEBUG("Rotator goto %.2f covered by the move in progress", az);
+            return IPS_BUSY;
+        case GotoCoalescer::GOTO_DEFERRED:
+            LOGF_DEBUG("Rotator goto %.2f deferred", az);
+            m_TargetRotatorAz = az;
+            scheduleGoto();
+            return IPS_BUSY;
+        case GotoCoalescer::GOTO_SEND:
+            break;
+    }
+
+    if (rotatorGotoAz(az))
+    {
+        m_TargetRotatorAz = az;
+        updateDomeState(DOME_MOVING);
         return IPS_BUSY;
     }
     return IPS_ALERT;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+/// Slaving: INDI::Dome::UpdateAutoSync with the target from the geometry
+/// table, so a mount update costs a lookup rather than the full calculation
+//////////////////////////////////////////////////////////////////////////////
+void Beaver::UpdateAutoSync()
+{
+    if ((mountState != IPS_OK && mountState != IPS_IDLE) || DomeAbsPosNP.s == IPS_BUSY || DomeAutoSyncS[0].s != ISS_ON)
+        return;
+    if (CanPark() && isParked()) {
+        if (!m_AutoSyncParkedWarned)
+            LOG_WARN("Cannot perform autosync with dome parked. Please unpark to enable autosync operation.");
+        m_AutoSyncParkedWarned = true;
+        return;
+    }
+    m_AutoSyncParkedWarned = false;
+    if (!HaveLatLong || !HaveRaDec)
+        return;
+
+    // libnova coordinates, in degrees
+    const double ha = get_local_hour_angle(get_local_sidereal_time(observer.lng), mountEquatorialCoords.ra / 15.0);
+    m_SlavingTable.configure(slavingGeometry());
+    SlavingTarget target;
+    if (!m_SlavingTable.lookup(ha, mountEquatorialCoords.dec, slavingSide(ha), target)) {
+        LOG_DEBUG("The telescope does not point out of the dome, check the Slaving tab");
+        return;
+    }
+    LOGF_DEBUG("Calculated target azimuth is %.2f. MinAz: %.2f, MaxAz: %.2f", target.az, target.minAz, target.maxAz);
+
+    if (fabs(remainder(target.az - DomeAbsPosN[0].value, 360)) <= DomeParamN[0].value)
+        return;
+    const IPState ret = INDI::Dome::MoveAbs(target.az);
+    if (ret == IPS_OK)
+        LOGF_DEBUG("Dome synced to position %.2f degrees.", target.az);
+    else if (ret == IPS_BUSY)
+        LOGF_DEBUG("Dome is syncing to position %.2f degrees...", target.az);
+    else
+        LOG_ERROR("Dome failed to sync to new requested position.");
+    DomeAbsPosNP.s = ret;
+    publish(DomeAbsPosNP);
+    m_Publisher.flush();
+}
+
+DomeGeometry Beaver::slavingGeometry() const
+{
+    DomeGeometry geometry;
+    geometry.radius = DomeMeasurementsN[DM_DOME_RADIUS].value;
+    geometry.shutterWidth = DomeMeasurementsN[DM_SHUTTER_WIDTH].value;
+    geometry.north = DomeMeasurementsN[DM_NORTH_DISPLACEMENT].value;
+    geometry.east = DomeMeasurementsN[DM_EAST_DISPLACEMENT].value;
+    geometry.up = DomeMeasurementsN[DM_UP_DISPLACEMENT].value;
+    geometry.otaOffset = DomeMeasurementsN[DM_OTA_OFFSET].value;
+    geometry.latitude = observer.lat;
+    return geometry;
+}
+
+int Beaver::slavingSide(double haHours) const
+{
+    if (OTASideS[DM_OTA_SIDE_EAST].s == ISS_ON)
+        return -1;
+    if (OTASideS[DM_OTA_SIDE_WEST].s == ISS_ON)
+        return 1;
+    if (OTASideS[DM_OTA_SIDE_MOUNT].s == ISS_ON)
+        return mountOTASide;
+    if (OTASideS[DM_OTA_SIDE_HA].s == ISS_ON)
+        return haHours > 0 ? -1 : 1;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Rotator relative move (calc's offset and calles abs move)
+//////////////////////////////////////////////////////////////////////////////
+IPState Beaver::MoveRel(double azDiff)
+{
+
+    azDiff = domeDir * azDiff;
+    m_TargetRotatorAz = DomeAbsPosN[0].value + azDiff;
+
+    if (m_TargetRotatorAz < DomeAbsPosN[0].min)
+        m_TargetRotatorAz += DomeAbsPosN[0].max;
+    if (m_TargetRotatorAz > DomeAbsPosN[0].max)
+        m_TargetRotatorAz -= DomeAbsPosN[0].max;
+    LOGF_DEBUG("Requested rel move of %.1f", azDiff);
+    lastAzDiff = fabs(azDiff);
+    return MoveAbs(m_TargetRotatorAz);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Rotator move (calc's offset and calles abs move)
+//////////////////////////////////////////////////////////////////////////////
+IPState Beaver::Move(DomeDirection dir, DomeMotionCommand operation)
+ {
+    LOG_DEBUG("Re-implemented move was called");
+     if (operation == MOTION_START)
+     {
+         if (dir == DOME_CW) {
+             domeDir = 1;
+         }
+         else {
+             domeDir = -1;
+         }
+         MoveRel(lastAzDiff);
+
+     }
+     return IPS_OK;
+ }
+
+//////////////////////////////////////////////////////////////////////////////
+/// open or close the shutter (will not show if shutter is not present)
+//////////////////////////////////////////////////////////////////////////////
+IPState Beaver::ControlShutter(ShutterOperation operation)
+{
+    const bool open = operation == SHUTTER_OPEN;
+    const BeaverProtocol::Request request = open ? BeaverProtocol::request<BeaverProtocol::CMD_OPENSHUTTER>()
+                                                 : BeaverProtocol::request<BeaverProtocol::CMD_CLOSESHUTTER>();
+    if (!sendCommandAsync(request, [this, open](bool rc, double)
+    {
+        if (rc) {
+            setShutterActivity(open ? BeaverState::SHUTTER_ACT_OPENING : BeaverState::SHUTTER_ACT_CLOSING);
+            m_Publisher.flush();
+            pollSoon();
+            return;
+        }
+        LOGF_ERROR("Shutter %s failed", open ? "open" : "close");
+        setShutterState(SHUTTER_ERROR);
+    }))
+        return IPS_ALERT;
+    return IPS_BUSY;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// INDI save config
+//////////////////////////////////////////////////////////////////////////////
+bool Beaver::saveConfigItems(FILE *fp)
+{
+    INDI::Dome::saveConfigItems(fp);
+    GotoCoalesceNP.save(fp);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// tells rotator to goto az pos
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorGotoAz(double az)
+{
+    const BeaverProtocol::Request gotoCmd = BeaverProtocol::request<BeaverProtocol::CMD_GOTOAZ>(az);
+    updateDomeState(DOME_MOVING);
+    m_Goto.sending(az, std::chrono::steady_clock::now());
+    // No reading counts for the move until the goto is known to have gone out
+    setRotatorOperation(BeaverState::ROTATOR_OP_MOVING, std::chrono::steady_clock::time_point::max());
+    m_Publisher.flush();
+    pollSoon();
+
+    // Dropped if an abort comes in while the goto is still queued
+    const unsigned generation = m_MotionGeneration;
+    std::shared_ptr<std::chrono::steady_clock::time_point> sent = std::make_shared<std::chrono::steady_clock::time_point>();
+    return m_IO.submit([this, generation, gotoCmd, sent]()
+    {
+        double res = 0;
+        *sent = std::chrono::steady_clock::now();
+        return generation == m_MotionGeneration && sendCommand(gotoCmd, res);
+    },
+    [this, generation, az, sent](bool rc)
+    {
+        if (generation != m_MotionGeneration)
+            return;
+        if (rc) {
+            // Started here so a poll read before the goto went out cannot end the move
+            m_RotatorOpSince = *sent;
+            m_Motion.start(DomeAbsPosN[0].value, az, *sent);
+            publishMotion(*sent);
+            m_Publisher.flush();
+            if (m_MotionTimerID < 0)
+                m_MotionTimerID = IEAddTimer(POLL_FAST_MS, motionTimerHelper, this);
+            return;
+        }
+        LOGF_ERROR("Rotator goto %.2f failed", az);
+        cancelGoto();
+        updateDomeState(DOME_IDLE);
+        setRotatorOperation(BeaverState::ROTATOR_OP_IDLE);
+        DomeAbsPosNP.s = IPS_ALERT;
+        publish(DomeAbsPosNP);
+        m_Publisher.flush();
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// get rotator az position
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorGetAz()
+{
+    return sendCommandAsync(BeaverProtocol::request<BeaverProtocol::CMD_GETAZ>(), [this](bool rc, double az)
+    {
+        if (!rc)
+            return;
+        DomeAbsPosN[0].value = az;
+        publish(DomeAbsPosNP);
+        m_Publisher.flush();
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Set home offset
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorSetHome(double az, BeaverCommandQueue::Completion done)
+{
+    return sendCommandAsync(BeaverProtocol::request<BeaverProtocol::CMD_SETHOME>(az), [this, az, done](bool rc, double)
+    {
+        if (rc) {
+            LOGF_INFO("Home is set to: %.1f", az);
+            m_Settings.home = az;
+            saveSettingsCache();
+        }
+        else
+            LOGF_ERROR("Setting home to %.1f failed", az);
+        if (done)
+            done(rc);
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Set home offset so the current position reads as home
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorSetHomeCurrent(BeaverCommandQueue::Completion done)
+{
+    std::shared_ptr<std::array<double, 2>> read = std::make_shared<std::array<double, 2>>();
+    return m_IO.submit([this, read]()
+    {
+        return sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_GETPARK>(), (*read)[0]) &&
+               sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_GETAZ>(), (*read)[1]);
+    },
+    [this, read, done](bool rc)
+    {
+        const double curHome = (*read)[0];
+        const double az = (*read)[1];
+        const double newAz = 360.0 - curHome + az;
+        if (rc) {
+            LOGF_DEBUG("New home az %.1f (from  360 - %1f + %1f)", newAz, curHome, az);
+            rc = rotatorSetHome(newAz, done);
+        }
+        else
+            LOG_ERROR("Reading park and az for the new home failed");
+        if (!rc && done)
+            done(false);
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Rotator park
+/////////////////////////////////////////////////////////////////////////////
+IPState Beaver::Park()
+{
+    if (!rotatorCommand(BeaverProtocol::request<BeaverProtocol::CMD_GOPARK>(), BeaverState::ROTATOR_OP_PARKING,
+                        [this](bool rc)
+    {
+        if (rc)
+            return;
+        LOG_ERROR("Rotator park failed");
+        ParkSP.s = IPS_ALERT;
+        IDSetSwitch(&ParkSP, nullptr);
+    }))
+        return IPS_ALERT;
+
+    // check shutter policy, online state from the last poll
+    if (m_Snapshot.shutterOnLine() && (ShutterParkPolicyS[SHUTTER_CLOSE_ON_PARK].s == ISS_ON)) {
+        if (ControlShutter(SHUTTER_CLOSE) == IPS_ALERT)
+            return IPS_ALERT;
+        DomeShutterS[SHUTTER_OPEN].s = ISS_OFF;
+        DomeShutterS[SHUTTER_CLOSE].s = ISS_ON;
+        setShutterState(SHUTTER_MOVING);
+    }
+    return IPS_BUSY;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 /// Rotator unpark
 /////////////////////////////////////////////////////////////////////////////
 IPState Beaver::UnPark()
 {
     //setDomeState(DOME_UNPARKED);
-    RotatorStatusTP[0].setText("Dome UnParked");
-    RotatorStatusTP.apply();
-    // check shutter policy
-    if (shutterOnLine() && (ShutterParkPolicyS[SHUTTER_OPEN_ON_UNPARK].s == ISS_ON)) {
-        if(!ControlShutter(SHUTTER_CLOSE)) {
-            DomeShutterS[SHUTTER_OPEN].s = ISS_ON;
-            DomeShutterS[SHUTTER_CLOSE].s = ISS_OFF;
-            setShutterState(SHUTTER_MOVING);
-        }
-        else
+    setRotatorOperation(BeaverState::ROTATOR_OP_UNPARKED);
+    m_Publisher.flush();
+    // check shutter policy, online state from the last poll
+    if (m_Snapshot.shutterOnLine() && (ShutterParkPolicyS[SHUTTER_OPEN_ON_UNPARK].s == ISS_ON)) {
+        if (ControlShutter(SHUTTER_OPEN) == IPS_ALERT)
             return IPS_ALERT;
+        DomeShutterS[SHUTTER_OPEN].s = ISS_ON;
+        DomeShutterS[SHUTTER_CLOSE].s = ISS_OFF;
+        setShutterState(SHUTTER_MOVING);
     }
     return IPS_OK;
 }
@@ -757,457 +2039,950 @@ IPState Beaver::UnPark()
 /////////////////////////////////////////////////////////////////////////////
 /// Rotator set park position
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorSetPark(double az)
+bool Beaver::rotatorSetPark(double az, BeaverCommandQueue::Completion done)
 {
-    double res = 0;
-    char cmd[DRIVER_LEN] = {0};
-    snprintf(cmd, DRIVER_LEN, "!domerot setpark %.2f#", az);
-    if (sendCommand(cmd, res)) {
-        LOGF_INFO("Park set to: %.2f", az);
-        SetAxis1Park(az);
-        return true;
-    }
-
-    return false;
+    return sendCommandAsync(BeaverProtocol::request<BeaverProtocol::CMD_SETPARK>(az), [this, az, done](bool rc, double)
+    {
+        if (rc) {
+            LOGF_INFO("Park set to: %.2f", az);
+            SetAxis1Park(az);
+            m_Settings.park = az;
+            saveSettingsCache();
+        }
+        else
+            LOGF_ERROR("Setting park to %.2f failed", az);
+        if (done)
+            done(rc);
+    });
 }
 
 /////////////////////////////////////////////////////////////////////////////
 /// Rotator set park position to current
 /////////////////////////////////////////////////////////////////////////////
 bool Beaver::SetCurrentPark() {
-    double res = 0;
-    char cmd[DRIVER_LEN] = {0};
-    snprintf(cmd, DRIVER_LEN, "!domerot setpark %.2f#", DomeAbsPosN[0].value);
-    if (sendCommand(cmd, res)) {
-        SetAxis1Park(DomeAbsPosN[0].value);
-        LOGF_INFO("Park set to current: %.2f", DomeAbsPosN[0].value);
-    }
-        return true;
-
-    return false;
+    return rotatorSetPark(DomeAbsPosN[0].value, [this](bool rc)
+    {
+        if (rc)
+            return;
+        ParkOptionSP.s = IPS_ALERT;
+        IDSetSwitch(&ParkOptionSP, nullptr);
+    });
 }
 
 /////////////////////////////////////////////////////////////////////////////
 /// Rotator set park position to default (0 az)
 /////////////////////////////////////////////////////////////////////////////
 bool Beaver::SetDefaultPark() {
+    return rotatorSetPark(0.0, [this](bool rc)
+    {
+        if (rc)
+            return;
+        ParkOptionSP.s = IPS_ALERT;
+        IDSetSwitch(&ParkOptionSP, nullptr);
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Starts a rotator motion command, the dome state follows once it went out.
+/// Dropped if an abort comes in while it is still queued.
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorCommand(const BeaverProtocol::Request &request, BeaverState::RotatorOperation operation,
+                            BeaverCommandQueue::Completion done)
+{
+    cancelGoto();
+    const unsigned generation = m_MotionGeneration;
+    return m_IO.submit([this, generation, request]()
+    {
+        double res = 0;
+        return generation == m_MotionGeneration && sendCommand(request, res);
+    },
+    [this, generation, operation, done](bool rc)
+    {
+        if (generation != m_MotionGeneration)
+            return;
+        if (rc) {
+            if (operation != BeaverState::ROTATOR_OP_PARKING)
+                updateDomeState(DOME_MOVING);
+            setRotatorOperation(operation);
+            m_Publisher.flush();
+            pollSoon();
+        }
+        if (done)
+            done(rc);
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// tells rotator to goto home position
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorGotoHome()
+{
+    return rotatorCommand(BeaverProtocol::request<BeaverProtocol::CMD_GOHOME>(), BeaverState::ROTATOR_OP_HOMING,
+                          [this](bool rc)
+    {
+        if (rc)
+            return;
+        LOG_ERROR("Rotator go home failed");
+        GotoHomeSP.setState(IPS_ALERT);
+        GotoHomeSP.apply();
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// tells the rotator to find and accurate measure the home pos and set all params
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorMeasureHome()
+{
+    return rotatorCommand(BeaverProtocol::request<BeaverProtocol::CMD_AUTOCALROT>(1), BeaverState::ROTATOR_OP_MEASURING_HOME,
+                          [this](bool rc)
+    {
+        if (rc)
+            return;
+        LOG_ERROR("Rotator home measurement failed");
+        RotatorCalibrationSP.setState(IPS_ALERT);
+        RotatorCalibrationSP.apply();
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// tell the rotator to find the home position magnet
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::rotatorFindHome()
+{
+    return rotatorCommand(BeaverProtocol::request<BeaverProtocol::CMD_AUTOCALROT>(0), BeaverState::ROTATOR_OP_FINDING_HOME,
+                          [this](bool rc)
+    {
+        if (rc)
+            return;
+        LOG_ERROR("Rotator find home failed");
+        RotatorCalibrationSP.setState(IPS_ALERT);
+        RotatorCalibrationSP.apply();
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Dome Status
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::getDomeStatus(uint16_t &domeStatus)
+{
     double res = 0;
-    char cmd[DRIVER_LEN] = {0};
-    snprintf(cmd, DRIVER_LEN, "!domerot setpark %d#", 0);
-    if (sendCommand(cmd, res)) {
-        SetAxis1Park(0.0);
-        LOG_INFO("Park set to default: 0.00");
-        return true;
+    if (!sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_STATUS>(), res))  {
+        LOG_ERROR("Status cmd errored out");
+        return false;
     }
+    domeStatus = static_cast<uint16_t>(res);
+    LOGF_DEBUG("Dome status: %0x", domeStatus);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Shutter is online if it reports up or the controller has no comms error
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::shutterOnLine(bool shutterIsUp, uint16_t domeStatus)
+{
+    return shutterIsUp || !(domeStatus & DOME_STATUS_SHUTTER_COMM);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// abort everything
+//////////////////////////////////////////////////////////////////////////////
+bool Beaver::Abort()
+{
+    return abortAll();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::abortAll()
+{
+    ++m_MotionGeneration;
+    stopMotionModel();
+    cancelGoto();
+    return sendAbort(BeaverProtocol::request<BeaverProtocol::CMD_ABORT>(1, 1, 1), [this](bool rc, double)
+    {
+        if (!rc) {
+            AbortSP.s = IPS_ALERT;
+            IDSetSwitch(&AbortSP, nullptr);
+            return;
+        }
+        setRotatorOperation(BeaverState::ROTATOR_OP_IDLE);
+        m_Publisher.flush();
+        rotatorGetAz();
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// abort shutter
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::shutterAbort()
+{
+    return sendAbort(BeaverProtocol::request<BeaverProtocol::CMD_ABORT>(0, 0, 1), CommandCompletion());
+}
 
+/////////////////////////////////////////////////////////////////////////////
+/// Abort goes to the front of the queue and the exchange in flight is cut
+/// short, so it does not wait out a slow command such as a flash save
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::sendAbort(const BeaverProtocol::Request &request, CommandCompletion done)
+{
+    m_AbortPending = true;
+    m_Transport.interrupt();
+    if (sendCommandAsync(request, done, BeaverCommandQueue::PRIORITY_URGENT))
+        return true;
+    m_AbortPending = false;
+    m_Transport.clearInterrupt();
     return false;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+/// Shutter set settings
+/////////////////////////////////////////////////////////////////////////////
+IPState Beaver::shutterSetSettings(double maxSpeed, double minSpeed, double acceleration, double voltage)
+{
+    // online state from the last poll, no need to block on a fresh query
+    if (!m_Snapshot.shutterOnLine()) {
+        LOG_WARN("Shutter is not online, settings not sent");
+        return IPS_ALERT;
+    }
+
+    static const BeaverProtocol::Command commands[] = {BeaverProtocol::CMD_SETSHUTTERMAXSPEED, BeaverProtocol::CMD_SETSHUTTERMINSPEED,
+                                                       BeaverProtocol::CMD_SETSHUTTERACCELERATION, BeaverProtocol::CMD_SETSHUTTERSAFEVOLTAGE};
+    static const char * const errors[] = {"Problem setting shutter max speed", "Problem setting shutter min speed",
+                                          "Problem setting shutter acceleration", "Problem setting shutter safe voltage"};
+    const SettingValues values = {{maxSpeed, minSpeed, acceleration, voltage}};
+
+    std::vector<QueuedCommand> cmds;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!settingChanged(values[i], m_Settings.shutter[i]))
+            continue;
+        cmds.push_back({BeaverProtocol::Request(), errors[i]});
+        BeaverProtocol::encode(cmds.back().request, commands[i], &values[i], 1);
+    }
+    if (cmds.empty()) {
+        LOG_DEBUG("Shutter parameters unchanged");
+        return IPS_OK;
+    }
+
+    if (!sendCommandsAsync(cmds, [this, values](bool rc)
+    {
+        if (rc) {
+            LOG_INFO("Shutter parameters have been updated");
+            m_Settings.shutter = values;
+            scheduleSaveFS();
+            saveSettingsCache();
+        }
+        else {
+            m_Settings.shutter.fill(NAN);
+            dropSettingsCache();
+        }
+        ShutterSettingsNP.setState(rc ? IPS_OK : IPS_ALERT);
+        ShutterSettingsNP.apply();
+    }))
+        return IPS_ALERT;
+    return IPS_BUSY;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Rotator set settings
+/////////////////////////////////////////////////////////////////////////////
+IPState Beaver::rotatorSetSettings(double maxSpeed, double minSpeed, double acceleration, double timeout)
+{
+    static const BeaverProtocol::Command commands[] = {BeaverProtocol::CMD_SETMAXSPEED, BeaverProtocol::CMD_SETMINSPEED,
+                                                       BeaverProtocol::CMD_SETACCELERATION, BeaverProtocol::CMD_SETMAXFULLROTSECS};
+    static const char * const errors[] = {"Problem setting rotator max speed", "Problem setting rotator min speed",
+                                          "Problem setting rotator acceleration", "Problem setting rotator full rot secs"};
+    const SettingValues values = {{maxSpeed, minSpeed, acceleration, timeout}};
+
+    std::vector<QueuedCommand> cmds;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!settingChanged(values[i], m_Settings.rotator[i]))
+            continue;
+        cmds.push_back({BeaverProtocol::Request(), errors[i]});
+        BeaverProtocol::encode(cmds.back().request, commands[i], &values[i], 1);
+    }
+    if (cmds.empty()) {
+        LOG_DEBUG("Rotator parameters unchanged");
+        return IPS_OK;
+    }
+
+    if (!sendCommandsAsync(cmds, [this, values](bool rc)
+    {
+        if (rc) {
+            LOG_INFO("Rotator parameters have been updated");
+            m_Settings.rotator = values;
+            scheduleSaveFS();
+            saveSettingsCache();
+            configureMotionModel();
+        }
+        else {
+            m_Settings.rotator.fill(NAN);
+            dropSettingsCache();
+        }
+        RotatorSettingsNP.setState(rc ? IPS_OK : IPS_ALERT);
+        RotatorSettingsNP.apply();
+    }))
+        return IPS_ALERT;
+    return IPS_BUSY;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Settings are sent with two decimals, anything finer is not a change
+/////////////////////////////////////////////////////////////////////////////
+bool Beaver::settingChanged(double value, double confirmed)
+{
+    return std::isnan(confirmed) || fabs(value - confirmed) >= 0.005;
+}
+
+void Beaver::invalidateConfirmedSettings()
+{
+    m_Settings.rotator.fill(NAN);
+    m_Settings.shutter.fill(NAN);
+}
 
 /////////////////////////////////////////////////////////////////////////////
-/// tells rotator to goto home position
+/// Read home, park and motion settings (any thread)
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorGotoHome()
+bool Beaver::readSettings(ControllerSettings &settings)
 {
-    double res = 0;
-    if (sendCommand("!dome gohome#", res)) {
-        setDomeState(DOME_MOVING);
-        RotatorStatusTP[0].setText("Homing");
-        RotatorStatusTP.apply();
-        return true;
+    // Shutter settings are asked for up front, their replies only count if the shutter is online
+    double shutterIsUp = 0, status = 0;
+    std::vector<PipelinedQuery> queries =
+    {
+        {BeaverProtocol::request<BeaverProtocol::CMD_SHUTTERISUP>(), &shutterIsUp},
+        {BeaverProtocol::request<BeaverProtocol::CMD_STATUS>(), &status},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETHOME>(), &settings.home, "Problem getting home offset"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETPARK>(), &settings.park, "Problem getting park position"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETMAXSPEED>(), &settings.rotator[ROTATOR_MAX_SPEED], "Problem getting rotator max speed"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETMINSPEED>(), &settings.rotator[ROTATOR_MIN_SPEED], "Problem getting rotator min speed"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETACCELERATION>(), &settings.rotator[ROTATOR_ACCELERATION], "Problem getting rotator acceleration"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETMAXFULLROTSECS>(), &settings.rotator[ROTATOR_TIMEOUT], "Problem getting rotator full rot secs"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETSHUTTERMAXSPEED>(), &settings.shutter[SHUTTER_MAX_SPEED], "Problem getting shutter max speed"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETSHUTTERMINSPEED>(), &settings.shutter[SHUTTER_MIN_SPEED], "Problem getting shutter min speed"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETSHUTTERACCELERATION>(), &settings.shutter[SHUTTER_ACCELERATION], "Problem getting shutter acceleration"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETSHUTTERTIMEOUTOPENCLOSE>(), &settings.shutterTimeout, "Problem getting shutter timeout"},
+        {BeaverProtocol::request<BeaverProtocol::CMD_GETSHUTTERSAFEVOLTAGE>(), &settings.shutter[SHUTTER_SAFE_VOLTAGE], "Problem getting shutter safe voltage"}
+    };
+    const size_t firstShutterQuery = 8;
+    sendPipelined(queries);
+
+    if (!queries[0].ok || !queries[1].ok)
+        LOG_ERROR("Shutter status cmd errored out");
+    settings.shutterValid = queries[0].ok && queries[1].ok &&
+                            shutterOnLine(static_cast<bool>(shutterIsUp), static_cast<uint16_t>(status));
+
+    const size_t last = settings.shutterValid ? queries.size() : firstShutterQuery;
+    for (size_t i = 2; i < last; i++) {
+        if (!queries[i].ok) {
+            LOG_ERROR(queries[i].error);
+            return false;
+        }
     }
-    return false;
+    return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// tells the rotator to find and accurate measure the home pos and set all params
+/// Groups with a write in flight keep the values the client asked for
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorMeasureHome()
+void Beaver::applySettings(const ControllerSettings &settings, bool confirmed)
 {
-    double res = 0;
-    if (sendCommand("!dome autocalrot 1#", res)) {
-        setDomeState(DOME_MOVING);
-        RotatorStatusTP[0].setText("Measuring Home");
-        RotatorStatusTP.apply();
-        return true;
+    HomePositionNP[0].setValue(settings.home);
+    HomePositionNP.apply();
+    LOGF_INFO("Dome reports home offset: %f", settings.home);
+    SetAxis1Park(settings.park);
+    LOGF_INFO("Dome reports park: %.1f", settings.park);
+    m_Settings.home = settings.home;
+    m_Settings.park = settings.park;
+
+    if (RotatorSettingsNP.getState() != IPS_BUSY) {
+        for (size_t i = 0; i < settings.rotator.size(); i++)
+            RotatorSettingsNP[i].setValue(settings.rotator[i]);
+        LOGF_DEBUG("Rotator reports max speed %.1f, min speed %.1f, acceleration %.1f, timeout(s) %.1f",
+                   settings.rotator[ROTATOR_MAX_SPEED], settings.rotator[ROTATOR_MIN_SPEED],
+                   settings.rotator[ROTATOR_ACCELERATION], settings.rotator[ROTATOR_TIMEOUT]);
+        RotatorSettingsNP.apply();
+        if (confirmed)
+            m_Settings.rotator = settings.rotator;
+        configureMotionModel();
+    }
+
+    m_Settings.shutterValid = settings.shutterValid;
+    if (settings.shutterValid && ShutterSettingsNP.getState() != IPS_BUSY) {
+        for (size_t i = 0; i < settings.shutter.size(); i++)
+            ShutterSettingsNP[i].setValue(settings.shutter[i]);
+        ShutterSettingsTimeoutNP[0].setValue(settings.shutterTimeout);
+        LOGF_DEBUG("Shutter reports max speed %.1f, min speed %.1f, acceleration %.1f, timeout(s) %.1f, safe voltage %.1f",
+                   settings.shutter[SHUTTER_MAX_SPEED], settings.shutter[SHUTTER_MIN_SPEED],
+                   settings.shutter[SHUTTER_ACCELERATION], settings.shutterTimeout, settings.shutter[SHUTTER_SAFE_VOLTAGE]);
+        ShutterSettingsNP.apply();
+        ShutterSettingsTimeoutNP.apply();
+        if (confirmed) {
+            m_Settings.shutter = settings.shutter;
+            m_Settings.shutterTimeout = settings.shutterTimeout;
+        }
     }
-    return false;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// tell the rotator to find the home position magnet
+/// Read back cached settings after the first poll is queued
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorFindHome()
+void Beaver::revalidateSettings()
 {
-    double res = 0;
-    if (sendCommand("!dome autocalrot 0#", res)) {
-        setDomeState(DOME_MOVING);
-        RotatorStatusTP[0].setText("Finding Home");
-        RotatorStatusTP.apply();
-        return true;
-    }
-    return false;
+    std::shared_ptr<ControllerSettings> settings = std::make_shared<ControllerSettings>();
+    m_IO.submit([this, settings]()
+    {
+        return readSettings(*settings);
+    },
+    [this, settings](bool rc)
+    {
+        if (!isConnected())
+            return;
+        if (!rc) {
+            LOG_WARN("Could not revalidate cached controller settings");
+            dropSettingsCache();
+            return;
+        }
+        applySettings(*settings, true);
+        saveSettingsCache();
+        LOG_DEBUG("Cached controller settings revalidated");
+    });
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// Rotator at home?
+/// Settings cache, one file per device next to the INDI config
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorIsHome()
+std::string Beaver::settingsCacheFile()
 {
-    double status = 0;
-    if (sendCommand("!dome athome#", status)) {
-        LOG_ERROR("Error checking home");
-        return false;
-    }
-    LOGF_DEBUG("Rotator Home? %s", (status == 1) ? "true" : "false");
-    if (status == 1)
-        return true;
-    else
-        return false;
+    const char *home = getenv("HOME");
+    return std::string(home ? home : "/tmp") + "/.indi/" + getDeviceName() + "_settings_cache";
 }
 
+std::string Beaver::connectionEndpoint()
+{
+    if (getActiveConnection() == serialConnection)
+        return std::string("serial:") + serialConnection->port();
+    return std::string("udp:") + tcpConnection->host() + ":" + std::to_string(tcpConnection->port());
+}
 
 /////////////////////////////////////////////////////////////////////////////
-/// Rotator parked?
+/// Only a cache written for this firmware and endpoint is used
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorIsParked()
+bool Beaver::loadSettingsCache(ControllerSettings &settings)
 {
-    double status = 0;
-    if (!sendCommand("!dome atpark#", status)) {
-        LOG_ERROR("Error checking park");
+    FILE *fp = fopen(settingsCacheFile().c_str(), "r");
+    if (!fp)
         return false;
+
+    std::map<std::string, std::string> entries;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char *eq = strchr(line, '=');
+        if (line[0] == '#' || !eq)
+            continue;
+        line[strcspn(line, "\r\n")] = 0;
+        *eq = 0;
+        entries[line] = eq + 1;
     }
-    LOGF_DEBUG("Rotator Parked? %s", (status == 1) ? "true" : "false");
-    if (status == 1)
-        return true;
-    else
-        return false;
-}
+    fclose(fp);
 
-/////////////////////////////////////////////////////////////////////////////
-/// Dome Status
-/////////////////////////////////////////////////////////////////////////////
-bool Beaver::getDomeStatus(uint16_t &domeStatus)
-{
-    double res = 0;
-    if (!sendCommand("!dome status#", res))  {
-        LOG_ERROR("Status cmd errored out");
+    if (entries["firmware"] != VersionTP[0].getText() || entries["endpoint"] != connectionEndpoint()) {
+        LOG_DEBUG("Settings cache does not match this controller");
         return false;
     }
-    domeStatus = static_cast<uint16_t>(res);
-    LOGF_DEBUG("Dome status: %0x", domeStatus);
+
+    struct Entry
+    {
+        const char *key;
+        double *value;
+    };
+    settings.shutterValid = entries["shutter"] == "1";
+    const Entry values[] =
+    {
+        {"home", &settings.home}, {"park", &settings.park},
+        {"rotator_max_speed", &settings.rotator[ROTATOR_MAX_SPEED]},
+        {"rotator_min_speed", &settings.rotator[ROTATOR_MIN_SPEED]},
+        {"rotator_acceleration", &settings.rotator[ROTATOR_ACCELERATION]},
+        {"rotator_timeout", &settings.rotator[ROTATOR_TIMEOUT]},
+        {"shutter_max_speed", &settings.shutter[SHUTTER_MAX_SPEED]},
+        {"shutter_min_speed", &settings.shutter[SHUTTER_MIN_SPEED]},
+        {"shutter_acceleration", &settings.shutter[SHUTTER_ACCELERATION]},
+        {"shutter_safe_voltage", &settings.shutter[SHUTTER_SAFE_VOLTAGE]},
+        {"shutter_timeout", &settings.shutterTimeout}
+    };
+    for (const Entry &entry : values) {
+        if (!settings.shutterValid && !strncmp(entry.key, "shutter_", 8))
+            continue;
+        const std::string &text = entries[entry.key];
+        char *end = nullptr;
+        *entry.value = strtod(text.c_str(), &end);
+        if (text.empty() || *end != 0 || std::isnan(*entry.value)) {
+            LOGF_DEBUG("Settings cache has no valid %s", entry.key);
+            return false;
+        }
+    }
     return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-///
+/// Written to a temporary file and renamed so a crash never leaves half a cache
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::shutterOnLine()
+void Beaver::saveSettingsCache()
 {
-    double res = 0;
-    uint16_t domeStatus;
-    bool shutterIsUp = false;
-    // retrieving shutter status
-    if (!sendCommand("!dome shutterisup#", res))  {
-        LOG_ERROR("Shutter status cmd errored out");
-        //failsave, return false/not online
-        return false;
+    // a failed write leaves the controller state unknown
+    for (size_t i = 0; i < m_Settings.rotator.size(); i++) {
+        if (std::isnan(m_Settings.rotator[i]) || (m_Settings.shutterValid && std::isnan(m_Settings.shutter[i]))) {
+            dropSettingsCache();
+            return;
+        }
     }
-    // retrieving comm status
-    shutterIsUp = static_cast<bool>(res);
-    if (!getDomeStatus(domeStatus)) {
-        LOG_ERROR("Shutter status cmd errored out");
-        //failsave, return false/not online
-        return false;
+
+    const std::string path = settingsCacheFile();
+    const std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        LOGF_DEBUG("Could not write settings cache %s", tmp.c_str());
+        return;
+    }
+
+    fprintf(fp, "# Beaver controller settings, refreshed on every connect\n");
+    fprintf(fp, "firmware=%s\n", VersionTP[0].getText());
+    fprintf(fp, "endpoint=%s\n", connectionEndpoint().c_str());
+    fprintf(fp, "home=%.6f\n", m_Settings.home);
+    fprintf(fp, "park=%.6f\n", m_Settings.park);
+    fprintf(fp, "rotator_max_speed=%.6f\n", m_Settings.rotator[ROTATOR_MAX_SPEED]);
+    fprintf(fp, "rotator_min_speed=%.6f\n", m_Settings.rotator[ROTATOR_MIN_SPEED]);
+    fprintf(fp, "rotator_acceleration=%.6f\n", m_Settings.rotator[ROTATOR_ACCELERATION]);
+    fprintf(fp, "rotator_timeout=%.6f\n", m_Settings.rotator[ROTATOR_TIMEOUT]);
+    fprintf(fp, "shutter=%d\n", m_Settings.shutterValid ? 1 : 0);
+    if (m_Settings.shutterValid) {
+        fprintf(fp, "shutter_max_speed=%.6f\n", m_Settings.shutter[SHUTTER_MAX_SPEED]);
+        fprintf(fp, "shutter_min_speed=%.6f\n", m_Settings.shutter[SHUTTER_MIN_SPEED]);
+        fprintf(fp, "shutter_acceleration=%.6f\n", m_Settings.shutter[SHUTTER_ACCELERATION]);
+        fprintf(fp, "shutter_safe_voltage=%.6f\n", m_Settings.shutter[SHUTTER_SAFE_VOLTAGE]);
+        fprintf(fp, "shutter_timeout=%.6f\n", m_Settings.shutterTimeout);
+    }
+
+    if (fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+        LOGF_DEBUG("Could not write settings cache %s", path.c_str());
+        unlink(tmp.c_str());
     }
-    LOGF_DEBUG("ShutterIsUp %s  Comms error %s", shutterIsUp ? "true" : "false", (domeStatus & DOME_STATUS_SHUTTER_COMM) ? "true" : "false");
-    bool status = (shutterIsUp |  !(domeStatus & DOME_STATUS_SHUTTER_COMM));
-    LOGF_DEBUG("ShuttOnLine %s", status ? "true" : "false");
-    return status;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-/// abort everything
-//////////////////////////////////////////////////////////////////////////////
-bool Beaver::Abort()
+void Beaver::dropSettingsCache()
 {
-    return abortAll();
+    unlink(settingsCacheFile().c_str());
 }
 
 /////////////////////////////////////////////////////////////////////////////
-///
+/// Coalesce flash writes
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::abortAll()
+void Beaver::scheduleSaveFS()
 {
-    double res = 0;
-    if (sendCommand("!dome abort 1 1 1#", res)) {
-        RotatorStatusTP[0].setText("Idle");
-        RotatorStatusTP.apply();
-        if (!rotatorGetAz())
-            return false;
-        return true;
-    }
+    if (m_SaveFSTimerID < 0)
+        m_SaveFSTimerID = IEAddTimer(SAVEFS_DELAY_MS, saveFSHelper, this);
+}
 
-    return false;
+void Beaver::saveFSHelper(void *context)
+{
+    static_cast<Beaver *>(context)->saveFS();
+}
+
+void Beaver::saveFS()
+{
+    m_SaveFSTimerID = -1;
+    if (!isConnected())
+        return;
+
+    sendCommandsAsync({{BeaverProtocol::request<BeaverProtocol::CMD_SAVEFS>(), "dome could not savefs"}}, [this](bool rc)
+    {
+        if (rc)
+            LOG_DEBUG("Settings saved to controller flash");
+    });
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// abort shutter
+///
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::shutterAbort()
+bool Beaver::shutterFindHome()
 {
-    double res = 0;
-    return sendCommand("!dome abort 0 0 1#", res);
+    // online state from the last poll, no need to block on a fresh query
+    if (!m_Snapshot.shutterOnLine())
+        return false;
+    return sendCommandAsync(BeaverProtocol::request<BeaverProtocol::CMD_AUTOCALSHUTTER>(), [this](bool rc, double)
+    {
+        if (rc) {
+            setShutterActivity(BeaverState::SHUTTER_ACT_MOVING);
+            m_Publisher.flush();
+            pollSoon();
+            return;
+        }
+        LOG_ERROR("Shutter find home failed");
+        ShutterCalibrationSP.setState(IPS_ALERT);
+        ShutterCalibrationSP.apply();
+    });
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// Shutter set settings
+/// Send Raw Command
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::shutterSetSettings(double maxSpeed, double minSpeed, double acceleration, double voltage)
+bool Beaver::sendRawCommand(const BeaverProtocol::Request &request, char * response, BeaverCommandQueue::Priority priority)
 {
-    if (shutterOnLine()) {
-        char cmd[DRIVER_LEN] = {0};
-        double res;
+    if (!request.valid())
+    {
+        LOGF_ERROR("Could not encode %s, argument out of range", request.command < BeaverProtocol::CMD_COUNT ?
+                   request.spec().text : "unknown command");
+        return false;
+    }
 
-        snprintf(cmd, DRIVER_LEN, "!dome setshuttermaxspeed %.2f#", maxSpeed);
-        if (!sendCommand(cmd, res)) {
-            LOG_ERROR("Problem setting shutter max speed");
-            return false;
+    // All controller I/O runs on the I/O thread
+    if (!m_IO.isIOThread())
+    {
+        return m_IO.call([this, &request, response]()
+        {
+            return sendRawCommand(request, response);
+        }, priority);
+    }
+
+    const char *cmd = request.text;
+    const BeaverProtocol::CommandClass commandClass = request.spec().commandClass;
+    // The abort cut the wait short, that says nothing about the link
+    const bool abort = commandClass == BeaverProtocol::CLASS_ABORT;
+    if (!abort && m_AbortPending) {
+        LOGF_DEBUG("%s dropped for a pending abort", cmd);
+        return false;
+    }
+    const RetryPolicy &policy = retryPolicy(commandClass);
+    CommandStats &stats = m_CommandStats[commandClass];
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(policy.deadlineMS);
+
+    // Over UDP a lost datagram is the usual failure. Requests that are safe to
+    // repeat go out again as soon as the RTT says the reply is overdue; others
+    // are sent once, the controller may have acted on a request whose reply was lost.
+    const bool idempotent = request.spec().idempotent;
+    const uint32_t retries = !m_Datagram ? policy.retries : idempotent ? std::max(policy.retries, UDP_RETRANSMITS) : 0;
+
+    int rc = TTY_OK;
+    for (uint32_t attempt = 0; attempt <= retries; attempt++)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+        if (attempt > 0) {
+            stats.retries++;
+            m_LinkRetransmits++;
         }
-        snprintf(cmd, DRIVER_LEN, "!dome setshutterminspeed %.2f#", minSpeed);
-        if (!sendCommand(cmd, res)) {
-            LOG_ERROR("Problem setting shutter min speed");
-            return false;
+
+        if (abort) {
+            m_AbortPending = false;
+            m_Transport.clearInterrupt();
+        }
+
+        // anything still in from an earlier, timed out request is stale
+        const size_t stale = m_Transport.drain();
+        if (stale > 0) {
+            m_StaleBytes += stale;
+            LOGF_DEBUG("Dropped %zu stale bytes before %s", stale, cmd);
         }
-        snprintf(cmd, DRIVER_LEN, "!dome setshutteracceleration %.2f#", acceleration);
-        if (!sendCommand(cmd, res)) {
-            LOG_ERROR("Problem setting shutter acceleration");
+
+        const uint32_t timeoutMS = m_Datagram && idempotent ? std::min(policy.timeoutMS, m_Rtt.timeout()) : policy.timeoutMS;
+        const std::chrono::steady_clock::time_point sentAt = std::chrono::steady_clock::now();
+        const std::chrono::steady_clock::time_point attemptDeadline = std::min(deadline,
+                sentAt + std::chrono::milliseconds(timeoutMS));
+        int nbytes_read = 0;
+        rc = m_Transport.write(cmd, attemptDeadline);
+        m_LinkRequests++;
+
+        if (rc != TTY_OK && !abort && m_Transport.interrupted()) {
+            LOGF_DEBUG("%s cut short by an abort", cmd);
             return false;
         }
-        snprintf(cmd, DRIVER_LEN, "!dome setshuttersafevoltage %.2f#", voltage);
-        if (!sendCommand(cmd, res)) {
-            LOG_ERROR("Problem setting shutter safe voltage");
+        if (rc != TTY_OK)
+        {
+            char errstr[MAXRBUF] = {0};
+            tty_error_msg(rc, errstr, MAXRBUF);
+            LOGF_ERROR("Serial write error: %s.", errstr);
+            stats.failures++;
+            m_ConsecutiveFailures++;
             return false;
         }
-        if(!sendCommand("!seletek savefs#", res)) {
-            LOG_ERROR("Problem setting shutter savefs");
+
+        rc = readReply(cmd, response, attemptDeadline, nbytes_read);
+
+        if (rc != TTY_OK && !abort && m_Transport.interrupted()) {
+            LOGF_DEBUG("%s cut short by an abort", cmd);
             return false;
         }
-        LOG_INFO("Shutter parameters have been updated");
+        if (rc != TTY_OK)
+        {
+            if (rc == TTY_TIME_OUT) {
+                stats.timeouts++;
+                m_LinkLost++;
+                m_Rtt.backoff();
+                updateLinkTiming();
+            }
+            // back off before trying again, unless that would run past the deadline
+            const uint32_t backoffMS = policy.backoffMS << attempt;
+            if (backoffMS > 0 && attempt < policy.retries &&
+                    std::chrono::steady_clock::now() + std::chrono::milliseconds(backoffMS) < deadline)
+                usleep(backoffMS * 1000);
+            continue;
+        }
+
+        // Karn: after a retransmit the reply may be to either copy
+        if (attempt == 0) {
+            m_Rtt.sample(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sentAt).count());
+            updateLinkTiming();
+        }
+
+        m_ConsecutiveFailures = 0;
+        m_LastReplyNS = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        // Remove extra #
+        response[nbytes_read - 1] = 0;
+        LOGF_DEBUG("Command Response: %s", response);
+        return true;
     }
 
-    return true;
+    // retries or deadline used up, return error
+    stats.failures++;
+    m_ConsecutiveFailures++;
+    char errstr[MAXRBUF] = {0};
+    tty_error_msg(rc, errstr, MAXRBUF);
+    LOGF_ERROR("%s command %s failed: %s.", BeaverProtocol::commandClassName(commandClass), cmd, errstr);
+    return false;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// Shutter get settings
+/// Only the reply that echoes cmd counts. Anything else is the late answer to
+/// an earlier request: it is skipped and the read goes on, so the link is back
+/// in step by the time our reply arrives. If it does not arrive in time the
+/// retry drains the port and asks again.
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::shutterGetSettings()
+int Beaver::readReply(const char *cmd, char *response, std::chrono::steady_clock::time_point deadline, int &nbytes_read)
 {
-    double res;
-    if (shutterOnLine()) {
-        if (!sendCommand("!dome getshuttermaxspeed#", res)) {
-            LOG_ERROR("Problem getting shutter max speed");
-            return false;
-        }
-        else {
-            ShutterSettingsNP[SHUTTER_MAX_SPEED].setValue(res);
-            LOGF_DEBUG("Shutter reports max speed of: %.1f", res);
-        }
-        if (!sendCommand("!dome getshutterminspeed#", res)) {
-            LOG_ERROR("Problem getting shutter min speed");
-            return false;
-        }
-        else {
-            ShutterSettingsNP[SHUTTER_MIN_SPEED].setValue(res);
-            LOGF_DEBUG("Shutter reports min speed of: %.1f", res);
-        }
-        if (!sendCommand("!dome getshutteracceleration#", res)) {
-            LOG_ERROR("Problem getting shutter acceleration");
-            return false;
-        }
-        else {
-            ShutterSettingsNP[SHUTTER_ACCELERATION].setValue(res);
-            LOGF_DEBUG("Shutter reports acceleration of: %.1f", res);
-        }
-        if (!sendCommand("!dome getshuttertimeoutopenclose#", res)) {
-            LOG_ERROR("Problem getting shutter timeout");
-            return false;
-        }
-        else {
-            ShutterSettingsTimeoutNP[0].setValue(res);
-            LOGF_DEBUG("Shutter reports safe timeout of: %.1f", res);
-        }
-        if (!sendCommand("!dome getshuttersafevoltage#", res)) {
-            LOG_ERROR("Problem getting shutter safe voltage");
-            return false;
-        }
-        else {
-            ShutterSettingsNP[SHUTTER_SAFE_VOLTAGE].setValue(res);
-            LOGF_DEBUG("Shutter reports safe voltage of: %.1f", res);
-        }
-        ShutterSettingsNP.apply();
+    for (;;)
+    {
+        const int rc = m_Transport.readFrame(response, DRIVER_LEN, deadline, nbytes_read);
+        if (rc != TTY_OK)
+            return rc;
+        if (BeaverProtocol::matchesRequest(cmd, response, nbytes_read - 1))
+            return TTY_OK;
+
+        m_Desyncs++;
+        // a garbled frame may not print, so the bytes go along
+        char hex[DRIVER_LEN * 3 + 1] = {0};
+        hexDump(hex, response, nbytes_read);
+        LOGF_WARN("Reply %.*s [%s] does not answer %s, resynchronising", nbytes_read, response, hex, cmd);
     }
-
-    return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// Rotator set settings
+/// "AB CD EF", size bytes of data, buf needs room for 3 * size
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorSetSettings(double maxSpeed, double minSpeed, double acceleration, double timeout)
+void Beaver::hexDump(char * buf, const char * data, int size)
 {
-    char cmd[DRIVER_LEN] = {0};
-    double res;
+    for (int i = 0; i < size; i++)
+        sprintf(buf + 3 * i, "%02X ", static_cast<uint8_t>(data[i]));
 
-    snprintf(cmd, DRIVER_LEN, "!domerot setmaxspeed %.2f#", maxSpeed);
-    if (!sendCommand(cmd, res)) {
-        LOG_ERROR("Problem setting rotator max speed");
-        return false;
-    }
-    snprintf(cmd, DRIVER_LEN, "!domerot setminspeed %.2f#", minSpeed);
-    if (!sendCommand(cmd, res)) {
-        LOG_ERROR("Problem setting rotator min speed");
-        return false;
-    }
-    snprintf(cmd, DRIVER_LEN, "!domerot setacceleration %.2f#", acceleration);
-    if (!sendCommand(cmd, res)) {
-        LOG_ERROR("Problem setting rotator acceleration");
-        return false;
-    }
-    snprintf(cmd, DRIVER_LEN, "!domerot setmaxfullrotsecs %.2f#", timeout);
-    if (!sendCommand(cmd, res)) {
-        LOG_ERROR("Problem setting rotator full rot secs");
-        return false;
-    }
-    if(!sendCommand("!seletek savefs#", res)) {
-        LOG_ERROR("dome could not savefs");
-        return false;
-    }
-    LOG_INFO("Rotator parameters have been updated");
+    if (size > 0)
+        buf[3 * size - 1] = '\0';
+}
 
-    return true;
+/////////////////////////////////////////////////////////////////////////////
+/// Status queries and abort must fail inside one poll period, so a lost
+/// packet never holds up slaving for longer than that. Moves and settings
+/// get more time, a flash commit the most.
+/////////////////////////////////////////////////////////////////////////////
+const Beaver::RetryPolicy &Beaver::retryPolicy(BeaverProtocol::CommandClass commandClass)
+{
+    static const RetryPolicy policies[BeaverProtocol::CLASS_COUNT] =
+    {
+        // timeout, retries, backoff, deadline (ms)
+        {400, 1, 0, 900},       // status
+        {1000, 1, 100, 2500},   // motion
+        {250, 3, 0, 1000},      // abort
+        {1000, 2, 100, 3500},   // config
+        {3000, 2, 500, 10000}   // flash
+    };
+    return policies[commandClass];
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// Rotator get settings
+/// Send Command
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::rotatorGetSettings()
+bool Beaver::sendCommand(const BeaverProtocol::Request &request, double &res, BeaverCommandQueue::Priority priority)
 {
-    double res;
-    if (!sendCommand("!domerot getmaxspeed#", res)) {
-        LOG_ERROR("Problem getting rotator max speed");
-        return false;
-    }
-    else {
-        RotatorSettingsNP[ROTATOR_MAX_SPEED].setValue(res);
-        LOGF_DEBUG("Rotator reports max speed of: %.1f", res);
-    }
-    if (!sendCommand("!domerot getminspeed#", res)) {
-        LOG_ERROR("Problem getting rotator min speed");
+    char response[DRIVER_LEN] = {0};
+    if (!sendRawCommand(request, response, priority))
         return false;
-    }
-    else {
-        RotatorSettingsNP[ROTATOR_MIN_SPEED].setValue(res);
-        LOGF_DEBUG("Rotator reports min speed of: %.1f", res);
-    }
-    if (!sendCommand("!domerot getacceleration#", res)) {
-        LOG_ERROR("Problem getting rotator acceleration");
+
+    BeaverProtocol::Reply reply;
+    if (!BeaverProtocol::parseReply(response, strlen(response), reply))
+    {
+        LOGF_ERROR("Failed to process response: %s.", response);
         return false;
     }
-    else {
-        RotatorSettingsNP[ROTATOR_ACCELERATION].setValue(res);
-        LOGF_DEBUG("Rotator reports acceleration of: %.1f", res);
-    }
-    if (!sendCommand("!domerot getmaxfullrotsecs#", res)) {
-        LOG_ERROR("Problem getting rotator full rot secs");
+    if (reply.type == BeaverProtocol::Reply::REPLY_ERROR)
+    {
+        LOGF_DEBUG("Command error: %s  code: %d", request.text, reply.errorCode);
         return false;
     }
-    else {
-        RotatorSettingsNP[ROTATOR_TIMEOUT].setValue(res);
-        LOGF_DEBUG("Rotator reports timeout(s) of: %.1f", res);
-    }
-    RotatorSettingsNP.apply();
 
+    res = reply.value;
     return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
-///
+/// Send Command without blocking the INDI thread
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::shutterFindHome()
+bool Beaver::sendCommandAsync(const BeaverProtocol::Request &request, CommandCompletion done,
+                              BeaverCommandQueue::Priority priority)
 {
-    if (shutterOnLine()) {
-        double res = 0;
-        return sendCommand("!dome autocalshutter#", res);
-    }
-    return false;
+    std::shared_ptr<double> res = std::make_shared<double>(0);
+    return m_IO.submit([this, request, res]()
+    {
+        return sendCommand(request, *res);
+    },
+    [done, res](bool rc)
+    {
+        if (done)
+            done(rc, *res);
+    }, priority);
 }
 
 /////////////////////////////////////////////////////////////////////////////
-/// Send Raw Command
+/// Pipelined read-only queries. Replies come back in request order, so a
+/// reply that matches a later query means the ones before it were lost.
+/// Lost queries are retried one at a time afterwards.
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::sendRawCommand(const char * cmd, char * response)
+bool Beaver::sendPipelined(std::vector<PipelinedQuery> &queries)
 {
-    int rc = TTY_OK;
-    for (int i = 0; i < 3; i++)
+    if (!m_IO.isIOThread())
     {
-        int nbytes_written = 0, nbytes_read = 0;
-        rc = tty_write_string(PortFD, cmd, &nbytes_written);
+        return m_IO.call([this, &queries]()
+        {
+            return sendPipelined(queries);
+        });
+    }
 
-        if (rc != TTY_OK)
+    // Only queries with a numeric reply may run ahead of their replies, a lost one is simply asked again
+    for (const PipelinedQuery &query : queries)
+    {
+        if (!query.request.valid() || query.request.spec().commandClass != BeaverProtocol::CLASS_STATUS ||
+                query.request.spec().reply != BeaverProtocol::Reply::REPLY_NUMBER)
         {
-            char errstr[MAXRBUF] = {0};
-            tty_error_msg(rc, errstr, MAXRBUF);
-            LOGF_ERROR("Serial write error: %s.", errstr);
+            LOGF_ERROR("%s cannot be pipelined", query.request.valid() ? query.request.spec().text : "Invalid request");
             return false;
         }
+    }
 
-        rc = tty_nread_section(PortFD, response, DRIVER_LEN, DRIVER_STOP_CHAR, DRIVER_TIMEOUT, &nbytes_read);
+    const size_t stale = m_Transport.drain();
+    if (stale > 0) {
+        m_StaleBytes += stale;
+        LOGF_DEBUG("Dropped %zu stale bytes before pipelined queries", stale);
+    }
 
-        if (rc != TTY_OK)
+    // a lost query is asked again below, one at a time
+    const uint32_t statusTimeoutMS = retryPolicy(BeaverProtocol::CLASS_STATUS).timeoutMS;
+    const std::chrono::milliseconds timeout(m_Datagram ? std::min(statusTimeoutMS, m_Rtt.timeout()) : statusTimeoutMS);
+    size_t sent = 0, answered = 0;
+    while (answered < queries.size())
+    {
+        while (sent < queries.size() && sent - answered < PIPELINE_DEPTH)
         {
-            // wait and try again
-            usleep(100000);
-            continue;
+            int rc = m_Transport.write(queries[sent].request.text, std::chrono::steady_clock::now() + timeout);
+            if (rc != TTY_OK)
+            {
+                char errstr[MAXRBUF] = {0};
+                tty_error_msg(rc, errstr, MAXRBUF);
+                LOGF_ERROR("Serial write error: %s.", errstr);
+                return false;
+            }
+            sent++;
         }
 
-        // Remove extra #
+        char response[DRIVER_LEN] = {0};
+        int nbytes_read = 0;
+        if (m_Transport.readFrame(response, DRIVER_LEN, std::chrono::steady_clock::now() + timeout, nbytes_read) != TTY_OK)
+        {
+            if (m_Transport.interrupted())
+                return false;
+            // nothing more is coming for what is on the wire
+            answered = sent;
+            continue;
+        }
         response[nbytes_read - 1] = 0;
         LOGF_DEBUG("Command Response: %s", response);
-        return true;
+
+        size_t match = answered;
+        while (match < sent && !BeaverProtocol::matchesRequest(queries[match].request.text, response, nbytes_read - 1))
+            match++;
+        if (match == sent)
+        {
+            m_Desyncs++;
+            LOGF_WARN("Dropping unexpected reply: %s", response);
+            continue;
+        }
+
+        PipelinedQuery &query = queries[match];
+        BeaverProtocol::Reply reply;
+        query.replied = true;
+        query.ok = BeaverProtocol::parseReply(response, nbytes_read - 1, reply) &&
+                   reply.type == BeaverProtocol::Reply::REPLY_NUMBER;
+        if (query.ok)
+            *query.value = reply.value;
+        else
+            LOGF_DEBUG("Command error: %s", query.request.text);
+        answered = match + 1;
     }
 
-    // timeouts used up, return error
-    if (rc != TTY_OK) {
-        char errstr[MAXRBUF] = {0};
-        tty_error_msg(rc, errstr, MAXRBUF);
-        LOGF_ERROR("Serial read error: %s.", errstr);
+    bool ok = true;
+    for (PipelinedQuery &query : queries)
+    {
+        if (!query.replied)
+            query.ok = sendCommand(query.request, *query.value);
+        ok = ok && query.ok;
     }
-    return false;
+    return ok;
 }
+
 /////////////////////////////////////////////////////////////////////////////
-/// Send Command
+/// Send a command sequence without blocking the INDI thread
 /////////////////////////////////////////////////////////////////////////////
-bool Beaver::sendCommand(const char * cmd, double &res)
+bool Beaver::sendCommandsAsync(const std::vector<QueuedCommand> &cmds, BeaverCommandQueue::Completion done)
 {
-    char response[DRIVER_LEN] = {0};
-    sendRawCommand(cmd, response);
-
-    std::regex rgx(R"(.*:((-*\d+(\.\d*)*)))");
-    std::smatch match;
-    std::string input(response);
+    if (cmds.empty())
+        return false;
 
-    if (std::regex_search(input, match, rgx)) {
-        try {
-            res = std::stof(match.str(1));
-            return true;
+    // One job per command so urgent work (abort) can run in between.
+    // ok is only touched on the I/O thread until the last completion.
+    std::shared_ptr<bool> ok = std::make_shared<bool>(true);
+    for (size_t i = 0; i < cmds.size(); i++)
+    {
+        const QueuedCommand item = cmds[i];
+        BeaverCommandQueue::Completion completion;
+        if (i + 1 == cmds.size())
+        {
+            completion = [ok, done](bool)
+            {
+                if (done)
+                    done(*ok);
+            };
         }
-        catch (...) {
-            LOGF_ERROR("Failed to process response: %s.", response);
+
+        BeaverCommandQueue::Work work = [this, item, ok]()
+        {
+            double res = 0;
+            if (*ok && !sendCommand(item.request, res))
+            {
+                LOG_ERROR(item.error);
+                *ok = false;
+            }
+            return *ok;
+        };
+        if (!m_IO.submit(work, completion))
             return false;
-        }
     }
-    LOGF_DEBUG("Command error: %s  response: %d", cmd, response);
-    return false;
+    return true;
 }
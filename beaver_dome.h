@@ -21,7 +21,25 @@
 
 #pragma once
 
+#include "beaver_battery.h"
+#include "beaver_io.h"
+#include "beaver_motion.h"
+#include "beaver_protocol.h"
+#include "beaver_publish.h"
+#include "beaver_shm.h"
+#include "beaver_slaving.h"
+#include "beaver_state.h"
+#include "beaver_telemetry.h"
+#include "beaver_trace.h"
+#include "beaver_transport.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include <indidome.h>
 #include <indipropertytext.h>
 #include <indipropertyswitch.h>
@@ -30,14 +48,18 @@
 class Beaver : public INDI::Dome
 {
     public:
-        Beaver();
+        explicit Beaver(int index = 0);
         virtual ~Beaver() override = default;
 
+        static std::vector<std::unique_ptr<Beaver>> createDomes();
+
         const char *getDefaultName() override;
         virtual bool initProperties() override;
+        virtual void ISGetProperties(const char *dev) override;
         virtual bool updateProperties() override;
         virtual bool ISNewNumber(const char *dev, const char *name, double values[], char *names[], int n) override;
         virtual bool ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int n) override;
+        virtual bool Disconnect() override;
 
     protected:
         bool Handshake() override;
@@ -63,6 +85,9 @@ class Beaver : public INDI::Dome
         virtual IPState Park() override;
         virtual IPState UnPark() override;
 
+        // Slaving, from the geometry table instead of GetTargetAz()
+        virtual void UpdateAutoSync() override;
+
         // Beaver status
         enum
         {
@@ -83,10 +108,124 @@ class Beaver : public INDI::Dome
 
     private:
 
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Poll snapshot: every controller query runs at most once per tick
+        ///////////////////////////////////////////////////////////////////////////////
+        struct DomeSnapshot
+        {
+            // when the status word was read
+            std::chrono::steady_clock::time_point timestamp;
+            double az {0};
+            uint16_t status {0};
+            bool shutterIsUp {false};
+            double shutterVolts {0};
+            bool azValid {false};
+            bool statusValid {false};
+            bool shutterVoltsValid {false};
+            // set before the poll: whether the voltage is due
+            bool readVolts {true};
+            // set before the poll: parking, atpark is asked for once the rotator stops
+            bool parking {false};
+            bool atPark {false};
+            bool atParkValid {false};
+
+            bool shutterOnLine() const
+            {
+                return statusValid && Beaver::shutterOnLine(shutterIsUp, status);
+            }
+        };
+
         ///////////////////////////////////////////////////////////////////////////////
         /// Set & Query Functions
         ///////////////////////////////////////////////////////////////////////////////
         bool echo();
+        bool readSnapshot(DomeSnapshot &snapshot);
+        void applySnapshot(const DomeSnapshot &snapshot);
+        void updateRotatorState(const DomeSnapshot &snapshot);
+        void updateShutterState(const DomeSnapshot &snapshot);
+        void recordTelemetry(const DomeSnapshot &snapshot);
+        void exportStatus(const DomeSnapshot &snapshot);
+        void startStatusExport();
+        void updateBattery(const DomeSnapshot &snapshot);
+        void startTelemetry();
+        void startTrace();
+        void stopTrace();
+        // Last step of Disconnect, once nothing is left to send
+        void closePort();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Rotator & Shutter State Machine
+        ///////////////////////////////////////////////////////////////////////////////
+        static unsigned rotatorEvents(uint16_t domeStatus);
+        static unsigned shutterEvents(uint16_t domeStatus);
+        // Readings taken before since do not move the new operation on
+        void setRotatorOperation(BeaverState::RotatorOperation op,
+                                 std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now());
+        void setShutterActivity(BeaverState::ShutterActivity activity,
+                                std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now());
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Poll Scheduling
+        ///////////////////////////////////////////////////////////////////////////////
+        uint32_t pollPeriod(const DomeSnapshot &snapshot);
+        void schedulePoll(uint32_t periodMS);
+        // Poll at the fast rate now that something was commanded to move
+        void pollSoon();
+        void publishPollStats(bool force);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Property Publication
+        ///////////////////////////////////////////////////////////////////////////////
+        // Poll driven sends are queued here and go out once per tick, if changed
+        void publish(INDI::PropertyNumber &property);
+        void publish(INDI::PropertyText &property);
+        void publish(INumberVectorProperty &property);
+        // setDomeState, keeping the publisher in step with the position it sends
+        void updateDomeState(const DomeState &state);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Rotator Motion Model
+        ///////////////////////////////////////////////////////////////////////////////
+        void configureMotionModel();
+        void stopMotionModel();
+        void publishMotion(std::chrono::steady_clock::time_point now);
+        // Interpolates the azimuth between polls while the model is active
+        static void motionTimerHelper(void *context);
+        void motionTimer();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Goto Coalescing
+        ///////////////////////////////////////////////////////////////////////////////
+        // Sends the newest deferred target once the rate limit allows
+        void scheduleGoto();
+        static void gotoTimerHelper(void *context);
+        void gotoTimer();
+        // Any other rotator command: a deferred target must not follow it
+        void cancelGoto();
+        void configureGotoCoalescing();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Link Watchdog
+        ///////////////////////////////////////////////////////////////////////////////
+        void startWatchdog();
+        void stopWatchdog();
+        static void watchdogTimerHelper(void *context);
+        void watchdogTimer();
+        // Closes the port and starts reconnecting; outageStart is the last reply
+        void linkLost(std::chrono::steady_clock::time_point outageStart);
+        static void reconnectTimerHelper(void *context);
+        void reconnectTimer();
+        void reconnectLater();
+        // Puts back the move, park and shutter operation the outage interrupted
+        void restoreLink(bool aborted);
+        void publishLinkRecovery();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Slaving Geometry
+        ///////////////////////////////////////////////////////////////////////////////
+        DomeGeometry slavingGeometry() const;
+        // -1 east, 1 west, 0 ignored, as chosen on the Slaving tab
+        int slavingSide(double haHours) const;
 
         ///////////////////////////////////////////////////////////////////////////////
         /// Rotator Motion Control
@@ -94,37 +233,123 @@ class Beaver : public INDI::Dome
         bool rotatorGotoAz(double az);
         bool rotatorGetAz();
         bool rotatorSyncAZ(double az);
-        bool rotatorSetHome(double az);
-        bool rotatorSetPark(double az);
+        // Queued on the I/O thread, done runs on the INDI thread
+        bool rotatorSetHome(double az, BeaverCommandQueue::Completion done = BeaverCommandQueue::Completion());
+        bool rotatorSetHomeCurrent(BeaverCommandQueue::Completion done);
+        bool rotatorSetPark(double az, BeaverCommandQueue::Completion done = BeaverCommandQueue::Completion());
         bool rotatorGotoPark();
         bool rotatorGotoHome();
         bool rotatorMeasureHome();
         bool rotatorFindHome();
-        bool rotatorIsHome();
-        bool rotatorIsParked();
         bool rotatorUnPark();
         bool rotatorSetPark();
         bool abortAll();
+        bool rotatorCommand(const BeaverProtocol::Request &request, BeaverState::RotatorOperation operation,
+                            BeaverCommandQueue::Completion done);
 
-        bool rotatorGetSettings();
-        bool rotatorSetSettings(double maxSpeed, double minSpeed, double acceleration, double timeout);
+        IPState rotatorSetSettings(double maxSpeed, double minSpeed, double acceleration, double timeout);
 
         ///////////////////////////////////////////////////////////////////////////////
         /// Shutter Motion Control
         ///////////////////////////////////////////////////////////////////////////////
         //bool shutterSetSettings(double maxSpeed, double minSpeed, double acceleration, double timeout, double voltage);
-        bool shutterSetSettings(double maxSpeed, double minSpeed, double acceleration, double voltage);
+        IPState shutterSetSettings(double maxSpeed, double minSpeed, double acceleration, double voltage);
 
-        bool shutterGetSettings();
         bool shutterFindHome();
         bool shutterAbort();
-        bool shutterOnLine();
+        static bool shutterOnLine(bool shutterIsUp, uint16_t domeStatus);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Settings Writes
+        ///////////////////////////////////////////////////////////////////////////////
+        // Only settings that differ from the last confirmed controller value are written
+        typedef std::array<double, 4> SettingValues;
+        static bool settingChanged(double value, double confirmed);
+        void invalidateConfirmedSettings();
+        // One savefs for all settings changed within SAVEFS_DELAY_MS
+        void scheduleSaveFS();
+        static void saveFSHelper(void *context);
+        void saveFS();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        /// Controller Settings
+        ///////////////////////////////////////////////////////////////////////////////
+        // Everything the handshake reads besides version and azimuth
+        struct ControllerSettings
+        {
+            double home {0};
+            double park {0};
+            SettingValues rotator {{0, 0, 0, 0}};
+            bool shutterValid {false};
+            SettingValues shutter {{0, 0, 0, 0}};
+            double shutterTimeout {0};
+        };
+        // Queries only (any thread)
+        bool readSettings(ControllerSettings &settings);
+        // Publishes the values (INDI thread). Only values read from the controller
+        // are confirmed, settingChanged() compares client writes against those.
+        void applySettings(const ControllerSettings &settings, bool confirmed);
+        void revalidateSettings();
+
+        // Warm start cache keyed by firmware version and connection endpoint
+        std::string settingsCacheFile();
+        std::string connectionEndpoint();
+        bool loadSettingsCache(ControllerSettings &settings);
+        void saveSettingsCache();
+        void dropSettingsCache();
 
         ///////////////////////////////////////////////////////////////////////////////
         /// Communication Functions
         ///////////////////////////////////////////////////////////////////////////////
-        bool sendCommand(const char * cmd, double &res);
-        bool sendRawCommand(const char * cmd, char *resString);
+        // Timeout, retries and whether a lost reply may be asked again come from the command table
+        bool sendCommand(const BeaverProtocol::Request &request, double &res,
+                         BeaverCommandQueue::Priority priority = BeaverCommandQueue::PRIORITY_NORMAL);
+        bool sendRawCommand(const BeaverProtocol::Request &request, char *resString,
+                            BeaverCommandQueue::Priority priority = BeaverCommandQueue::PRIORITY_NORMAL);
+
+        // Timeout per attempt, extra attempts, backoff doubling per retry, and the
+        // overall deadline no retry may run past
+        struct RetryPolicy
+        {
+            uint32_t timeoutMS;
+            uint32_t retries;
+            uint32_t backoffMS;
+            uint32_t deadlineMS;
+        };
+        static const RetryPolicy &retryPolicy(BeaverProtocol::CommandClass commandClass);
+        // Next frame that answers cmd, replies to earlier requests are skipped
+        int readReply(const char *cmd, char *response, std::chrono::steady_clock::time_point deadline, int &nbytes_read);
+        void publishCommandStats();
+        void updateLinkTiming();
+
+        // Queued on the I/O thread, done runs on the INDI thread with the parsed value
+        typedef std::function<void(bool, double)> CommandCompletion;
+        bool sendCommandAsync(const BeaverProtocol::Request &request, CommandCompletion done,
+                              BeaverCommandQueue::Priority priority = BeaverCommandQueue::PRIORITY_NORMAL);
+        // Urgent, and cuts short the exchange in flight
+        bool sendAbort(const BeaverProtocol::Request &request, CommandCompletion done);
+
+        // Commands sent in order, stopping at the first failure
+        struct QueuedCommand
+        {
+            BeaverProtocol::Request request;
+            const char *error;
+        };
+        bool sendCommandsAsync(const std::vector<QueuedCommand> &cmds, BeaverCommandQueue::Completion done);
+
+        // Read-only query for sendPipelined, ok once a numeric reply was parsed into value
+        struct PipelinedQuery
+        {
+            PipelinedQuery(const BeaverProtocol::Request &request, double *value, const char *error = nullptr) :
+                request(request), value(value), error(error) {}
+            BeaverProtocol::Request request;
+            double *value;
+            const char *error;
+            bool replied {false};
+            bool ok {false};
+        };
+        // Sends up to PIPELINE_DEPTH queries ahead of their replies, returns true if all succeeded
+        bool sendPipelined(std::vector<PipelinedQuery> &queries);
         bool getDomeStatus(uint16_t &domeStatus);
         void hexDump(char * buf, const char * data, int size);
         std::vector<std::string> split(const std::string &input, const std::string &regex);
@@ -148,6 +373,20 @@ class Beaver : public INDI::Dome
         INDI::PropertySwitch GotoHomeSP {1};
         // Shutter voltage
         INDI::PropertyNumber ShutterVoltsNP {1};
+        INDI::PropertyNumber ShutterBatteryNP {3};
+        enum
+        {
+            BATTERY_AVERAGE,
+            BATTERY_TREND,
+            BATTERY_HOURS_TO_SAFE
+        };
+        // Goto coalescing while the rotator is moving
+        INDI::PropertyNumber GotoCoalesceNP {2};
+        enum
+        {
+            GOTO_TOLERANCE,
+            GOTO_INTERVAL
+        };
         // Rotator Status        
         INDI::PropertyText RotatorStatusTP {1};
         // Shutter Status
@@ -176,6 +415,101 @@ class Beaver : public INDI::Dome
         };
         INDI::PropertyNumber ShutterSettingsTimeoutNP {1};
 
+        // Poll scheduler statistics
+        INDI::PropertyNumber PollStatsNP {5};
+        enum
+        {
+            POLL_PERIOD,
+            POLL_DURATION,
+            POLL_JITTER,
+            POLL_JITTER_MAX,
+            POLL_OVERRUNS
+        };
+
+        // Property publisher statistics
+        INDI::PropertyNumber PublishStatsNP {2};
+        enum
+        {
+            PUBLISH_SENT,
+            PUBLISH_SUPPRESSED
+        };
+
+        // Timeouts, retries and failures per command class
+        INDI::PropertyNumber CommandStatsNP {BeaverProtocol::CLASS_COUNT * 3};
+        enum
+        {
+            COMMAND_TIMEOUTS,
+            COMMAND_RETRIES,
+            COMMAND_FAILURES,
+            COMMAND_STAT_COUNT
+        };
+
+        // Replies that did not answer the request, and stale bytes drained
+        INDI::PropertyNumber LinkStatsNP {9};
+        enum
+        {
+            LINK_DESYNCS,
+            LINK_STALE_BYTES,
+            LINK_REQUESTS,
+            LINK_LOST,
+            LINK_LOSS,
+            LINK_RETRANSMITS,
+            LINK_SRTT,
+            LINK_RTTVAR,
+            LINK_RTO
+        };
+
+        // Link outages and how long they took to recover from
+        INDI::PropertyNumber LinkRecoveryNP {4};
+        enum
+        {
+            RECOVERY_OUTAGES,
+            RECOVERY_COUNT,
+            RECOVERY_LAST,
+            RECOVERY_MEAN
+        };
+
+        // Gotos sent, dropped as covered, and replaced by a newer target
+        INDI::PropertyNumber GotoStatsNP {3};
+        enum
+        {
+            GOTO_SENT,
+            GOTO_COVERED,
+            GOTO_SUPERSEDED
+        };
+
+        // Per poll binary record of the dome state
+        INDI::PropertySwitch TelemetrySP {2};
+        enum
+        {
+            TELEMETRY_ON,
+            TELEMETRY_OFF
+        };
+
+        // Per poll status in shared memory for local programs, see beaver_shm.h
+        INDI::PropertySwitch StatusExportSP {2};
+        enum
+        {
+            STATUS_EXPORT_ON,
+            STATUS_EXPORT_OFF
+        };
+
+        // Every request and reply frame, for replay with beaver_sim -R
+        INDI::PropertySwitch TraceSP {2};
+        enum
+        {
+            TRACE_ON,
+            TRACE_OFF
+        };
+
+        // Rotator move prediction
+        INDI::PropertyNumber RotatorMotionNP {2};
+        enum
+        {
+            ROTATOR_MOTION_TARGET,
+            ROTATOR_MOTION_ETA
+        };
+
         // Rotator Configuration
         INDI::PropertyNumber RotatorSettingsNP {4};
         enum
@@ -190,18 +524,131 @@ class Beaver : public INDI::Dome
         /// Private Variables
         ///////////////////////////////////////////////////////////////////////
         double m_TargetRotatorAz {-1};
+        DomeSnapshot m_Snapshot;
+
+        // All controller I/O goes through here
+        BeaverCommandQueue m_IO;
+        // Port reads and writes, I/O thread only
+        BeaverTransport m_Transport {DRIVER_STOP_CHAR};
+        bool m_PollInFlight {false};
+        int m_PollTimerID {-1};
+        // fixed-rate deadline of the next poll, and when the current one started
+        std::chrono::steady_clock::time_point m_PollDeadline;
+        std::chrono::steady_clock::time_point m_PollStarted;
+        std::chrono::steady_clock::time_point m_PollStatsPublished;
+        double m_PollJitterMS {0};
+        double m_PollJitterMaxMS {0};
+        uint32_t m_PollOverruns {0};
+        // Bumped by abort so queued motion commands are dropped
+        std::atomic<unsigned> m_MotionGeneration {0};
+        // Set by abort until it is sent, everything else queued before it fails at once
+        std::atomic<bool> m_AbortPending {false};
+        RotatorMotionModel m_Motion;
+        PropertyPublisher m_Publisher;
+        int m_MotionTimerID {-1};
+        GotoCoalescer m_Goto;
+        int m_GotoTimerID {-1};
+        // Link watchdog, INDI thread
+        int m_WatchdogTimerID {-1};
+        int m_ReconnectTimerID {-1};
+        bool m_LinkDown {false};
+        // Handshake only attaches the reopened port while set
+        bool m_Reconnecting {false};
+        std::chrono::steady_clock::time_point m_LinkDownSince;
+        uint32_t m_ReconnectDelayMS {0};
+        uint32_t m_ReconnectAttempts {0};
+        uint32_t m_LinkOutages {0};
+        uint32_t m_LinkRecoveries {0};
+        double m_LinkRecoveryTotalS {0};
+        // Read on the I/O thread after a reconnect, used to restore state
+        DomeSnapshot m_ResumeSnapshot;
+        // Updated on the I/O thread, read by the watchdog
+        std::atomic<uint32_t> m_ConsecutiveFailures {0};
+        std::atomic<int64_t> m_LastReplyNS {0};
+        // Rebuilt on the next mount update after a Slaving tab change
+        SlavingTable m_SlavingTable;
+        bool m_AutoSyncParkedWarned {false};
+        BeaverState::RotatorOperation m_RotatorOp {BeaverState::ROTATOR_OP_IDLE};
+        std::chrono::steady_clock::time_point m_RotatorOpSince;
+        BeaverState::ShutterActivity m_ShutterActivity {BeaverState::SHUTTER_ACT_IDLE};
+        std::chrono::steady_clock::time_point m_ShutterActivitySince;
+        // Last values read from or written to the controller, NaN when unknown
+        ControllerSettings m_Settings;
+        // Published from the cache, read them back once connected
+        bool m_RevalidateSettings {false};
+        int m_SaveFSTimerID {-1};
+        // Disconnected, but the port stays open until the flash save went out
+        bool m_ClosingPort {false};
+        // Counted on the I/O thread, published with the poll statistics
+        struct CommandStats
+        {
+            std::atomic<uint32_t> timeouts {0};
+            std::atomic<uint32_t> retries {0};
+            std::atomic<uint32_t> failures {0};
+        };
+        CommandStats m_CommandStats[BeaverProtocol::CLASS_COUNT];
+        std::atomic<uint32_t> m_Desyncs {0};
+        std::atomic<uint64_t> m_StaleBytes {0};
+        std::atomic<uint64_t> m_LinkRequests {0};
+        std::atomic<uint64_t> m_LinkLost {0};
+        std::atomic<uint64_t> m_LinkRetransmits {0};
+        std::atomic<double> m_LinkSRTT {0};
+        std::atomic<double> m_LinkRTTVAR {0};
+        std::atomic<double> m_LinkRTO {0};
+        // I/O thread only
+        RttEstimator m_Rtt {RTT_MIN_MS, RTT_MAX_MS};
+        // UDP, set by the handshake
+        bool m_Datagram {false};
+        TelemetryWriter m_Telemetry;
+        BeaverShmWriter m_StatusExport;
+        uint64_t m_StatusExportTick {0};
+        // open and written on the I/O thread
+        TraceWriter m_Trace;
+        std::string m_TracePath;
+        BatteryEstimator m_Battery;
+        std::chrono::steady_clock::time_point m_NextVoltsRead;
 
         /////////////////////////////////////////////////////////////////////////////
         /// Static Helper Values
         /////////////////////////////////////////////////////////////////////////////        
         static constexpr const char * ROTATOR_TAB = "Rotator";
         static constexpr const char * SHUTTER_TAB = "Shutter";
+        static constexpr const char * DIAGNOSTICS_TAB = "Diagnostics";
+        // Poll rate while anything moves, and the slow down when parked and closed
+        static constexpr const uint32_t POLL_FAST_MS {250};
+        static constexpr const uint32_t POLL_PARKED_FACTOR {4};
+        static constexpr const uint32_t POLL_PARKED_MAX_MS {10000};
+        // Poll statistics are published at most this often unless an overrun happens
+        static constexpr const uint32_t POLL_STATS_INTERVAL_MS {10000};
+        // Smallest changes worth sending to clients
+        static constexpr const double AZ_DEADBAND {0.05};
+        static constexpr const double VOLTS_DEADBAND {0.01};
+        static constexpr const double ETA_DEADBAND {0.1};
+        // Slowest shutter voltage read, and how far ahead a low battery is flagged
+        static constexpr const double BATTERY_READ_MAX_S {60};
+        static constexpr const double BATTERY_WARN_HOURS {1};
+        // Settings changes this close together share one flash write
+        static constexpr const uint32_t SAVEFS_DELAY_MS {2000};
         // '#' is the stop char
         static const char DRIVER_STOP_CHAR { 0x23 };
-        // Wait up to a maximum of 3 seconds for serial input
-        static constexpr const uint8_t DRIVER_TIMEOUT {3};
         // Maximum buffer for sending/receving.
         static constexpr const uint8_t DRIVER_LEN {128};
+        // Most domes one driver process hosts
+        static constexpr const int MAX_DOMES {16};
+        // Bounds of the adaptive timeout, and how often a lost UDP query is sent again
+        static constexpr const uint32_t RTT_MIN_MS {50};
+        static constexpr const uint32_t RTT_MAX_MS {3000};
+        static constexpr const uint32_t UDP_RETRANSMITS {4};
+        // A link is dead after this many commands failed in a row, or no reply for
+        // the heartbeat or three poll periods, whichever is longer
+        static constexpr const uint32_t WATCHDOG_FAILURES {5};
+        static constexpr const uint32_t WATCHDOG_HEARTBEAT_MS {15000};
+        static constexpr const uint32_t WATCHDOG_PERIOD_MS {1000};
+        // Reconnect attempts back off between these
+        static constexpr const uint32_t RECONNECT_MIN_MS {500};
+        static constexpr const uint32_t RECONNECT_MAX_MS {30000};
+        // Unanswered queries allowed on the wire during startup
+        static constexpr const size_t PIPELINE_DEPTH {4};
         int domeDir = 1;
         double lastAzDiff = 1;
 };
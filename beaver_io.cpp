@@ -0,0 +1,217 @@
+/*
+    NexDome Beaver Controller - Command Queue
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_io.h"
+
+#include "indidevapi.h"
+
+#include <future>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+BeaverCommandQueue::~BeaverCommandQueue()
+{
+    stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Start the I/O thread and hook the completion pipe into the event loop
+/////////////////////////////////////////////////////////////////////////////
+bool BeaverCommandQueue::start()
+{
+    if (m_Running)
+        return true;
+
+    if (pipe(m_Pipe) != 0)
+        return false;
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(m_Pipe[i], F_SETFL, fcntl(m_Pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(m_Pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    m_CallbackID = IEAddCallback(m_Pipe[0], onCompletionsReady, this);
+
+    m_Stop = false;
+    m_Running = true;
+    m_Thread = std::thread(&BeaverCommandQueue::run, this);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+void BeaverCommandQueue::stop()
+{
+    if (!m_Running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stop = true;
+        m_Jobs.clear();
+    }
+    m_Wake.notify_all();
+    if (m_Thread.joinable())
+        m_Thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Completions.clear();
+    }
+
+    if (m_CallbackID >= 0)
+        IERmCallback(m_CallbackID);
+    m_CallbackID = -1;
+    close(m_Pipe[0]);
+    close(m_Pipe[1]);
+    m_Pipe[0] = m_Pipe[1] = -1;
+    m_Running = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool BeaverCommandQueue::submit(Work work, Completion done, Priority priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        if (!m_Running || m_Stop)
+            return false;
+
+        Job job;
+        job.work = std::move(work);
+        job.done = std::move(done);
+        if (priority == PRIORITY_URGENT)
+            m_Jobs.push_front(std::move(job));
+        else
+            m_Jobs.push_back(std::move(job));
+    }
+    m_Wake.notify_one();
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool BeaverCommandQueue::call(Work work, Priority priority)
+{
+    if (isIOThread())
+        return work();
+
+    // Only the job owns the promise. If stop() drops the job the promise dies
+    // unset, which get() reports as an exception.
+    std::shared_ptr<std::promise<bool>> result = std::make_shared<std::promise<bool>>();
+    std::future<bool> future = result->get_future();
+    Work job = [work, result]()
+    {
+        const bool rc = work();
+        result->set_value(rc);
+        return rc;
+    };
+    result.reset();
+    if (!submit(std::move(job), Completion(), priority))
+        return false;
+
+    try
+    {
+        return future.get();
+    }
+    catch (const std::future_error &)
+    {
+        return false;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool BeaverCommandQueue::isIOThread() const
+{
+    return m_Running && std::this_thread::get_id() == m_Thread.get_id();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+size_t BeaverCommandQueue::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Jobs.size();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// I/O thread
+/////////////////////////////////////////////////////////////////////////////
+void BeaverCommandQueue::run()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_Wake.wait(lock, [this]()
+            {
+                return m_Stop || !m_Jobs.empty();
+            });
+            if (m_Stop)
+                return;
+            job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+        }
+
+        const bool rc = job.work();
+
+        if (job.done)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Lock);
+                m_Completions.push_back(std::make_pair(std::move(job.done), rc));
+            }
+            const char wakeup = 1;
+            if (write(m_Pipe[1], &wakeup, 1) < 0)
+            {
+                // pipe full: the event loop already has a wakeup pending
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// INDI thread
+/////////////////////////////////////////////////////////////////////////////
+void BeaverCommandQueue::onCompletionsReady(int fd, void *userpointer)
+{
+    char drain[64];
+    while (read(fd, drain, sizeof(drain)) > 0)
+        ;
+    static_cast<BeaverCommandQueue *>(userpointer)->dispatchCompletions();
+}
+
+void BeaverCommandQueue::dispatchCompletions()
+{
+    std::deque<std::pair<Completion, bool>> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        ready.swap(m_Completions);
+    }
+    for (auto &completion : ready)
+        completion.first(completion.second);
+}
@@ -0,0 +1,94 @@
+/*
+    NexDome Beaver Controller - Command Queue
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+///////////////////////////////////////////////////////////////////////////////
+/// Serialises all controller I/O on one dedicated thread. Work items run on
+/// the I/O thread; their completions are handed back to the INDI event loop
+/// through a pipe, so property updates always happen on the INDI thread.
+///////////////////////////////////////////////////////////////////////////////
+class BeaverCommandQueue
+{
+    public:
+        // Runs on the I/O thread, returns success
+        typedef std::function<bool()> Work;
+        // Runs on the INDI thread with the result of the work item
+        typedef std::function<void(bool)> Completion;
+
+        enum Priority
+        {
+            PRIORITY_NORMAL,
+            // Jumps ahead of everything queued, e.g. abort
+            PRIORITY_URGENT
+        };
+
+        BeaverCommandQueue() = default;
+        ~BeaverCommandQueue();
+
+        BeaverCommandQueue(const BeaverCommandQueue &) = delete;
+        BeaverCommandQueue &operator=(const BeaverCommandQueue &) = delete;
+
+        bool start();
+        // Drops queued work and pending completions, then joins the I/O thread
+        void stop();
+        bool isRunning() const
+        {
+            return m_Running;
+        }
+
+        // Queue work, done is called later from the INDI event loop
+        bool submit(Work work, Completion done = Completion(), Priority priority = PRIORITY_NORMAL);
+
+        // Queue work and block until it ran. Runs inline when called from the I/O thread.
+        bool call(Work work, Priority priority = PRIORITY_NORMAL);
+
+        bool isIOThread() const;
+        size_t pending() const;
+
+    private:
+        struct Job
+        {
+            Work work;
+            Completion done;
+        };
+
+        void run();
+        void dispatchCompletions();
+        static void onCompletionsReady(int fd, void *userpointer);
+
+        mutable std::mutex m_Lock;
+        std::condition_variable m_Wake;
+        std::deque<Job> m_Jobs;
+        std::deque<std::pair<Completion, bool>> m_Completions;
+        std::thread m_Thread;
+        bool m_Stop {false};
+        std::atomic<bool> m_Running {false};
+
+        // I/O thread -> INDI event loop wakeup
+        int m_Pipe[2] {-1, -1};
+        int m_CallbackID {-1};
+};
@@ -0,0 +1,293 @@
+/*
+    NexDome Beaver Controller - Rotator Motion Model
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_motion.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// The full rotation timeout leaves about this much margin over a real full turn
+const double TIMEOUT_MARGIN = 1.25;
+// How much of the observed speed error is taken into the scale per reading
+const double LEARN_GAIN = 0.5;
+// Below this many degrees to go the move counts as done
+const double ARRIVED = 0.05;
+
+double range360(double az)
+{
+    az = fmod(az, 360.0);
+    return az < 0 ? az + 360.0 : az;
+}
+
+// shortest signed travel from -> to
+double shortestTravel(double from, double to)
+{
+    double delta = range360(to - from);
+    return delta > 180.0 ? delta - 360.0 : delta;
+}
+
+double seconds(RotatorMotionModel::TimePoint from, RotatorMotionModel::TimePoint to)
+{
+    return std::chrono::duration<double>(to - from).count();
+}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Settings
+/////////////////////////////////////////////////////////////////////////////
+void RotatorMotionModel::configure(double maxSpeed, double minSpeed, double acceleration, double timeout)
+{
+    if (maxSpeed <= 0 || acceleration <= 0)
+        return;
+
+    m_MaxSpeed = maxSpeed;
+    m_MinSpeed = std::max(0.0, std::min(minSpeed, maxSpeed));
+    m_Acceleration = acceleration;
+
+    // Until a move was observed assume the timeout is a full turn plus margin
+    if (!m_Learned && timeout > 0)
+        m_DegPerStep = 360.0 / (timeout / TIMEOUT_MARGIN) / m_MaxSpeed;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+void RotatorMotionModel::start(double fromAz, double targetAz, TimePoint now)
+{
+    const double travel = shortestTravel(fromAz, targetAz);
+    m_TargetAz = range360(targetAz);
+    m_Direction = travel < 0 ? -1 : 1;
+    m_AnchorAz = range360(fromAz);
+    m_AnchorRemaining = fabs(travel);
+    m_AnchorSpeed = m_MinSpeed * m_DegPerStep;
+    m_AnchorTime = now;
+    m_Active = m_DegPerStep > 0 && m_AnchorRemaining > ARRIVED;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Learn the speed scale from the reading, then re-anchor on it
+/////////////////////////////////////////////////////////////////////////////
+void RotatorMotionModel::correct(double measuredAz, TimePoint when)
+{
+    if (!m_Active)
+        return;
+
+    const double dt = seconds(m_AnchorTime, when);
+    if (dt <= 0)
+        return;
+
+    double vPeak, tAccel, tCruise, tDecel;
+    profile(vPeak, tAccel, tCruise, tDecel);
+
+    // Away from the braking phase every distance scales with deg/step, so the
+    // ratio of observed to predicted travel is the scale error
+    const double predicted = travelAfter(dt);
+    const double observed = m_Direction * shortestTravel(m_AnchorAz, measuredAz);
+    double scale = 1;
+    if (dt <= tAccel + tCruise && predicted > 0.1 && observed > 0)
+    {
+        scale = 1 + LEARN_GAIN * (std::min(2.0, std::max(0.5, observed / predicted)) - 1);
+        m_DegPerStep *= scale;
+        m_Learned = true;
+    }
+
+    m_AnchorSpeed = std::min(speedAfter(dt) * scale, m_MaxSpeed * m_DegPerStep);
+    m_AnchorAz = range360(measuredAz);
+    m_AnchorTime = when;
+
+    // overshoot or arrival leaves nothing to go; the status word ends the move
+    m_AnchorRemaining = std::max(0.0, m_Direction * shortestTravel(m_AnchorAz, m_TargetAz));
+    if (m_AnchorRemaining < ARRIVED)
+        m_AnchorRemaining = 0;
+}
+
+void RotatorMotionModel::stop()
+{
+    m_Active = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Predictions
+/////////////////////////////////////////////////////////////////////////////
+double RotatorMotionModel::predictAz(TimePoint now) const
+{
+    if (!m_Active)
+        return m_AnchorAz;
+    return range360(m_AnchorAz + m_Direction * travelAfter(seconds(m_AnchorTime, now)));
+}
+
+double RotatorMotionModel::eta(TimePoint now) const
+{
+    if (!m_Active)
+        return 0;
+    return std::max(0.0, timeToGo() - seconds(m_AnchorTime, now));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Accelerate from the anchor speed, cruise, then brake to min speed at the target
+/////////////////////////////////////////////////////////////////////////////
+void RotatorMotionModel::profile(double &vPeak, double &tAccel, double &tCruise, double &tDecel) const
+{
+    const double vMax = m_MaxSpeed * m_DegPerStep;
+    const double vMin = m_MinSpeed * m_DegPerStep;
+    const double accel = m_Acceleration * m_DegPerStep;
+    const double v0 = std::max(vMin, m_AnchorSpeed);
+    const double d = m_AnchorRemaining;
+
+    // Already braking (or slower than min speed): straight line decel to the target
+    const double braking = (v0 * v0 - vMin * vMin) / (2 * accel);
+    if (d <= braking || v0 >= vMax)
+    {
+        vPeak = v0;
+        tAccel = 0;
+        const double dDecel = std::min(d, braking);
+        tDecel = dDecel > 0 ? (v0 - vMin) / accel : 0;
+        tCruise = v0 > 0 ? (d - dDecel) / v0 : 0;
+        return;
+    }
+
+    vPeak = std::min(vMax, sqrt((2 * accel * d + v0 * v0 + vMin * vMin) / 2));
+    tAccel = (vPeak - v0) / accel;
+    tDecel = (vPeak - vMin) / accel;
+    const double dAccel = (vPeak * vPeak - v0 * v0) / (2 * accel);
+    const double dDecel = (vPeak * vPeak - vMin * vMin) / (2 * accel);
+    tCruise = std::max(0.0, d - dAccel - dDecel) / vPeak;
+}
+
+double RotatorMotionModel::timeToGo() const
+{
+    if (m_AnchorRemaining <= 0)
+        return 0;
+    double vPeak, tAccel, tCruise, tDecel;
+    profile(vPeak, tAccel, tCruise, tDecel);
+    return tAccel + tCruise + tDecel;
+}
+
+double RotatorMotionModel::travelAfter(double t) const
+{
+    if (t <= 0 || m_AnchorRemaining <= 0)
+        return 0;
+
+    double vPeak, tAccel, tCruise, tDecel;
+    profile(vPeak, tAccel, tCruise, tDecel);
+    const double accel = m_Acceleration * m_DegPerStep;
+    const double v0 = vPeak - accel * tAccel;
+
+    double travel;
+    if (t < tAccel)
+        travel = v0 * t + accel * t * t / 2;
+    else if (t < tAccel + tCruise)
+        travel = v0 * tAccel + accel * tAccel * tAccel / 2 + vPeak * (t - tAccel);
+    else
+    {
+        const double u = std::min(t - tAccel - tCruise, tDecel);
+        travel = v0 * tAccel + accel * tAccel * tAccel / 2 + vPeak * tCruise + vPeak * u - accel * u * u / 2;
+    }
+    return std::min(travel, m_AnchorRemaining);
+}
+
+double RotatorMotionModel::speedAfter(double t) const
+{
+    if (m_AnchorRemaining <= 0)
+        return 0;
+
+    double vPeak, tAccel, tCruise, tDecel;
+    profile(vPeak, tAccel, tCruise, tDecel);
+    const double accel = m_Acceleration * m_DegPerStep;
+
+    if (t < tAccel)
+        return vPeak - accel * (tAccel - t);
+    if (t < tAccel + tCruise)
+        return vPeak;
+    return std::max(m_MinSpeed * m_DegPerStep, vPeak - accel * (t - tAccel - tCruise));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Goto coalescing
+/////////////////////////////////////////////////////////////////////////////
+void GotoCoalescer::configure(double toleranceDeg, double intervalS)
+{
+    m_Tolerance = std::max(0.0, toleranceDeg);
+    m_Interval = std::chrono::milliseconds(static_cast<int64_t>(std::max(0.0, intervalS) * 1000));
+}
+
+GotoCoalescer::Decision GotoCoalescer::offer(double az, bool moving, TimePoint now)
+{
+    if (!moving || !m_HasTarget)
+    {
+        dropPending();
+        return GOTO_SEND;
+    }
+
+    if (fabs(shortestTravel(m_Target, az)) <= m_Tolerance)
+    {
+        // anything held back is older than this and just as well covered
+        dropPending();
+        m_Covered++;
+        return GOTO_COVERED;
+    }
+
+    if (now - m_LastSent < m_Interval)
+    {
+        dropPending();
+        m_Pending = az;
+        m_HasPending = true;
+        return GOTO_DEFERRED;
+    }
+
+    dropPending();
+    return GOTO_SEND;
+}
+
+void GotoCoalescer::sending(double az, TimePoint now)
+{
+    m_HasTarget = true;
+    m_Target = az;
+    m_LastSent = now;
+    m_Sent++;
+}
+
+void GotoCoalescer::reset()
+{
+    m_HasTarget = false;
+    dropPending();
+}
+
+GotoCoalescer::TimePoint GotoCoalescer::pendingDue() const
+{
+    return m_LastSent + m_Interval;
+}
+
+bool GotoCoalescer::takePending(double &az)
+{
+    if (!m_HasPending)
+        return false;
+    az = m_Pending;
+    m_HasPending = false;
+    return true;
+}
+
+void GotoCoalescer::dropPending()
+{
+    if (m_HasPending)
+        m_Superseded++;
+    m_HasPending = false;
+}
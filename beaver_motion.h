@@ -0,0 +1,155 @@
+/*
+    NexDome Beaver Controller - Rotator Motion Model
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+/// Trapezoidal model of one rotator move, used to estimate azimuth and time
+/// to target between polls. Speeds come from the controller settings in motor
+/// steps; the degrees per step scale is seeded from the full rotation timeout
+/// and then learned from the azimuth readings.
+///////////////////////////////////////////////////////////////////////////////
+class RotatorMotionModel
+{
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        // Controller settings: steps/s, steps/s^2 and full rotation timeout in seconds
+        void configure(double maxSpeed, double minSpeed, double acceleration, double timeout);
+
+        // A new move from the current azimuth to target (shortest path, as the firmware does)
+        void start(double fromAz, double targetAz, TimePoint now);
+        // Re-anchor on a real reading
+        void correct(double measuredAz, TimePoint when);
+        void stop();
+
+        bool isActive() const
+        {
+            return m_Active;
+        }
+        double targetAz() const
+        {
+            return m_TargetAz;
+        }
+
+        double predictAz(TimePoint now) const;
+        // Seconds until the rotator reaches the target, 0 when idle
+        double eta(TimePoint now) const;
+
+        // Learned cruise speed, deg/s
+        double cruiseSpeed() const
+        {
+            return m_MaxSpeed * m_DegPerStep;
+        }
+
+    private:
+        // Distance covered t seconds after the anchor
+        double travelAfter(double t) const;
+        double timeToGo() const;
+        double speedAfter(double t) const;
+        void profile(double &vPeak, double &tAccel, double &tCruise, double &tDecel) const;
+
+        // settings, steps
+        double m_MaxSpeed {800};
+        double m_MinSpeed {400};
+        double m_Acceleration {500};
+        double m_DegPerStep {0};
+        bool m_Learned {false};
+
+        // the move, re-anchored on every reading
+        bool m_Active {false};
+        double m_TargetAz {0};
+        double m_Direction {1};
+        double m_AnchorAz {0};
+        // remaining distance (deg) and speed (deg/s) at the anchor
+        double m_AnchorRemaining {0};
+        double m_AnchorSpeed {0};
+        TimePoint m_AnchorTime;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Latest target wins. Every goto makes the firmware decelerate and re-plan,
+/// so while the rotator is moving a new target within tolerance of the one
+/// it is already heading for is dropped, and other re-targets reach the
+/// firmware at most once per interval. Targets arriving in between replace
+/// each other; only the newest is sent when the interval is up.
+///////////////////////////////////////////////////////////////////////////////
+class GotoCoalescer
+{
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        enum Decision
+        {
+            GOTO_SEND,
+            // within tolerance of the move in progress
+            GOTO_COVERED,
+            // held until pendingDue()
+            GOTO_DEFERRED
+        };
+
+        void configure(double toleranceDeg, double intervalS);
+
+        // moving: a goto is on its way or the rotator is travelling to its target
+        Decision offer(double az, bool moving, TimePoint now);
+        // The goto for az is being sent
+        void sending(double az, TimePoint now);
+        // Abort, park or any other rotator command: nothing is pending any more
+        void reset();
+
+        bool hasPending() const
+        {
+            return m_HasPending;
+        }
+        TimePoint pendingDue() const;
+        // Hands over the newest deferred target
+        bool takePending(double &az);
+
+        uint64_t sent() const
+        {
+            return m_Sent;
+        }
+        uint64_t covered() const
+        {
+            return m_Covered;
+        }
+        uint64_t superseded() const
+        {
+            return m_Superseded;
+        }
+
+    private:
+        void dropPending();
+
+        double m_Tolerance {0.5};
+        std::chrono::milliseconds m_Interval {2000};
+
+        bool m_HasTarget {false};
+        double m_Target {0};
+        TimePoint m_LastSent;
+        bool m_HasPending {false};
+        double m_Pending {0};
+
+        uint64_t m_Sent {0};
+        uint64_t m_Covered {0};
+        uint64_t m_Superseded {0};
+};
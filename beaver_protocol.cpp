@@ -0,0 +1,381 @@
+/*
+    NexDome Beaver Controller - Protocol Decoder
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_protocol.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace BeaverProtocol
+{
+
+constexpr CommandSpec Table::COMMANDS[CMD_COUNT];
+
+namespace
+{
+// '#' is the stop char
+const char STOP_CHAR = '#';
+
+const double POW10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\r' || c == '\n' || c == '\t';
+}
+
+// case-insensitive compare of [begin, end) with a lower case literal
+bool equalsWord(const char *begin, const char *end, const char *word)
+{
+    for (; begin < end && *word; ++begin, ++word)
+    {
+        char c = *begin;
+        if (c >= 'A' && c <= 'Z')
+            c = static_cast<char>(c - 'A' + 'a');
+        if (c != *word)
+            return false;
+    }
+    return begin == end && *word == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Split reply into the segment before the last ':' and the payload after it
+/////////////////////////////////////////////////////////////////////////////
+bool splitReply(const char *buf, size_t len, const char *&prevBegin, const char *&payload, const char *&end)
+{
+    if (buf == nullptr || len == 0)
+        return false;
+
+    end = buf + len;
+    // the buffer may still be null terminated or carry the stop char
+    for (const char *p = buf; p < end; ++p)
+    {
+        if (*p == 0 || *p == STOP_CHAR)
+        {
+            end = p;
+            break;
+        }
+    }
+    while (end > buf && isSpace(end[-1]))
+        --end;
+
+    const char *colon = nullptr;
+    for (const char *p = end; p > buf; --p)
+    {
+        if (p[-1] == ':')
+        {
+            colon = p - 1;
+            break;
+        }
+    }
+    if (colon == nullptr)
+        return false;
+
+    payload = colon + 1;
+    prevBegin = colon;
+    while (prevBegin > buf && prevBegin[-1] != ':')
+        --prevBegin;
+    // no previous segment if the command echo is the only thing before the colon
+    if (prevBegin == buf)
+        prevBegin = colon;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// error replies: "...:error#" or "...:error:<code>#"
+/////////////////////////////////////////////////////////////////////////////
+bool parseError(const char *prevBegin, const char *payload, const char *end, Reply &reply)
+{
+    if (equalsWord(payload, end, "error") || equalsWord(payload, end, "err"))
+    {
+        reply.type = Reply::REPLY_ERROR;
+        reply.errorCode = 0;
+        return true;
+    }
+
+    const char *prevEnd = payload - 1;
+    double code = 0;
+    if (prevBegin < prevEnd && (equalsWord(prevBegin, prevEnd, "error") || equalsWord(prevBegin, prevEnd, "err"))
+            && parseNumber(payload, end, code))
+    {
+        reply.type = Reply::REPLY_ERROR;
+        reply.errorCode = static_cast<int>(code);
+        return true;
+    }
+    return false;
+}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Number
+/////////////////////////////////////////////////////////////////////////////
+bool parseNumber(const char *begin, const char *end, double &value)
+{
+    while (begin < end && isSpace(*begin))
+        ++begin;
+
+    bool negative = false;
+    if (begin < end && *begin == '-')
+    {
+        negative = true;
+        ++begin;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0, fraction = 0;
+    bool dot = false;
+    for (; begin < end; ++begin)
+    {
+        const char c = *begin;
+        if (isDigit(c))
+        {
+            // more significant digits than a double can hold are not a valid reply
+            if (++digits > 18)
+                return false;
+            mantissa = mantissa * 10 + static_cast<uint64_t>(c - '0');
+            if (dot)
+                ++fraction;
+        }
+        else if (c == '.' && !dot)
+            dot = true;
+        else
+            break;
+    }
+
+    // trailing garbage after the number
+    while (begin < end && isSpace(*begin))
+        ++begin;
+    if (digits == 0 || begin != end)
+        return false;
+
+    // both operands are exact, so the division is correctly rounded
+    value = static_cast<double>(mantissa) / POW10[fraction];
+    if (negative)
+        value = -value;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Numeric reply
+/////////////////////////////////////////////////////////////////////////////
+bool parseReply(const char *buf, size_t len, Reply &reply)
+{
+    reply = Reply();
+
+    const char *prevBegin, *payload, *end;
+    if (!splitReply(buf, len, prevBegin, payload, end))
+        return false;
+
+    reply.payload = payload;
+    reply.payloadLen = static_cast<size_t>(end - payload);
+
+    if (parseError(prevBegin, payload, end, reply))
+        return true;
+
+    if (!parseNumber(payload, end, reply.value))
+        return false;
+
+    reply.type = Reply::REPLY_NUMBER;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Version reply: "!seletek tversion:<n>:<major>.<minor>.<patch>#"
+/////////////////////////////////////////////////////////////////////////////
+bool parseVersion(const char *buf, size_t len, Reply &reply)
+{
+    reply = Reply();
+
+    const char *prevBegin, *payload, *end;
+    if (!splitReply(buf, len, prevBegin, payload, end))
+        return false;
+
+    reply.payload = payload;
+    reply.payloadLen = static_cast<size_t>(end - payload);
+
+    if (parseError(prevBegin, payload, end, reply))
+        return true;
+
+    // the segment before the version is the numeric hardware id
+    for (const char *p = prevBegin; p < payload - 1; ++p)
+    {
+        if (!isDigit(*p))
+            return false;
+    }
+
+    int part = 0;
+    bool haveDigit = false;
+    for (const char *p = payload; p < end; ++p)
+    {
+        if (isDigit(*p))
+        {
+            reply.version[part] = reply.version[part] * 10 + (*p - '0');
+            haveDigit = true;
+        }
+        else if (*p == '.' && haveDigit && part < 2)
+        {
+            ++part;
+            haveDigit = false;
+        }
+        else
+            return false;
+    }
+    if (!haveDigit)
+        return false;
+
+    reply.type = Reply::REPLY_VERSION;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Request echo
+/////////////////////////////////////////////////////////////////////////////
+bool matchesRequest(const char *request, const char *buf, size_t len)
+{
+    if (request == nullptr || buf == nullptr)
+        return false;
+
+    size_t i = 0;
+    for (; request[i] && request[i] != STOP_CHAR; ++i)
+    {
+        if (i >= len || buf[i] != request[i])
+            return false;
+    }
+    return i > 0 && i < len && buf[i] == ':';
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Command classes
+/////////////////////////////////////////////////////////////////////////////
+const char *commandClassName(CommandClass commandClass)
+{
+    static const char *const names[CLASS_COUNT] = {"Status", "Motion", "Abort", "Config", "Flash"};
+    return commandClass < CLASS_COUNT ? names[commandClass] : "Unknown";
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Request encoding. Same text as snprintf("%.2f") / ("%d") for the values
+/// the controller takes, without the format string parse.
+/////////////////////////////////////////////////////////////////////////////
+namespace
+{
+// Writes the decimal digits of value backwards from end, returns the first
+char *writeDigits(char *end, uint64_t value, int minDigits)
+{
+    do
+    {
+        *--end = static_cast<char>('0' + value % 10);
+        value /= 10;
+        --minDigits;
+    }
+    while (value > 0 || minDigits > 0);
+    return end;
+}
+
+// Hundredths of |value| rounded like printf: the exact binary value decides,
+// a tie goes to even
+uint64_t hundredths(double magnitude)
+{
+    const double whole = std::floor(magnitude);
+    const double cents = (magnitude - whole) * 100;
+    double rounded = std::floor(cents);
+    const double rest = cents - rounded;
+    if (rest > 0.5)
+        rounded++;
+    else if (rest == 0.5)
+    {
+        // what the multiplication rounded away
+        const double error = std::fma(magnitude - whole, 100, -cents);
+        if (error > 0 || (error == 0 && std::fmod(rounded, 2) != 0))
+            rounded++;
+    }
+    return static_cast<uint64_t>(whole) * 100 + static_cast<uint64_t>(rounded);
+}
+
+// False if value is not finite or out of the ArgType range
+bool appendArg(char *&out, ArgType argType, double value)
+{
+    if (!std::isfinite(value) || std::fabs(value) >= 1e6)
+        return false;
+
+    const double magnitude = std::fabs(value);
+    char digits[16];
+    char *const end = digits + sizeof(digits);
+    char *begin;
+    bool negative = std::signbit(value);
+    if (argType == ARG_FIXED2)
+    {
+        const uint64_t cents = hundredths(magnitude);
+        begin = writeDigits(end, cents % 100, 2);
+        *--begin = '.';
+        begin = writeDigits(begin, cents / 100, 1);
+    }
+    else
+    {
+        const uint64_t units = static_cast<uint64_t>(std::llround(magnitude));
+        begin = writeDigits(end, units, 1);
+        negative = negative && units > 0;
+    }
+    if (negative)
+        *--begin = '-';
+
+    *out++ = ' ';
+    memcpy(out, begin, static_cast<size_t>(end - begin));
+    out += end - begin;
+    return true;
+}
+}
+
+bool encode(Request &request, Command command, const double *args, size_t count)
+{
+    request.command = command;
+    request.len = 0;
+    request.text[0] = 0;
+    if (command >= CMD_COUNT || count != Table::COMMANDS[command].argCount)
+        return false;
+
+    // REQUEST_LEN holds the widest arguments, see Check::fits
+    const CommandSpec &spec = Table::COMMANDS[command];
+    char *out = request.text;
+    for (const char *text = spec.text; *text; ++text)
+        *out++ = *text;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!appendArg(out, spec.argType, args[i]))
+        {
+            request.text[0] = 0;
+            return false;
+        }
+    }
+    *out++ = STOP_CHAR;
+    *out = 0;
+    request.len = static_cast<uint32_t>(out - request.text);
+    return true;
+}
+
+}
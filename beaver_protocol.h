@@ -0,0 +1,294 @@
+/*
+    NexDome Beaver Controller - Protocol Decoder
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+/// Lunatico replies have the form "!<cmd>:<value>#", e.g.
+///     !dome getaz:123.45#
+///     !dome gotoaz 400:error:-5#
+///     !seletek tversion:2:1.1.1#
+/// Decoding works in place on the receive buffer: no allocation, no regex.
+///////////////////////////////////////////////////////////////////////////////
+namespace BeaverProtocol
+{
+
+struct Reply
+{
+    enum Type
+    {
+        REPLY_INVALID,
+        REPLY_NUMBER,
+        REPLY_ERROR,
+        REPLY_VERSION
+    };
+
+    Type type {REPLY_INVALID};
+    // REPLY_NUMBER
+    double value {0};
+    // REPLY_ERROR
+    int errorCode {0};
+    // REPLY_VERSION (major, minor, patch)
+    int version[3] {0, 0, 0};
+    // Payload after the command echo, points into the decoded buffer (not terminated)
+    const char *payload {nullptr};
+    size_t payloadLen {0};
+};
+
+// Decode a numeric reply. Sets REPLY_NUMBER, REPLY_ERROR or REPLY_INVALID.
+// buf may or may not include the trailing stop char.
+bool parseReply(const char *buf, size_t len, Reply &reply);
+
+// Decode a "!seletek tversion#" reply. Sets REPLY_VERSION, REPLY_ERROR or REPLY_INVALID.
+bool parseVersion(const char *buf, size_t len, Reply &reply);
+
+// Strict decimal parse of [begin, end): optional '-', digits, optional '.' and digits.
+bool parseNumber(const char *begin, const char *end, double &value);
+
+// True if buf is the reply to request, i.e. starts with the request echo and a ':'.
+// request may carry the trailing stop char.
+bool matchesRequest(const char *request, const char *buf, size_t len);
+
+// What a request does, each class gets its own timeout and retry budget
+enum CommandClass
+{
+    CLASS_STATUS,   // read-only queries: status, get*, at*, version
+    CLASS_MOTION,   // starts or changes a movement
+    CLASS_ABORT,    // stops everything
+    CLASS_CONFIG,   // set* writes to the controller RAM
+    CLASS_FLASH,    // savefs, commits the settings to flash
+    CLASS_COUNT
+};
+
+const char *commandClassName(CommandClass commandClass);
+
+///////////////////////////////////////////////////////////////////////////////
+/// Every request the driver sends. The table below is indexed by Command and
+/// holds all the driver needs to know about one: the text before the
+/// arguments, the arguments, what the reply carries, the class that picks
+/// timeout and retries, and whether it is safe to send again when the reply
+/// is lost (queries, abort and absolute set* values; moves and savefs are
+/// not, the first copy may have been acted on).
+///////////////////////////////////////////////////////////////////////////////
+enum Command
+{
+    CMD_VERSION,
+    CMD_SAVEFS,
+    // dome status
+    CMD_GETAZ,
+    CMD_STATUS,
+    CMD_SHUTTERISUP,
+    CMD_ATHOME,
+    CMD_ATPARK,
+    CMD_GETSHUTTERBATVOLTAGE,
+    // motion
+    CMD_GOTOAZ,
+    CMD_GOHOME,
+    CMD_GOPARK,
+    CMD_OPENSHUTTER,
+    CMD_CLOSESHUTTER,
+    CMD_AUTOCALROT,
+    CMD_AUTOCALSHUTTER,
+    CMD_ABORT,
+    // rotator settings
+    CMD_GETHOME,
+    CMD_GETPARK,
+    CMD_GETMAXSPEED,
+    CMD_GETMINSPEED,
+    CMD_GETACCELERATION,
+    CMD_GETMAXFULLROTSECS,
+    CMD_SETHOME,
+    CMD_SETPARK,
+    CMD_SETMAXSPEED,
+    CMD_SETMINSPEED,
+    CMD_SETACCELERATION,
+    CMD_SETMAXFULLROTSECS,
+    // shutter settings
+    CMD_GETSHUTTERMAXSPEED,
+    CMD_GETSHUTTERMINSPEED,
+    CMD_GETSHUTTERACCELERATION,
+    CMD_GETSHUTTERTIMEOUTOPENCLOSE,
+    CMD_GETSHUTTERSAFEVOLTAGE,
+    CMD_SETSHUTTERMAXSPEED,
+    CMD_SETSHUTTERMINSPEED,
+    CMD_SETSHUTTERACCELERATION,
+    CMD_SETSHUTTERSAFEVOLTAGE,
+    CMD_COUNT
+};
+
+enum ArgType
+{
+    ARG_NONE,
+    ARG_INT,        // -999999 to 999999
+    ARG_FIXED2      // two decimals, -999999.99 to 999999.99
+};
+
+struct CommandSpec
+{
+    Command command;
+    // "!<group> <verb>", the arguments follow space separated, then the stop char
+    const char *text;
+    ArgType argType;
+    unsigned argCount;
+    // REPLY_NUMBER or REPLY_VERSION
+    Reply::Type reply;
+    CommandClass commandClass;
+    bool idempotent;
+};
+
+// A static member, unlike a constexpr array at namespace scope, is one object
+// for the whole program; it is defined in beaver_protocol.cpp
+struct Table
+{
+    static constexpr CommandSpec COMMANDS[CMD_COUNT] =
+    {
+        {CMD_VERSION, "!seletek tversion", ARG_NONE, 0, Reply::REPLY_VERSION, CLASS_STATUS, true},
+        {CMD_SAVEFS, "!seletek savefs", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_FLASH, false},
+
+        {CMD_GETAZ, "!dome getaz", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_STATUS, "!dome status", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_SHUTTERISUP, "!dome shutterisup", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_ATHOME, "!dome athome", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_ATPARK, "!dome atpark", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETSHUTTERBATVOLTAGE, "!dome getshutterbatvoltage", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+
+        {CMD_GOTOAZ, "!dome gotoaz", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        {CMD_GOHOME, "!dome gohome", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        {CMD_GOPARK, "!dome gopark", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        {CMD_OPENSHUTTER, "!dome openshutter", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        {CMD_CLOSESHUTTER, "!dome closeshutter", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        // 1 calibrates and leaves the rotator there, 0 goes back to where it was
+        {CMD_AUTOCALROT, "!dome autocalrot", ARG_INT, 1, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        {CMD_AUTOCALSHUTTER, "!dome autocalshutter", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_MOTION, false},
+        // rotator, shutter, and the shutter's controller; 1 to stop
+        {CMD_ABORT, "!dome abort", ARG_INT, 3, Reply::REPLY_NUMBER, CLASS_ABORT, true},
+
+        {CMD_GETHOME, "!domerot gethome", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETPARK, "!domerot getpark", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETMAXSPEED, "!domerot getmaxspeed", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETMINSPEED, "!domerot getminspeed", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETACCELERATION, "!domerot getacceleration", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETMAXFULLROTSECS, "!domerot getmaxfullrotsecs", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_SETHOME, "!domerot sethome", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETPARK, "!domerot setpark", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETMAXSPEED, "!domerot setmaxspeed", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETMINSPEED, "!domerot setminspeed", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETACCELERATION, "!domerot setacceleration", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETMAXFULLROTSECS, "!domerot setmaxfullrotsecs", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+
+        {CMD_GETSHUTTERMAXSPEED, "!dome getshuttermaxspeed", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETSHUTTERMINSPEED, "!dome getshutterminspeed", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETSHUTTERACCELERATION, "!dome getshutteracceleration", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETSHUTTERTIMEOUTOPENCLOSE, "!dome getshuttertimeoutopenclose", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_GETSHUTTERSAFEVOLTAGE, "!dome getshuttersafevoltage", ARG_NONE, 0, Reply::REPLY_NUMBER, CLASS_STATUS, true},
+        {CMD_SETSHUTTERMAXSPEED, "!dome setshuttermaxspeed", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETSHUTTERMINSPEED, "!dome setshutterminspeed", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETSHUTTERACCELERATION, "!dome setshutteracceleration", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+        {CMD_SETSHUTTERSAFEVOLTAGE, "!dome setshuttersafevoltage", ARG_FIXED2, 1, Reply::REPLY_NUMBER, CLASS_CONFIG, true},
+    };
+};
+
+// Longest request plus the terminating 0
+const size_t REQUEST_LEN = 48;
+
+namespace Check
+{
+constexpr size_t textLength(const char *text)
+{
+    return *text ? 1 + textLength(text + 1) : 0;
+}
+
+constexpr size_t argLength(ArgType argType)
+{
+    return argType == ARG_FIXED2 ? 10 : argType == ARG_INT ? 7 : 0;
+}
+
+// text, a space and the widest value per argument, the stop char
+constexpr size_t encodedLength(const CommandSpec &spec)
+{
+    return textLength(spec.text) + spec.argCount * (1 + argLength(spec.argType)) + 1;
+}
+
+constexpr bool inOrder(size_t i = 0)
+{
+    return i == CMD_COUNT || (Table::COMMANDS[i].command == static_cast<Command>(i) && inOrder(i + 1));
+}
+
+constexpr bool fits(size_t i = 0)
+{
+    return i == CMD_COUNT || (encodedLength(Table::COMMANDS[i]) < REQUEST_LEN && fits(i + 1));
+}
+
+constexpr bool argsDeclared(size_t i = 0)
+{
+    return i == CMD_COUNT || ((Table::COMMANDS[i].argType == ARG_NONE) == (Table::COMMANDS[i].argCount == 0) &&
+                              argsDeclared(i + 1));
+}
+}
+
+static_assert(Check::inOrder(), "Table::COMMANDS must be in Command order");
+static_assert(Check::fits(), "a request does not fit REQUEST_LEN");
+static_assert(Check::argsDeclared(), "a command has arguments without a type or a type without arguments");
+
+inline const CommandSpec &commandSpec(Command command)
+{
+    return Table::COMMANDS[command];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// An encoded request, the text lives in the object: building one, copying it
+/// into a queued job or a lambda never touches the heap. len is 0 if the
+/// arguments could not be encoded (out of range or not finite).
+///////////////////////////////////////////////////////////////////////////////
+struct Request
+{
+    Command command {CMD_COUNT};
+    uint32_t len {0};
+    char text[REQUEST_LEN] {};
+
+    bool valid() const
+    {
+        return len > 0;
+    }
+    const CommandSpec &spec() const
+    {
+        return Table::COMMANDS[command];
+    }
+};
+
+// For callers that pick the command at run time, e.g. from a settings table.
+// False, and request.len 0, if count does not match the command or a value does not fit.
+bool encode(Request &request, Command command, const double *args, size_t count);
+
+// The argument count is checked at compile time:
+//     sendCommand(BeaverProtocol::request<BeaverProtocol::CMD_GOTOAZ>(az), res);
+template <Command C, typename... Args>
+Request request(Args... args)
+{
+    static_assert(sizeof...(Args) == Table::COMMANDS[C].argCount, "wrong number of arguments for this command");
+    const double values[] = {static_cast<double>(args)..., 0};
+    Request result;
+    encode(result, C, values, sizeof...(Args));
+    return result;
+}
+
+}
@@ -0,0 +1,112 @@
+/*
+    NexDome Beaver Controller - Property Publisher
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_publish.h"
+
+#include <cmath>
+
+void PropertyPublisher::setDeadband(const std::string &name, double deadband)
+{
+    m_Entries[name].deadband = deadband;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+void PropertyPublisher::update(const std::string &name, int state, const std::vector<double> &numbers, Sender send)
+{
+    Content content;
+    content.state = state;
+    content.numbers = numbers;
+    queue(name, content, send);
+}
+
+void PropertyPublisher::update(const std::string &name, int state, const std::string &text, Sender send)
+{
+    Content content;
+    content.state = state;
+    content.text = text;
+    queue(name, content, send);
+}
+
+void PropertyPublisher::queue(const std::string &name, const Content &content, Sender send)
+{
+    Entry &entry = m_Entries[name];
+    // replaced within the tick
+    if (entry.pending)
+        m_Suppressed++;
+    entry.pending = true;
+    entry.next = content;
+    entry.send = send;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// End of tick
+/////////////////////////////////////////////////////////////////////////////
+void PropertyPublisher::flush()
+{
+    for (auto &item : m_Entries)
+    {
+        Entry &entry = item.second;
+        if (!entry.pending)
+            continue;
+        entry.pending = false;
+
+        if (!changed(entry))
+        {
+            m_Suppressed++;
+            continue;
+        }
+        entry.sent = entry.next;
+        entry.hasSent = true;
+        m_Sent++;
+        entry.send();
+    }
+}
+
+void PropertyPublisher::reset()
+{
+    for (auto &item : m_Entries)
+        item.second.hasSent = false;
+}
+
+void PropertyPublisher::forget(const std::string &name)
+{
+    const auto entry = m_Entries.find(name);
+    if (entry != m_Entries.end())
+        entry->second.hasSent = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Compared with what clients last saw, so slow drift still gets through
+/////////////////////////////////////////////////////////////////////////////
+bool PropertyPublisher::changed(const Entry &entry)
+{
+    if (!entry.hasSent || entry.next.state != entry.sent.state || entry.next.text != entry.sent.text ||
+            entry.next.numbers.size() != entry.sent.numbers.size())
+        return true;
+
+    for (size_t i = 0; i < entry.next.numbers.size(); i++)
+    {
+        const double delta = fabs(entry.next.numbers[i] - entry.sent.numbers[i]);
+        if (entry.deadband > 0 ? delta >= entry.deadband : delta > 0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,86 @@
+/*
+    NexDome Beaver Controller - Property Publisher
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+/// Change-only publication of poll driven properties. Updates queued during a
+/// tick are coalesced per property; flush() sends a property only if its state,
+/// text or a number moved past the deadband since it was last sent.
+///////////////////////////////////////////////////////////////////////////////
+class PropertyPublisher
+{
+    public:
+        // Sends the property as it is now, e.g. property.apply()
+        typedef std::function<void()> Sender;
+
+        // Numbers within deadband of the last sent value count as unchanged
+        void setDeadband(const std::string &name, double deadband);
+
+        // Queue the current content, a later update in the same tick replaces it
+        void update(const std::string &name, int state, const std::vector<double> &numbers, Sender send);
+        void update(const std::string &name, int state, const std::string &text, Sender send);
+
+        // Send everything that changed, at most once per property
+        void flush();
+        // Forget what was sent, e.g. after the properties were defined again
+        void reset();
+        // The property was sent around the publisher, its next update goes out regardless
+        void forget(const std::string &name);
+
+        uint64_t sent() const
+        {
+            return m_Sent;
+        }
+        uint64_t suppressed() const
+        {
+            return m_Suppressed;
+        }
+
+    private:
+        struct Content
+        {
+            int state {-1};
+            std::vector<double> numbers;
+            std::string text;
+        };
+
+        struct Entry
+        {
+            double deadband {0};
+            bool hasSent {false};
+            bool pending {false};
+            Content sent;
+            Content next;
+            Sender send;
+        };
+
+        void queue(const std::string &name, const Content &content, Sender send);
+        static bool changed(const Entry &entry);
+
+        std::map<std::string, Entry> m_Entries;
+        uint64_t m_Sent {0};
+        uint64_t m_Suppressed {0};
+};
@@ -0,0 +1,91 @@
+/*
+    NexDome Beaver Controller - Shared Memory Status
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_shm.h"
+
+BeaverShmWriter::~BeaverShmWriter()
+{
+    stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// A segment left behind by a crashed driver is taken over
+/////////////////////////////////////////////////////////////////////////////
+bool BeaverShmWriter::start(const std::string &device)
+{
+    stop();
+    m_Name = BeaverShm::segmentName(device);
+    const int fd = shm_open(m_Name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(BeaverShmSegment)) == 0)
+        map = mmap(nullptr, sizeof(BeaverShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(m_Name.c_str());
+        return false;
+    }
+
+    m_Segment = static_cast<BeaverShmSegment *>(map);
+    // odd until the header is complete, for readers of a taken over segment
+    uint64_t sequence = m_Segment->sequence.load(std::memory_order_relaxed);
+    sequence += (sequence & 1) ? 2 : 1;
+    m_Segment->sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memset(&m_Segment->status, 0, sizeof(m_Segment->status));
+    memcpy(m_Segment->magic, BeaverShm::MAGIC, sizeof(m_Segment->magic));
+    m_Segment->version = BeaverShm::VERSION;
+    m_Segment->size = sizeof(BeaverShmSegment);
+    m_Segment->pid = static_cast<uint32_t>(getpid());
+    m_Segment->reserved = 0;
+    m_Segment->sequence.store(sequence + 1, std::memory_order_release);
+    return true;
+}
+
+void BeaverShmWriter::stop()
+{
+    if (m_Segment == nullptr)
+        return;
+
+    BeaverShmStatus status = m_Segment->status;
+    status.flags &= ~BeaverShmStatus::CONNECTED;
+    publish(status);
+
+    munmap(m_Segment, sizeof(BeaverShmSegment));
+    m_Segment = nullptr;
+    shm_unlink(m_Name.c_str());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Single writer: the INDI thread
+/////////////////////////////////////////////////////////////////////////////
+void BeaverShmWriter::publish(const BeaverShmStatus &status)
+{
+    if (m_Segment == nullptr)
+        return;
+
+    const uint64_t sequence = m_Segment->sequence.load(std::memory_order_relaxed);
+    m_Segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&m_Segment->status, &status, sizeof(status));
+    m_Segment->sequence.store(sequence + 2, std::memory_order_release);
+}
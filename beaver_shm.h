@@ -0,0 +1,226 @@
+/*
+    NexDome Beaver Controller - Shared Memory Status
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+/// The driver publishes its state once per poll into a POSIX shared memory
+/// segment, /<device name> with anything but letters and digits as '_', e.g.
+/// /Beaver_Dome. Local programs read it without an INDI connection:
+///
+///     BeaverShmReader reader;
+///     BeaverShmStatus status;
+///     if (reader.open("Beaver Dome") && reader.read(status))
+///         printf("%.1f\n", status.az);
+///
+/// This header is all a reader needs (link with -lrt on older glibc).
+/// Updates are guarded by a sequence counter, odd while the driver writes:
+/// the driver never waits for readers, readers retry the rare copy that
+/// overlapped a write.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct BeaverShmStatus
+{
+    enum
+    {
+        AZ_VALID = 0x1,
+        STATUS_VALID = 0x2,
+        VOLTS_VALID = 0x4,
+        SHUTTER_ONLINE = 0x8,
+        // cleared when the driver disconnects; the values are the last ones read
+        CONNECTED = 0x10
+    };
+
+    // wall clock of the poll, microseconds since the epoch
+    int64_t timeUS;
+    // polls since the driver connected
+    uint64_t tick;
+    double az;
+    double targetAz;
+    // seconds to the rotator target, 0 when not moving
+    double etaS;
+    double shutterVolts;
+    // DOME_STATUS bits as read from the controller
+    uint16_t status;
+    // BeaverState::RotatorOperation and BeaverState::ShutterActivity
+    uint8_t rotatorOp;
+    uint8_t shutterActivity;
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+
+struct BeaverShmSegment
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    // of the driver
+    uint32_t pid;
+    uint32_t reserved;
+    std::atomic<uint64_t> sequence;
+    BeaverShmStatus status;
+};
+
+static_assert(sizeof(BeaverShmStatus) == 56, "shared memory status layout");
+static_assert(sizeof(BeaverShmSegment) == 88, "shared memory segment layout");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the sequence must be lock-free to be shared between processes");
+
+namespace BeaverShm
+{
+const char MAGIC[8] = {'B', 'V', 'R', 'S', 'T', 'A', 'T', 'E'};
+const uint32_t VERSION = 1;
+
+inline std::string segmentName(const std::string &device)
+{
+    std::string name = "/" + device;
+    for (size_t i = 1; i < name.size(); i++)
+        if (!isalnum(static_cast<unsigned char>(name[i])))
+            name[i] = '_';
+    return name;
+}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Maps a segment read-only. A driver restart makes a new segment, so a
+/// reader that sees CONNECTED cleared for long should open() again.
+///////////////////////////////////////////////////////////////////////////////
+class BeaverShmReader
+{
+    public:
+        BeaverShmReader() = default;
+        ~BeaverShmReader()
+        {
+            close();
+        }
+
+        BeaverShmReader(const BeaverShmReader &) = delete;
+        BeaverShmReader &operator=(const BeaverShmReader &) = delete;
+
+        // False if the driver is not running or the layout is not this one
+        bool open(const std::string &device = "Beaver Dome")
+        {
+            close();
+            const int fd = shm_open(BeaverShm::segmentName(device).c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+            void *map = MAP_FAILED;
+            if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(BeaverShmSegment))
+                map = mmap(nullptr, sizeof(BeaverShmSegment), PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (map == MAP_FAILED)
+                return false;
+
+            m_Segment = static_cast<const BeaverShmSegment *>(map);
+            if (memcmp(m_Segment->magic, BeaverShm::MAGIC, sizeof(m_Segment->magic)) ||
+                    m_Segment->version != BeaverShm::VERSION || m_Segment->size != sizeof(BeaverShmSegment))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            if (m_Segment != nullptr)
+                munmap(const_cast<BeaverShmSegment *>(m_Segment), sizeof(BeaverShmSegment));
+            m_Segment = nullptr;
+        }
+
+        bool isOpen() const
+        {
+            return m_Segment != nullptr;
+        }
+
+        // A consistent copy of the latest status; false only if the driver
+        // kept writing (or died while writing) for all attempts
+        bool read(BeaverShmStatus &status, int attempts = 1000) const
+        {
+            if (m_Segment == nullptr)
+                return false;
+
+            for (int i = 0; i < attempts; i++)
+            {
+                const uint64_t before = m_Segment->sequence.load(std::memory_order_acquire);
+                if ((before & 1) == 0)
+                {
+                    memcpy(&status, &m_Segment->status, sizeof(status));
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (m_Segment->sequence.load(std::memory_order_relaxed) == before)
+                        return true;
+                }
+                // a write takes well under a microsecond, unless the driver was preempted in it
+                if (i > 0 && i % 16 == 0)
+                    sched_yield();
+            }
+            return false;
+        }
+
+        // Changes every time the driver publishes
+        uint64_t sequence() const
+        {
+            return m_Segment ? m_Segment->sequence.load(std::memory_order_acquire) : 0;
+        }
+
+    private:
+        const BeaverShmSegment *m_Segment {nullptr};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// The driver's side: creates the segment and publishes into it from the
+/// INDI thread. Not needed by readers, see beaver_shm.cpp.
+///////////////////////////////////////////////////////////////////////////////
+class BeaverShmWriter
+{
+    public:
+        BeaverShmWriter() = default;
+        ~BeaverShmWriter();
+
+        BeaverShmWriter(const BeaverShmWriter &) = delete;
+        BeaverShmWriter &operator=(const BeaverShmWriter &) = delete;
+
+        bool start(const std::string &device);
+        // Publishes the last status with CONNECTED cleared and removes the segment name
+        void stop();
+        bool isRunning() const
+        {
+            return m_Segment != nullptr;
+        }
+
+        // Wait-free, a copy between two counter updates
+        void publish(const BeaverShmStatus &status);
+
+    private:
+        BeaverShmSegment *m_Segment {nullptr};
+        std::string m_Name;
+};
@@ -0,0 +1,390 @@
+/*
+    NexDome Beaver Controller - Firmware Simulator
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_sim_model.h"
+#include "beaver_trace.h"
+
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct LinkConfig
+{
+    // one way delay applied to every reply
+    double latencyMs {0};
+    // uniform +/- jitter on top of the latency
+    double jitterMs {0};
+    // probability that a request or a reply is lost
+    double loss {0};
+};
+
+struct Channel
+{
+    int fd {-1};
+    bool udp {false};
+    char buf[256];
+    size_t len {0};
+    sockaddr_in peer;
+};
+
+struct PendingReply
+{
+    Clock::time_point due;
+    int channel;
+    std::string data;
+    sockaddr_in peer;
+};
+
+volatile sig_atomic_t g_Quit = 0;
+
+void onSignal(int)
+{
+    g_Quit = 1;
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -l ms     reply latency (default 0)\n"
+            "  -j ms     reply jitter, uniform +/- (default 0)\n"
+            "  -p prob   request/reply loss probability 0..1 (default 0)\n"
+            "  -u port   UDP port on 127.0.0.1, 0 disables (default 10000)\n"
+            "  -s path   symlink to the pty slave, e.g. /tmp/beaver\n"
+            "  -n        no shutter unit\n"
+            "  -S steps  rotator steps per degree (default 133.3)\n"
+            "  -t secs   shutter travel time (default 25)\n"
+            "  -r seed   random seed for jitter and loss\n"
+            "  -R trace  answer from a recorded serial trace instead of the model\n"
+            "  -f        replay as fast as possible, not at the recorded latency\n"
+            "  -v        log traffic\n", name);
+}
+
+int openPty(const char *link)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    const char *slave = ptsname(master);
+    // Keep a slave handle open so the master never sees EIO between driver sessions
+    int slaveFD = open(slave, O_RDWR | O_NOCTTY);
+    if (slaveFD >= 0)
+    {
+        termios tio;
+        tcgetattr(slaveFD, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slaveFD, TCSANOW, &tio);
+    }
+
+    printf("Serial: %s\n", slave);
+    if (link)
+    {
+        unlink(link);
+        if (symlink(slave, link) == 0)
+            printf("Serial link: %s\n", link);
+        else
+            perror("symlink");
+    }
+    return master;
+}
+
+int openUdp(int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    printf("UDP: 127.0.0.1:%d\n", port);
+    return fd;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    BeaverSimConfig config;
+    LinkConfig link;
+    int udpPort = 10000;
+    const char *ptyLink = nullptr;
+    bool verbose = false;
+    unsigned seed = std::random_device()();
+    const char *tracePath = nullptr;
+    bool fast = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l:j:p:u:s:nS:t:r:R:fvh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                link.latencyMs = atof(optarg);
+                break;
+            case 'j':
+                link.jitterMs = atof(optarg);
+                break;
+            case 'p':
+                link.loss = atof(optarg);
+                break;
+            case 'u':
+                udpPort = atoi(optarg);
+                break;
+            case 's':
+                ptyLink = optarg;
+                break;
+            case 'n':
+                config.shutterPresent = false;
+                break;
+            case 'S':
+                config.stepsPerDegree = atof(optarg);
+                break;
+            case 't':
+                config.shutterTravelSecs = atof(optarg);
+                break;
+            case 'r':
+                seed = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+                break;
+            case 'R':
+                tracePath = optarg;
+                break;
+            case 'f':
+                fast = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (link.latencyMs < 0 || link.jitterMs < 0 || link.loss < 0 || link.loss > 1 || config.stepsPerDegree <= 0
+            || config.shutterTravelSecs <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceFrame> frames;
+    std::unique_ptr<TraceReplay> replay;
+    if (tracePath)
+    {
+        if (!loadTrace(tracePath, frames))
+        {
+            fprintf(stderr, "%s: not a Beaver serial trace\n", tracePath);
+            return 1;
+        }
+        replay.reset(new TraceReplay(frames));
+        printf("Replaying %zu frames from %s%s\n", frames.size(), tracePath, fast ? " as fast as possible" : "");
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Channel channels[2];
+    int nchannels = 0;
+    channels[nchannels].fd = openPty(ptyLink);
+    if (channels[nchannels].fd < 0)
+        return 1;
+    nchannels++;
+    if (udpPort > 0)
+    {
+        channels[nchannels].fd = openUdp(udpPort);
+        channels[nchannels].udp = true;
+        if (channels[nchannels].fd < 0)
+            return 1;
+        nchannels++;
+    }
+    fflush(stdout);
+
+    BeaverSimModel model(config);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::deque<PendingReply> pending;
+    Clock::time_point lastStep = Clock::now();
+
+    while (!g_Quit)
+    {
+        // Wake up for the next due reply or to advance the model
+        int timeoutMs = 50;
+        const Clock::time_point now = Clock::now();
+        if (!pending.empty())
+        {
+            const long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(pending.front().due - now).count();
+            timeoutMs = static_cast<int>(std::max(0LL, std::min<long long>(timeoutMs, wait)));
+        }
+
+        pollfd fds[2];
+        for (int i = 0; i < nchannels; i++)
+        {
+            fds[i].fd = channels[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, nchannels, timeoutMs) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        const Clock::time_point stepTime = Clock::now();
+        model.step(std::chrono::duration<double>(stepTime - lastStep).count());
+        lastStep = stepTime;
+
+        for (int i = 0; i < nchannels; i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+
+            Channel &channel = channels[i];
+            char chunk[256];
+            ssize_t n;
+            if (channel.udp)
+            {
+                socklen_t peerLen = sizeof(channel.peer);
+                n = recvfrom(channel.fd, chunk, sizeof(chunk), 0, reinterpret_cast<sockaddr *>(&channel.peer), &peerLen);
+            }
+            else
+                n = read(channel.fd, chunk, sizeof(chunk));
+            if (n <= 0)
+                continue;
+
+            for (ssize_t k = 0; k < n; k++)
+            {
+                if (channel.len < sizeof(channel.buf))
+                    channel.buf[channel.len++] = chunk[k];
+                if (chunk[k] != '#')
+                    continue;
+
+                // Skip anything ahead of the start of a command
+                const char *start = static_cast<const char *>(memchr(channel.buf, '!', channel.len));
+                const size_t len = start ? channel.len - static_cast<size_t>(start - channel.buf) : 0;
+                channel.len = 0;
+                if (len == 0)
+                    continue;
+
+                if (uniform(rng) < link.loss)
+                {
+                    if (verbose)
+                        fprintf(stderr, "drop request %.*s\n", static_cast<int>(len), start);
+                    continue;
+                }
+
+                std::string reply;
+                double delayMs = 0;
+                if (replay)
+                {
+                    const bool wasFinished = replay->finished();
+                    double recordedS = 0;
+                    if (!replay->handle(start, len, reply, recordedS))
+                    {
+                        if (verbose)
+                            fprintf(stderr, "%.*s -> (no reply in trace)\n", static_cast<int>(len), start);
+                        continue;
+                    }
+                    if (!fast)
+                        delayMs = recordedS * 1000;
+                    if (!wasFinished && replay->finished())
+                        printf("Replay reached the end of the trace\n");
+                }
+                else
+                {
+                    char buf[160];
+                    reply.assign(buf, model.handle(start, len, buf, sizeof(buf)));
+                }
+                if (verbose)
+                    fprintf(stderr, "%.*s -> %s\n", static_cast<int>(len), start, reply.c_str());
+                if (uniform(rng) < link.loss)
+                {
+                    if (verbose)
+                        fprintf(stderr, "drop reply\n");
+                    continue;
+                }
+
+                delayMs += link.latencyMs + (uniform(rng) * 2 - 1) * link.jitterMs;
+                PendingReply out;
+                out.due = Clock::now() + std::chrono::microseconds(static_cast<long long>(std::max(0.0, delayMs) * 1000));
+                out.channel = i;
+                out.data = reply;
+                out.peer = channel.peer;
+
+                // A serial line never reorders, so keep replies in order
+                if (!pending.empty() && out.due < pending.back().due)
+                    out.due = pending.back().due;
+                pending.push_back(out);
+            }
+        }
+
+        const Clock::time_point sendTime = Clock::now();
+        while (!pending.empty() && pending.front().due <= sendTime)
+        {
+            const PendingReply &out = pending.front();
+            const Channel &channel = channels[out.channel];
+            if (channel.udp)
+                sendto(channel.fd, out.data.data(), out.data.size(), 0, reinterpret_cast<const sockaddr *>(&out.peer), sizeof(out.peer));
+            else if (write(channel.fd, out.data.data(), out.data.size()) < 0)
+                perror("write");
+            pending.pop_front();
+        }
+    }
+
+    if (replay)
+        printf("Replay: %llu requests matched the trace, %llu answered out of order or not at all\n",
+               static_cast<unsigned long long>(replay->matched()), static_cast<unsigned long long>(replay->missed()));
+    if (ptyLink)
+        unlink(ptyLink);
+    return 0;
+}
@@ -0,0 +1,450 @@
+/*
+    NexDome Beaver Controller - Firmware Simulator Model
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_sim_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+// Within this many degrees the rotator counts as at home/park
+const double POSITION_TOLERANCE = 0.5;
+// Error codes returned as "...:error:<code>#"
+const int ERROR_UNKNOWN_COMMAND = -1;
+const int ERROR_BAD_ARGUMENT = -2;
+const int ERROR_NO_SHUTTER = -3;
+const int ERROR_BUSY = -4;
+
+double range360(double az)
+{
+    az = fmod(az, 360.0);
+    return az < 0 ? az + 360.0 : az;
+}
+
+// shortest signed travel from -> to
+double shortestTravel(double from, double to)
+{
+    double delta = range360(to - from);
+    return delta > 180.0 ? delta - 360.0 : delta;
+}
+}
+
+BeaverSimModel::BeaverSimModel(const BeaverSimConfig &config) : m_Config(config)
+{
+    m_BatteryVolts = m_Config.batteryRestVolts;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Physics
+/////////////////////////////////////////////////////////////////////////////
+void BeaverSimModel::step(double dt)
+{
+    if (dt <= 0)
+        return;
+
+    stepRotator(dt);
+    stepShutter(dt);
+
+    if (m_ShutterOp != SHUT_IDLE)
+        m_BatteryVolts -= m_Config.batteryDrainPerMovingSec * dt;
+    else
+        m_BatteryVolts = std::min(m_Config.batteryRestVolts, m_BatteryVolts + m_Config.batteryChargePerSec * dt);
+
+    // Firmware failsafe: close on low battery
+    if (m_Config.shutterPresent && shutterVolts() < m_ShutterSafeVolts && m_ShutterPos > 0 && m_ShutterOp != SHUT_CLOSING)
+        shutterMove(SHUT_CLOSING);
+}
+
+void BeaverSimModel::stepRotator(double dt)
+{
+    if (m_RotatorOp == ROT_IDLE)
+        return;
+
+    const double vMax = m_MaxSpeed / m_Config.stepsPerDegree;
+    const double vMin = std::min(vMax, m_MinSpeed / m_Config.stepsPerDegree);
+    const double accel = m_Acceleration / m_Config.stepsPerDegree;
+
+    // Trapezoidal profile starting and ending at min speed
+    const double distance = fabs(m_Remaining);
+    const double braking = (m_Speed * m_Speed - vMin * vMin) / (2 * accel);
+    if (distance <= braking)
+        m_Speed = std::max(vMin, m_Speed - accel * dt);
+    else
+        m_Speed = std::min(vMax, m_Speed + accel * dt);
+
+    const double travel = std::min(distance, m_Speed * dt);
+    const double direction = m_Remaining < 0 ? -1 : 1;
+    m_Az = range360(m_Az + direction * travel);
+    m_Remaining -= direction * travel;
+    m_MoveSecs += dt;
+
+    if (fabs(m_Remaining) < 1e-6)
+    {
+        m_Az = range360(m_TargetAz);
+        rotatorStop();
+        return;
+    }
+
+    // a full calibration turn gets twice the move timeout
+    const double timeout = m_MaxFullRotSecs * (m_RotatorOp == ROT_CALIBRATE ? 2 : 1);
+    if (m_MoveSecs > timeout)
+    {
+        m_RotatorError = true;
+        rotatorStop();
+    }
+}
+
+void BeaverSimModel::stepShutter(double dt)
+{
+    if (m_ShutterOp == SHUT_IDLE)
+        return;
+
+    const double rate = (m_ShutterMaxSpeed / 800.0) / m_Config.shutterTravelSecs;
+    if (m_ShutterOp == SHUT_OPENING)
+    {
+        m_ShutterPos = std::min(1.0, m_ShutterPos + rate * dt);
+        if (m_ShutterPos >= 1.0)
+            m_ShutterOp = SHUT_IDLE;
+    }
+    else
+    {
+        m_ShutterPos = std::max(0.0, m_ShutterPos - rate * dt);
+        if (m_ShutterPos <= 0.0)
+            m_ShutterOp = SHUT_IDLE;
+    }
+}
+
+void BeaverSimModel::rotatorGoto(double az)
+{
+    m_TargetAz = range360(az);
+    m_Remaining = shortestTravel(m_Az, m_TargetAz);
+    m_Speed = m_MinSpeed / m_Config.stepsPerDegree;
+    m_MoveSecs = 0;
+    m_RotatorError = false;
+    m_RotatorOp = ROT_GOTO;
+}
+
+void BeaverSimModel::rotatorStop()
+{
+    m_RotatorOp = ROT_IDLE;
+    m_Remaining = 0;
+    m_Speed = 0;
+}
+
+void BeaverSimModel::shutterMove(ShutterOp op)
+{
+    m_ShutterError = false;
+    m_ShutterOp = op;
+}
+
+void BeaverSimModel::shutterStop(bool fault)
+{
+    // Stopping mid travel raises a hardware error, as the real controller does
+    if (fault && m_ShutterOp != SHUT_IDLE)
+        m_ShutterError = true;
+    m_ShutterOp = SHUT_IDLE;
+}
+
+bool BeaverSimModel::rotatorNear(double az) const
+{
+    return fabs(shortestTravel(m_Az, az)) < POSITION_TOLERANCE;
+}
+
+double BeaverSimModel::shutterVolts() const
+{
+    return m_BatteryVolts - (m_ShutterOp != SHUT_IDLE ? m_Config.batteryLoadSag : 0);
+}
+
+uint16_t BeaverSimModel::status() const
+{
+    uint16_t status = 0;
+    if (m_RotatorOp != ROT_IDLE)
+        status |= DOME_STATUS_ROTATOR_MOVING;
+    if (m_RotatorError)
+        status |= DOME_STATUS_ROTATOR_ERROR;
+    if (m_UnsafeCW)
+        status |= DOME_STATUS_UNSAFE_CW;
+    if (m_UnsafeRG)
+        status |= DOME_STATUS_UNSAFE_RG;
+    if (m_RotatorOp == ROT_IDLE && rotatorNear(m_HomeAz))
+        status |= DOME_STATUS_ROTATOR_HOME;
+    if (m_RotatorOp == ROT_IDLE && rotatorNear(m_ParkAz))
+        status |= DOME_STATUS_ROTATOR_PARKED;
+
+    if (!m_Config.shutterPresent)
+        return status | DOME_STATUS_SHUTTER_COMM;
+
+    if (m_ShutterError)
+        status |= DOME_STATUS_SHUTTER_ERROR;
+    if (m_ShutterOp == SHUT_OPENING)
+        status |= DOME_STATUS_SHUTTER_MOVING | DOME_STATUS_SHUTTER_OPENING;
+    else if (m_ShutterOp == SHUT_CLOSING)
+        status |= DOME_STATUS_SHUTTER_MOVING | DOME_STATUS_SHUTTER_CLOSING;
+    else if (m_ShutterPos >= 1.0)
+        status |= DOME_STATUS_SHUTTER_OPENED;
+    else if (m_ShutterPos <= 0.0)
+        status |= DOME_STATUS_SHUTTER_CLOSED;
+    return status;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Request handling: "!<group> <verb> [args]#" -> "<request>:<value>#"
+/////////////////////////////////////////////////////////////////////////////
+size_t BeaverSimModel::handle(const char *request, size_t len, char *reply, size_t replySize)
+{
+    char line[128] = {0};
+    len = std::min(len, sizeof(line) - 1);
+    memcpy(line, request, len);
+    char *end = strchr(line, '#');
+    if (end)
+        *end = 0;
+
+    char echo[128];
+    snprintf(echo, sizeof(echo), "%s", line);
+
+    char *save = nullptr;
+    const char *group = strtok_r(line, " ", &save);
+    const char *verb = strtok_r(nullptr, " ", &save);
+    double args[3] = {0, 0, 0};
+    int nargs = 0;
+    bool badArg = false;
+    for (const char *tok = strtok_r(nullptr, " ", &save); tok; tok = strtok_r(nullptr, " ", &save))
+    {
+        char *parsed = nullptr;
+        const double value = strtod(tok, &parsed);
+        if (nargs == 3 || parsed == tok || *parsed)
+        {
+            badArg = true;
+            break;
+        }
+        args[nargs++] = value;
+    }
+
+    double result = 0;
+    int error = 0;
+    bool version = false;
+    if (group == nullptr || verb == nullptr)
+        error = ERROR_UNKNOWN_COMMAND;
+    else if (badArg)
+        error = ERROR_BAD_ARGUMENT;
+    else if (!strcmp(group, "!dome"))
+    {
+        if (!handleDome(verb, args, nargs, result))
+            error = static_cast<int>(result);
+    }
+    else if (!strcmp(group, "!domerot"))
+    {
+        if (!handleDomeRot(verb, args, nargs, result))
+            error = static_cast<int>(result);
+    }
+    else if (!strcmp(group, "!seletek"))
+    {
+        version = !strcmp(verb, "tversion");
+        if (!handleSeletek(verb, result))
+            error = static_cast<int>(result);
+    }
+    else
+        error = ERROR_UNKNOWN_COMMAND;
+
+    int n;
+    if (error)
+        n = snprintf(reply, replySize, "%s:error:%d#", echo, error);
+    else if (version)
+        n = snprintf(reply, replySize, "%s:1:%s#", echo, m_Config.firmwareVersion);
+    else if (result == floor(result))
+        n = snprintf(reply, replySize, "%s:%d#", echo, static_cast<int>(result));
+    else
+        n = snprintf(reply, replySize, "%s:%.2f#", echo, result);
+
+    if (n < 0)
+        return 0;
+    return std::min(static_cast<size_t>(n), replySize - 1);
+}
+
+bool BeaverSimModel::handleDome(const char *verb, const double *args, int nargs, double &result)
+{
+    result = 0;
+
+    ////////////////////////////////////////////
+    // Rotator
+    ////////////////////////////////////////////
+    if (!strcmp(verb, "getaz"))
+        result = m_Az;
+    else if (!strcmp(verb, "status"))
+        result = status();
+    else if (!strcmp(verb, "gotoaz"))
+    {
+        if (nargs != 1 || args[0] < 0 || args[0] > 360)
+        {
+            result = ERROR_BAD_ARGUMENT;
+            return false;
+        }
+        rotatorGoto(args[0]);
+    }
+    else if (!strcmp(verb, "gopark"))
+        rotatorGoto(m_ParkAz);
+    else if (!strcmp(verb, "gohome"))
+        rotatorGoto(m_HomeAz);
+    else if (!strcmp(verb, "autocalrot"))
+    {
+        // 1: measure (full turn, then home), 0: find the home magnet
+        rotatorGoto(m_HomeAz);
+        double travel = range360(m_HomeAz - m_Az);
+        if (nargs == 1 && args[0] == 1)
+            travel += 360.0;
+        m_Remaining = travel;
+        m_RotatorOp = ROT_CALIBRATE;
+    }
+    else if (!strcmp(verb, "athome"))
+        result = (m_RotatorOp == ROT_IDLE && rotatorNear(m_HomeAz)) ? 1 : 0;
+    else if (!strcmp(verb, "atpark"))
+        result = (m_RotatorOp == ROT_IDLE && rotatorNear(m_ParkAz)) ? 1 : 0;
+    else if (!strcmp(verb, "abort"))
+    {
+        // abort <rotator> <shutter open/close> <shutter>
+        if (nargs == 0 || args[0] != 0)
+            rotatorStop();
+        if (nargs > 1 && (args[1] != 0 || (nargs > 2 && args[2] != 0)))
+            shutterStop(true);
+    }
+    else if (!strcmp(verb, "shutterisup"))
+        result = m_Config.shutterPresent ? 1 : 0;
+
+    ////////////////////////////////////////////
+    // Shutter
+    ////////////////////////////////////////////
+    else if (!strncmp(verb, "shutter", 7) || !strncmp(verb, "getshutter", 10) || !strncmp(verb, "setshutter", 10)
+             || !strcmp(verb, "openshutter") || !strcmp(verb, "closeshutter") || !strcmp(verb, "autocalshutter"))
+    {
+        if (!m_Config.shutterPresent)
+        {
+            result = ERROR_NO_SHUTTER;
+            return false;
+        }
+
+        if (!strcmp(verb, "openshutter"))
+        {
+            if (shutterVolts() < m_ShutterSafeVolts)
+            {
+                result = ERROR_BUSY;
+                return false;
+            }
+            shutterMove(SHUT_OPENING);
+        }
+        else if (!strcmp(verb, "closeshutter") || !strcmp(verb, "autocalshutter"))
+            shutterMove(SHUT_CLOSING);
+        else if (!strcmp(verb, "getshutterbatvoltage"))
+            result = shutterVolts();
+        else if (!strcmp(verb, "getshuttermaxspeed"))
+            result = m_ShutterMaxSpeed;
+        else if (!strcmp(verb, "getshutterminspeed"))
+            result = m_ShutterMinSpeed;
+        else if (!strcmp(verb, "getshutteracceleration"))
+            result = m_ShutterAcceleration;
+        else if (!strcmp(verb, "getshuttersafevoltage"))
+            result = m_ShutterSafeVolts;
+        else if (!strcmp(verb, "getshuttertimeoutopenclose"))
+            result = round(m_Config.shutterTravelSecs * 800.0 / m_ShutterMaxSpeed * 2);
+        else if (nargs == 1 && !strcmp(verb, "setshuttermaxspeed"))
+            m_ShutterMaxSpeed = args[0];
+        else if (nargs == 1 && !strcmp(verb, "setshutterminspeed"))
+            m_ShutterMinSpeed = args[0];
+        else if (nargs == 1 && !strcmp(verb, "setshutteracceleration"))
+            m_ShutterAcceleration = args[0];
+        else if (nargs == 1 && !strcmp(verb, "setshuttersafevoltage"))
+            m_ShutterSafeVolts = args[0];
+        else
+        {
+            result = ERROR_UNKNOWN_COMMAND;
+            return false;
+        }
+    }
+    else
+    {
+        result = ERROR_UNKNOWN_COMMAND;
+        return false;
+    }
+
+    return true;
+}
+
+bool BeaverSimModel::handleDomeRot(const char *verb, const double *args, int nargs, double &result)
+{
+    result = 0;
+
+    if (!strncmp(verb, "set", 3))
+    {
+        if (nargs != 1 || args[0] < 0)
+        {
+            result = ERROR_BAD_ARGUMENT;
+            return false;
+        }
+        if (!strcmp(verb, "setpark"))
+            m_ParkAz = range360(args[0]);
+        else if (!strcmp(verb, "sethome"))
+            m_HomeAz = range360(args[0]);
+        else if (!strcmp(verb, "setmaxspeed"))
+            m_MaxSpeed = args[0];
+        else if (!strcmp(verb, "setminspeed"))
+            m_MinSpeed = args[0];
+        else if (!strcmp(verb, "setacceleration"))
+            m_Acceleration = args[0];
+        else if (!strcmp(verb, "setmaxfullrotsecs"))
+            m_MaxFullRotSecs = args[0];
+        else
+        {
+            result = ERROR_UNKNOWN_COMMAND;
+            return false;
+        }
+        return true;
+    }
+
+    if (!strcmp(verb, "getpark"))
+        result = m_ParkAz;
+    else if (!strcmp(verb, "gethome"))
+        result = m_HomeAz;
+    else if (!strcmp(verb, "getmaxspeed"))
+        result = m_MaxSpeed;
+    else if (!strcmp(verb, "getminspeed"))
+        result = m_MinSpeed;
+    else if (!strcmp(verb, "getacceleration"))
+        result = m_Acceleration;
+    else if (!strcmp(verb, "getmaxfullrotsecs"))
+        result = m_MaxFullRotSecs;
+    else
+    {
+        result = ERROR_UNKNOWN_COMMAND;
+        return false;
+    }
+    return true;
+}
+
+bool BeaverSimModel::handleSeletek(const char *verb, double &result)
+{
+    result = 0;
+    if (!strcmp(verb, "tversion") || !strcmp(verb, "savefs"))
+        return true;
+
+    result = ERROR_UNKNOWN_COMMAND;
+    return false;
+}
@@ -0,0 +1,148 @@
+/*
+    NexDome Beaver Controller - Firmware Simulator Model
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Physical parameters of the simulated dome
+struct BeaverSimConfig
+{
+    // Rotator speeds and acceleration are in motor steps
+    double stepsPerDegree {133.3};
+    // Shutter travel time at the default max speed of 800
+    double shutterTravelSecs {25};
+    bool shutterPresent {true};
+    // Battery
+    double batteryRestVolts {12.9};
+    double batteryLoadSag {0.8};
+    double batteryDrainPerMovingSec {0.0005};
+    double batteryChargePerSec {0.00005};
+    const char *firmwareVersion {"1.1.1"};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Models a Beaver controller with rotator and shutter units. Physics advance
+/// with step(), requests are answered with handle(). No I/O happens here so
+/// the model can be driven from beaver_sim or linked into benchmarks.
+///////////////////////////////////////////////////////////////////////////////
+class BeaverSimModel
+{
+    public:
+        // Mirrors Beaver::DOME_STATUS_*
+        enum
+        {
+            DOME_STATUS_ROTATOR_MOVING = 0x0001,
+            DOME_STATUS_SHUTTER_MOVING = 0x0002,
+            DOME_STATUS_ROTATOR_ERROR = 0x0004,
+            DOME_STATUS_SHUTTER_ERROR = 0x0008,
+            DOME_STATUS_SHUTTER_COMM = 0x0010,
+            DOME_STATUS_UNSAFE_CW = 0x0020,
+            DOME_STATUS_UNSAFE_RG = 0x0040,
+            DOME_STATUS_SHUTTER_OPENED = 0x0080,
+            DOME_STATUS_SHUTTER_CLOSED = 0x0100,
+            DOME_STATUS_SHUTTER_OPENING = 0x0200,
+            DOME_STATUS_SHUTTER_CLOSING = 0x0400,
+            DOME_STATUS_ROTATOR_HOME = 0x0800,
+            DOME_STATUS_ROTATOR_PARKED = 0x1000
+        };
+
+        explicit BeaverSimModel(const BeaverSimConfig &config = BeaverSimConfig());
+
+        // Advance rotator, shutter and battery by dt seconds
+        void step(double dt);
+
+        // Answer one request (stop char optional). Returns the reply length including '#'.
+        size_t handle(const char *request, size_t len, char *reply, size_t replySize);
+
+        uint16_t status() const;
+        double az() const
+        {
+            return m_Az;
+        }
+        double shutterPosition() const
+        {
+            return m_ShutterPos;
+        }
+        double shutterVolts() const;
+
+        void setUnsafe(bool cw, bool rg)
+        {
+            m_UnsafeCW = cw;
+            m_UnsafeRG = rg;
+        }
+
+    private:
+        enum RotatorOp
+        {
+            ROT_IDLE,
+            ROT_GOTO,
+            // autocalrot: a full turn, then on to home
+            ROT_CALIBRATE
+        };
+        enum ShutterOp
+        {
+            SHUT_IDLE,
+            SHUT_OPENING,
+            SHUT_CLOSING
+        };
+
+        bool handleDome(const char *verb, const double *args, int nargs, double &result);
+        bool handleDomeRot(const char *verb, const double *args, int nargs, double &result);
+        bool handleSeletek(const char *verb, double &result);
+
+        void rotatorGoto(double az);
+        void rotatorStop();
+        void stepRotator(double dt);
+        void shutterMove(ShutterOp op);
+        void shutterStop(bool fault);
+        void stepShutter(double dt);
+        bool rotatorNear(double az) const;
+
+        BeaverSimConfig m_Config;
+
+        // Rotator
+        double m_Az {0};
+        double m_TargetAz {0};
+        // signed remaining travel and current speed (deg, deg/s)
+        double m_Remaining {0};
+        double m_Speed {0};
+        double m_MoveSecs {0};
+        RotatorOp m_RotatorOp {ROT_IDLE};
+        bool m_RotatorError {false};
+        bool m_UnsafeCW {false};
+        bool m_UnsafeRG {false};
+        double m_HomeAz {0};
+        double m_ParkAz {0};
+        double m_MaxSpeed {800};
+        double m_MinSpeed {400};
+        double m_Acceleration {500};
+        double m_MaxFullRotSecs {83};
+
+        // Shutter (0 closed, 1 open)
+        double m_ShutterPos {0};
+        ShutterOp m_ShutterOp {SHUT_IDLE};
+        bool m_ShutterError {false};
+        double m_ShutterMaxSpeed {800};
+        double m_ShutterMinSpeed {400};
+        double m_ShutterAcceleration {500};
+        double m_ShutterSafeVolts {11};
+        double m_BatteryVolts {12.9};
+};
@@ -0,0 +1,205 @@
+/*
+    NexDome Beaver Controller - Slaving Geometry
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_slaving.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+constexpr const int SlavingTable::HA_STEP_DEG;
+constexpr const int SlavingTable::DEC_STEP_DEG;
+constexpr const int SlavingTable::HA_CELLS;
+constexpr const int SlavingTable::DEC_CELLS;
+
+namespace
+{
+
+const double DEG = M_PI / 180;
+
+double range360(double az)
+{
+    az = fmod(az, 360);
+    return az < 0 ? az + 360 : az;
+}
+
+// Half the angle the slit spans at the altitude, 180 when it spans everything
+double halfSlitAngle(double radius, double shutterWidth, double alt)
+{
+    const double radiusAtAlt = radius * cos(alt * DEG);
+    if (shutterWidth < 2 * radiusAtAlt)
+        return asin(shutterWidth / (2 * radiusAtAlt)) / DEG;
+    return 180;
+}
+
+double altitude(const double point[3])
+{
+    return atan2(point[2], sqrt(point[0] * point[0] + point[1] * point[1])) / DEG;
+}
+
+void fillTarget(double x, double y, double z, double halfSlit, SlavingTarget &target)
+{
+    target.az = range360(atan2(x, y) / DEG);
+    const double point[3] = {x, y, z};
+    target.alt = altitude(point);
+    if (halfSlit >= 180)
+    {
+        target.minAz = 0;
+        target.maxAz = 360;
+        return;
+    }
+    target.minAz = range360(target.az - halfSlit);
+    target.maxAz = range360(target.az + halfSlit);
+}
+
+// Where the optical axis leaves the dome, in meters from the dome center
+bool intersection(const DomeGeometry &geometry, double haHours, double decDeg, int side, double point[3])
+{
+    const double ha = haHours * 15 * DEG;
+    const double dec = decDeg * DEG;
+    const double lat = geometry.latitude * DEG;
+
+    // optical center: the OTA offset turned with the RA axis, which points at the pole
+    const double q = (90 - geometry.latitude) * DEG;
+    const double f = -(M_PI + ha);
+    const double offset = side * geometry.otaOffset;
+    const double center[3] = {offset * cos(f) + geometry.east,
+                              offset * sin(f) * cos(q) + geometry.north,
+                              offset * sin(f) * sin(q) + geometry.up
+                             };
+
+    // optical axis, from the horizontal coordinates of the pointing
+    const double sinAlt = sin(lat) * sin(dec) + cos(lat) * cos(dec) * cos(ha);
+    const double alt = asin(std::max(-1.0, std::min(1.0, sinAlt)));
+    const double az = atan2(-cos(dec) * sin(ha), sin(dec) * cos(lat) - cos(dec) * sin(lat) * cos(ha));
+    const double axis[3] = {cos(alt) * sin(az), cos(alt) * cos(az), sin(alt)};
+
+    // center + mu * axis on the sphere, the axis being a unit vector
+    const double b = 2 * (axis[0] * center[0] + axis[1] * center[1] + axis[2] * center[2]);
+    const double c = center[0] * center[0] + center[1] * center[1] + center[2] * center[2] -
+                     geometry.radius * geometry.radius;
+    const double discriminant = b * b - 4 * c;
+    if (discriminant < 0 || geometry.radius <= 0)
+        return false;
+    double mu = (-b + sqrt(discriminant)) / 2;
+    if (mu < 0)
+        mu = (-b - sqrt(discriminant)) / 2;
+
+    for (int i = 0; i < 3; i++)
+        point[i] = center[i] + mu * axis[i];
+    return true;
+}
+
+int sideIndex(int side)
+{
+    return side < 0 ? 0 : (side > 0 ? 2 : 1);
+}
+
+}
+
+bool DomeGeometry::operator==(const DomeGeometry &other) const
+{
+    return radius == other.radius && shutterWidth == other.shutterWidth && north == other.north && east == other.east &&
+           up == other.up && otaOffset == other.otaOffset && latitude == other.latitude;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Direct calculation
+/////////////////////////////////////////////////////////////////////////////
+bool BeaverSlaving::directTarget(const DomeGeometry &geometry, double haHours, double decDeg, int side,
+                                 SlavingTarget &target)
+{
+    double point[3];
+    if (!intersection(geometry, haHours, decDeg, side, point))
+        return false;
+    fillTarget(point[0], point[1], point[2], halfSlitAngle(geometry.radius, geometry.shutterWidth, altitude(point)), target);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Lookup table
+/////////////////////////////////////////////////////////////////////////////
+void SlavingTable::configure(const DomeGeometry &geometry)
+{
+    if (geometry == m_Geometry)
+        return;
+    m_Geometry = geometry;
+    for (std::vector<Cell> &table : m_Tables)
+        table.clear();
+}
+
+void SlavingTable::build(int side)
+{
+    std::vector<Cell> &table = m_Tables[sideIndex(side)];
+    table.resize(static_cast<size_t>(HA_CELLS) * DEC_CELLS);
+    const float invalid = std::numeric_limits<float>::quiet_NaN();
+    for (int row = 0; row < DEC_CELLS; row++)
+    {
+        const double dec = -90 + row * DEC_STEP_DEG;
+        for (int col = 0; col < HA_CELLS; col++)
+        {
+            Cell &cell = table[static_cast<size_t>(row) * HA_CELLS + col];
+            double point[3];
+            if (!intersection(m_Geometry, (-180 + col * HA_STEP_DEG) / 15.0, dec, side, point))
+            {
+                std::fill(cell.v, cell.v + 4, invalid);
+                continue;
+            }
+            for (int i = 0; i < 3; i++)
+                cell.v[i] = static_cast<float>(point[i] / m_Geometry.radius);
+            cell.v[3] = 0;
+        }
+    }
+    m_Builds++;
+}
+
+bool SlavingTable::lookup(double haHours, double decDeg, int side, SlavingTarget &target)
+{
+    if (!std::isfinite(haHours) || !std::isfinite(decDeg))
+        return false;
+    std::vector<Cell> &table = m_Tables[sideIndex(side)];
+    if (table.empty())
+        build(side);
+
+    // hour angle wraps around, declination stops at the poles
+    const double u = range360(haHours * 15 + 180) / HA_STEP_DEG;
+    const double v = (std::max(-90.0, std::min(90.0, decDeg)) + 90) / DEC_STEP_DEG;
+    const int col = std::min(static_cast<int>(u), HA_CELLS - 1);
+    const int row = std::min(static_cast<int>(v), DEC_CELLS - 2);
+    const float fu = static_cast<float>(u - col);
+    const float fv = static_cast<float>(v - row);
+    const int nextCol = (col + 1) % HA_CELLS;
+
+    const Cell &c00 = table[static_cast<size_t>(row) * HA_CELLS + col];
+    const Cell &c10 = table[static_cast<size_t>(row) * HA_CELLS + nextCol];
+    const Cell &c01 = table[static_cast<size_t>(row + 1) * HA_CELLS + col];
+    const Cell &c11 = table[static_cast<size_t>(row + 1) * HA_CELLS + nextCol];
+    const float w00 = (1 - fu) * (1 - fv), w10 = fu * (1 - fv), w01 = (1 - fu) * fv, w11 = fu * fv;
+    float blend[4];
+    for (int i = 0; i < 4; i++)
+        blend[i] = w00 * c00.v[i] + w10 * c10.v[i] + w01 * c01.v[i] + w11 * c11.v[i];
+
+    // the axis misses the dome somewhere around here
+    if (std::isnan(blend[3]))
+        return BeaverSlaving::directTarget(m_Geometry, haHours, decDeg, side, target);
+    const double point[3] = {blend[0], blend[1], blend[2]};
+    fillTarget(blend[0], blend[1], blend[2], halfSlitAngle(1, m_Geometry.shutterWidth / m_Geometry.radius, altitude(point)),
+               target);
+    return true;
+}
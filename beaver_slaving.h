@@ -0,0 +1,110 @@
+/*
+    NexDome Beaver Controller - Slaving Geometry
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+/// The dome and mount as set on INDI::Dome's Slaving tab, in meters, plus the
+/// site latitude in degrees
+///////////////////////////////////////////////////////////////////////////////
+struct DomeGeometry
+{
+    double radius {0};
+    double shutterWidth {0};
+    double north {0};
+    double east {0};
+    double up {0};
+    double otaOffset {0};
+    double latitude {0};
+
+    bool operator==(const DomeGeometry &other) const;
+    bool operator!=(const DomeGeometry &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+// Where the dome has to be for the telescope to see out of the slit
+struct SlavingTarget
+{
+    double az {0};
+    double alt {0};
+    // the slit clears the optical axis between these; 0 and 360 when it always does
+    double minAz {0};
+    double maxAz {360};
+};
+
+namespace BeaverSlaving
+{
+// The calculation of INDI::Dome::GetTargetAz, from the hour angle in hours.
+// side is the OTA side: -1 east, 1 west, 0 on the axis. False if the optical
+// axis does not meet the dome, i.e. the mount is set outside it.
+bool directTarget(const DomeGeometry &geometry, double haHours, double decDeg, int side, SlavingTarget &target);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Precomputed directTarget() over hour angle and declination, one table per
+/// OTA side, built on first use after the geometry changed. A lookup blends
+/// the four surrounding cells instead of redoing the trigonometry. The cells
+/// hold the point where the optical axis meets the dome, which varies
+/// smoothly even where the azimuth does not (near the zenith); azimuth and
+/// slit clearance follow from the blended point. Cells are 16 bytes, blended
+/// as one four float vector.
+///////////////////////////////////////////////////////////////////////////////
+class SlavingTable
+{
+    public:
+        // Cheap when nothing changed
+        void configure(const DomeGeometry &geometry);
+        // Falls back to directTarget() where a cell is not usable
+        bool lookup(double haHours, double decDeg, int side, SlavingTarget &target);
+
+        // Tables built so far, for diagnostics
+        uint64_t builds() const
+        {
+            return m_Builds;
+        }
+
+        // 2 degrees both ways keeps the interpolation error under a hundredth
+        // of a degree of arc on the dome, far below any autosync threshold,
+        // in 256 KB per side
+        static constexpr const int HA_STEP_DEG {2};
+        static constexpr const int DEC_STEP_DEG {2};
+        static constexpr const int HA_CELLS {360 / HA_STEP_DEG};
+        static constexpr const int DEC_CELLS {180 / DEC_STEP_DEG + 1};
+
+    private:
+        struct alignas(16) Cell
+        {
+            // intersection x (east), y (north), z (up) over the radius, then 0;
+            // all NaN where the axis misses the dome
+            float v[4];
+        };
+
+        void build(int side);
+
+        DomeGeometry m_Geometry;
+        // east, on the axis, west
+        std::vector<Cell> m_Tables[3];
+        uint64_t m_Builds {0};
+};
@@ -0,0 +1,167 @@
+/*
+    NexDome Beaver Controller - Rotator and Shutter State Tables
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_state.h"
+
+namespace BeaverState
+{
+
+namespace
+{
+
+struct Description
+{
+    const char *text;
+    IPState state;
+};
+
+const Description ROTATOR_DESCRIPTIONS[ROTATOR_OP_COUNT] =
+{
+    {"Idle", IPS_OK},
+    {"Moving", IPS_BUSY},
+    {"Homing", IPS_BUSY},
+    {"Finding Home", IPS_BUSY},
+    {"Measuring Home", IPS_BUSY},
+    {"Parking", IPS_BUSY},
+    {"Parked", IPS_OK},
+    {"Dome UnParked", IPS_OK},
+    {"Home", IPS_OK},
+    {"Unsafe", IPS_ALERT}
+};
+
+const char * const SHUTTER_TEXT[SHUTTER_ACT_COUNT] =
+{
+    "Idle", "Opening", "Closing", "Moving", "Open", "Closed", "Mechanical Error"
+};
+
+/////////////////////////////////////////////////////////////////////////////
+/// Rotator rules
+/////////////////////////////////////////////////////////////////////////////
+RotatorTransition rotatorRule(RotatorOperation op, unsigned events)
+{
+    // the safety inputs override everything
+    if (events & ROTATOR_EVENT_UNSAFE)
+        return {ROTATOR_OP_UNSAFE, op == ROTATOR_OP_UNSAFE ? ROTATOR_ACTION_NONE : ROTATOR_ACTION_DOME_ERROR};
+
+    if (events & ROTATOR_EVENT_MOVING)
+    {
+        switch (op)
+        {
+            // moved by someone else, e.g. the hand paddle
+            case ROTATOR_OP_IDLE:
+            case ROTATOR_OP_PARKED:
+            case ROTATOR_OP_UNPARKED:
+            case ROTATOR_OP_HOME:
+            case ROTATOR_OP_UNSAFE:
+                return {ROTATOR_OP_MOVING, ROTATOR_ACTION_NONE};
+            default:
+                return {op, ROTATOR_ACTION_NONE};
+        }
+    }
+
+    // stopped: whatever was running has completed
+    switch (op)
+    {
+        case ROTATOR_OP_MOVING:
+            return {ROTATOR_OP_IDLE, ROTATOR_ACTION_DOME_IDLE | ROTATOR_ACTION_CALIBRATION_OK};
+        case ROTATOR_OP_HOMING:
+            return {ROTATOR_OP_HOME, ROTATOR_ACTION_DOME_IDLE | ROTATOR_ACTION_GOTO_HOME_OK};
+        case ROTATOR_OP_FINDING_HOME:
+        case ROTATOR_OP_MEASURING_HOME:
+            return {ROTATOR_OP_HOME, ROTATOR_ACTION_DOME_IDLE | ROTATOR_ACTION_CALIBRATION_OK};
+        case ROTATOR_OP_PARKING:
+            if (events & ROTATOR_EVENT_PARKED)
+                return {ROTATOR_OP_PARKED, ROTATOR_ACTION_SET_PARKED};
+            return {ROTATOR_OP_PARKING, ROTATOR_ACTION_CHECK_PARK};
+        case ROTATOR_OP_UNSAFE:
+            return {ROTATOR_OP_IDLE, ROTATOR_ACTION_DOME_IDLE};
+        default:
+            return {op, ROTATOR_ACTION_NONE};
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Shutter rules, end positions win over the motion bits
+/////////////////////////////////////////////////////////////////////////////
+ShutterActivity shutterRule(ShutterActivity activity, unsigned events)
+{
+    if (events & SHUTTER_EVENT_ERROR)
+        return SHUTTER_ACT_ERROR;
+    if (events & SHUTTER_EVENT_OPENED)
+        return SHUTTER_ACT_OPEN;
+    if (events & SHUTTER_EVENT_CLOSED)
+        return SHUTTER_ACT_CLOSED;
+    if (events & SHUTTER_EVENT_OPENING)
+        return SHUTTER_ACT_OPENING;
+    if (events & SHUTTER_EVENT_CLOSING)
+        return SHUTTER_ACT_CLOSING;
+    if (events & SHUTTER_EVENT_MOVING)
+        return SHUTTER_ACT_MOVING;
+    return activity;
+}
+
+struct Tables
+{
+    RotatorTransition rotator[ROTATOR_OP_COUNT][ROTATOR_EVENTS];
+    ShutterActivity shutter[SHUTTER_ACT_COUNT][SHUTTER_EVENTS];
+
+    Tables()
+    {
+        for (int op = 0; op < ROTATOR_OP_COUNT; op++)
+            for (unsigned events = 0; events < ROTATOR_EVENTS; events++)
+                rotator[op][events] = rotatorRule(static_cast<RotatorOperation>(op), events);
+        for (int activity = 0; activity < SHUTTER_ACT_COUNT; activity++)
+            for (unsigned events = 0; events < SHUTTER_EVENTS; events++)
+                shutter[activity][events] = shutterRule(static_cast<ShutterActivity>(activity), events);
+    }
+};
+
+const Tables TABLES;
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+const RotatorTransition &rotatorTransition(RotatorOperation op, unsigned events)
+{
+    return TABLES.rotator[op][events & (ROTATOR_EVENTS - 1)];
+}
+
+ShutterActivity shutterTransition(ShutterActivity activity, unsigned events)
+{
+    return TABLES.shutter[activity][events & (SHUTTER_EVENTS - 1)];
+}
+
+const char *rotatorText(RotatorOperation op)
+{
+    return ROTATOR_DESCRIPTIONS[op].text;
+}
+
+IPState rotatorState(RotatorOperation op)
+{
+    return ROTATOR_DESCRIPTIONS[op].state;
+}
+
+const char *shutterText(ShutterActivity activity)
+{
+    return SHUTTER_TEXT[activity];
+}
+
+}
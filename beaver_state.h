@@ -0,0 +1,107 @@
+/*
+    NexDome Beaver Controller - Rotator and Shutter State Tables
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <indiapi.h>
+
+///////////////////////////////////////////////////////////////////////////////
+/// What the rotator and shutter are doing, and what each status word moves
+/// them to. The tables are built once from the rules in beaver_state.cpp and
+/// indexed by the current operation and the event bits of the status word.
+///////////////////////////////////////////////////////////////////////////////
+namespace BeaverState
+{
+
+enum RotatorOperation
+{
+    ROTATOR_OP_IDLE,
+    ROTATOR_OP_MOVING,
+    ROTATOR_OP_HOMING,
+    ROTATOR_OP_FINDING_HOME,
+    ROTATOR_OP_MEASURING_HOME,
+    ROTATOR_OP_PARKING,
+    ROTATOR_OP_PARKED,
+    ROTATOR_OP_UNPARKED,
+    ROTATOR_OP_HOME,
+    ROTATOR_OP_UNSAFE,
+    ROTATOR_OP_COUNT
+};
+
+// Rotator bits of the status word
+enum RotatorEvent
+{
+    ROTATOR_EVENT_MOVING = 0x1,
+    ROTATOR_EVENT_UNSAFE = 0x2,
+    ROTATOR_EVENT_PARKED = 0x4,
+    ROTATOR_EVENT_HOME = 0x8,
+    ROTATOR_EVENTS = 0x10
+};
+
+// Side effects of a rotator transition, besides the new status text
+enum RotatorAction
+{
+    ROTATOR_ACTION_NONE = 0,
+    ROTATOR_ACTION_DOME_IDLE = 0x1,
+    ROTATOR_ACTION_DOME_ERROR = 0x2,
+    ROTATOR_ACTION_CALIBRATION_OK = 0x4,
+    ROTATOR_ACTION_GOTO_HOME_OK = 0x8,
+    ROTATOR_ACTION_SET_PARKED = 0x10,
+    // stopped while parking without the parked bit: ask the controller
+    ROTATOR_ACTION_CHECK_PARK = 0x20
+};
+
+struct RotatorTransition
+{
+    RotatorOperation next;
+    unsigned actions;
+};
+
+enum ShutterActivity
+{
+    SHUTTER_ACT_IDLE,
+    SHUTTER_ACT_OPENING,
+    SHUTTER_ACT_CLOSING,
+    SHUTTER_ACT_MOVING,
+    SHUTTER_ACT_OPEN,
+    SHUTTER_ACT_CLOSED,
+    SHUTTER_ACT_ERROR,
+    SHUTTER_ACT_COUNT
+};
+
+// Shutter bits of the status word
+enum ShutterEvent
+{
+    SHUTTER_EVENT_ERROR = 0x1,
+    SHUTTER_EVENT_MOVING = 0x2,
+    SHUTTER_EVENT_OPENING = 0x4,
+    SHUTTER_EVENT_CLOSING = 0x8,
+    SHUTTER_EVENT_OPENED = 0x10,
+    SHUTTER_EVENT_CLOSED = 0x20,
+    SHUTTER_EVENTS = 0x40
+};
+
+const RotatorTransition &rotatorTransition(RotatorOperation op, unsigned events);
+ShutterActivity shutterTransition(ShutterActivity activity, unsigned events);
+
+const char *rotatorText(RotatorOperation op);
+IPState rotatorState(RotatorOperation op);
+const char *shutterText(ShutterActivity activity);
+
+}
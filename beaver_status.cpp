@@ -0,0 +1,130 @@
+/*
+    NexDome Beaver Controller - Shared Memory Status Reader
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_shm.h"
+#include "beaver_state.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <unistd.h>
+
+namespace
+{
+
+void printNumber(double value, bool valid)
+{
+    if (valid && !std::isnan(value))
+        printf(",%.3f", value);
+    else
+        printf(",");
+}
+
+// Same columns as beaver_telemetry_csv, plus the poll count and the time to target
+void printStatus(const BeaverShmStatus &status)
+{
+    const time_t secs = static_cast<time_t>(status.timeUS / 1000000);
+    struct tm utc;
+    gmtime_r(&secs, &utc);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+    printf("%s.%03dZ", stamp, static_cast<int>((status.timeUS / 1000) % 1000));
+
+    printf(",%llu", static_cast<unsigned long long>(status.tick));
+    printf(",%d", (status.flags & BeaverShmStatus::CONNECTED) ? 1 : 0);
+    printNumber(status.az, status.flags & BeaverShmStatus::AZ_VALID);
+    printNumber(status.targetAz, true);
+    printNumber(status.etaS, true);
+    if (status.flags & BeaverShmStatus::STATUS_VALID)
+        printf(",0x%04x", status.status);
+    else
+        printf(",");
+    printf(",%s", status.rotatorOp < BeaverState::ROTATOR_OP_COUNT ?
+           BeaverState::rotatorText(static_cast<BeaverState::RotatorOperation>(status.rotatorOp)) : "");
+    printf(",%d", (status.flags & BeaverShmStatus::SHUTTER_ONLINE) ? 1 : 0);
+    printf(",%s", status.shutterActivity < BeaverState::SHUTTER_ACT_COUNT ?
+           BeaverState::shutterText(static_cast<BeaverState::ShutterActivity>(status.shutterActivity)) : "");
+    printNumber(status.shutterVolts, status.flags & BeaverShmStatus::VOLTS_VALID);
+    printf("\n");
+    fflush(stdout);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = "Beaver Dome";
+    bool follow = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:f")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                device = optarg;
+                break;
+            case 'f':
+                follow = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d device] [-f]\n", argv[0]);
+                fprintf(stderr, "  -d  INDI device name, default \"Beaver Dome\"\n");
+                fprintf(stderr, "  -f  print every update until the driver disconnects\n");
+                return 1;
+        }
+    }
+
+    BeaverShmReader reader;
+    if (!reader.open(device))
+    {
+        fprintf(stderr, "%s: no shared memory status %s, is the driver connected?\n", device,
+                BeaverShm::segmentName(device).c_str());
+        return 1;
+    }
+
+    printf("time,tick,connected,az,target_az,eta,status,rotator,shutter_online,shutter,shutter_volts\n");
+    BeaverShmStatus status;
+    uint64_t last = 0;
+    do
+    {
+        const uint64_t sequence = reader.sequence();
+        if (sequence == last)
+        {
+            usleep(10000);
+            continue;
+        }
+        last = sequence;
+        if (!reader.read(status))
+        {
+            if (!follow)
+            {
+                fprintf(stderr, "%s: status kept changing while read\n", device);
+                return 1;
+            }
+            continue;
+        }
+        printStatus(status);
+        if (!(status.flags & BeaverShmStatus::CONNECTED))
+            break;
+    }
+    while (follow);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+    NexDome Beaver Controller - Telemetry Recorder
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_telemetry.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+constexpr const uint64_t TelemetryWriter::FILE_RECORDS;
+constexpr const size_t TelemetryWriter::FILE_SIZE;
+constexpr const size_t TelemetryWriter::RING_SIZE;
+constexpr const uint32_t TelemetryWriter::FLUSH_INTERVAL_MS;
+
+
+TelemetryWriter::~TelemetryWriter()
+{
+    stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool TelemetryWriter::start(const std::string &path)
+{
+    if (m_Running)
+        return true;
+
+    m_Path = path;
+    m_Head = 0;
+    m_Tail = 0;
+    m_Dropped = 0;
+    rotateFiles();
+    if (!openFile())
+        return false;
+
+    m_Running = true;
+    m_Thread = std::thread(&TelemetryWriter::writerThread, this);
+    return true;
+}
+
+void TelemetryWriter::stop()
+{
+    if (!m_Running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_WakeLock);
+        m_Running = false;
+    }
+    m_Wake.notify_all();
+    if (m_Thread.joinable())
+        m_Thread.join();
+    flushRing();
+    closeFile();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Hot path
+/////////////////////////////////////////////////////////////////////////////
+void TelemetryWriter::record(const TelemetryRecord &record)
+{
+    if (!m_Running)
+        return;
+
+    const size_t head = m_Head.load(std::memory_order_relaxed);
+    if (head - m_Tail.load(std::memory_order_acquire) >= RING_SIZE)
+    {
+        m_Dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_Ring[head & (RING_SIZE - 1)] = record;
+    m_Head.store(head + 1, std::memory_order_release);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Writer thread
+/////////////////////////////////////////////////////////////////////////////
+void TelemetryWriter::writerThread()
+{
+    std::unique_lock<std::mutex> lock(m_WakeLock);
+    while (m_Running)
+    {
+        m_Wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this]()
+        {
+            return !m_Running;
+        });
+        if (!m_Running)
+            break;
+        lock.unlock();
+        flushRing();
+        lock.lock();
+    }
+}
+
+void TelemetryWriter::flushRing()
+{
+    size_t tail = m_Tail.load(std::memory_order_relaxed);
+    const size_t head = m_Head.load(std::memory_order_acquire);
+    for (; tail != head; tail++)
+    {
+        if (m_Header == nullptr)
+            break;
+
+        m_Records[m_Header->records] = m_Ring[tail & (RING_SIZE - 1)];
+        m_Header->records++;
+        if (m_Header->records == m_Header->capacity)
+        {
+            closeFile();
+            rotateFiles();
+            openFile();
+        }
+    }
+    // a record that found no file is lost rather than blocking the producer
+    m_Tail.store(head, std::memory_order_release);
+    if (m_Header != nullptr)
+        m_Header->dropped = m_Dropped.load(std::memory_order_relaxed);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Files
+/////////////////////////////////////////////////////////////////////////////
+bool TelemetryWriter::openFile()
+{
+    m_FD = open(m_Path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_FD < 0)
+        return false;
+    if (ftruncate(m_FD, static_cast<off_t>(FILE_SIZE)) != 0)
+    {
+        close(m_FD);
+        m_FD = -1;
+        return false;
+    }
+
+    void *map = mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_FD, 0);
+    if (map == MAP_FAILED)
+    {
+        close(m_FD);
+        m_FD = -1;
+        return false;
+    }
+
+    m_Header = static_cast<TelemetryHeader *>(map);
+    m_Records = reinterpret_cast<TelemetryRecord *>(static_cast<char *>(map) + sizeof(TelemetryHeader));
+    memset(m_Header, 0, sizeof(TelemetryHeader));
+    memcpy(m_Header->magic, BeaverTelemetry::MAGIC, sizeof(m_Header->magic));
+    m_Header->version = BeaverTelemetry::VERSION;
+    m_Header->recordSize = sizeof(TelemetryRecord);
+    m_Header->capacity = FILE_RECORDS;
+    return true;
+}
+
+void TelemetryWriter::closeFile()
+{
+    if (m_Header != nullptr)
+    {
+        // cut the file back to the records written
+        const size_t used = sizeof(TelemetryHeader) + m_Header->records * sizeof(TelemetryRecord);
+        msync(m_Header, FILE_SIZE, MS_SYNC);
+        munmap(m_Header, FILE_SIZE);
+        m_Header = nullptr;
+        m_Records = nullptr;
+        // if this fails the file keeps its full size, which still reads fine
+        const int rc = ftruncate(m_FD, static_cast<off_t>(used));
+        (void)rc;
+    }
+    if (m_FD >= 0)
+    {
+        close(m_FD);
+        m_FD = -1;
+    }
+}
+
+// <path> -> <path>.1 -> <path>.2 ..., the oldest falls off
+void TelemetryWriter::rotateFiles()
+{
+    for (int i = KEEP_FILES - 1; i >= 1; i--)
+        rename((m_Path + "." + std::to_string(i)).c_str(), (m_Path + "." + std::to_string(i + 1)).c_str());
+    rename(m_Path.c_str(), (m_Path + ".1").c_str());
+}
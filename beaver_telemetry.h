@@ -0,0 +1,138 @@
+/*
+    NexDome Beaver Controller - Telemetry Recorder
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+///////////////////////////////////////////////////////////////////////////////
+/// On-disk layout: one header, then capacity fixed size records of which the
+/// first `records` are valid. Native byte order, read back on the same host.
+///////////////////////////////////////////////////////////////////////////////
+struct TelemetryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+    uint64_t records;
+    // lost because the writer thread fell behind
+    uint64_t dropped;
+    uint8_t reserved[24];
+};
+
+struct TelemetryRecord
+{
+    enum
+    {
+        AZ_VALID = 0x1,
+        STATUS_VALID = 0x2,
+        VOLTS_VALID = 0x4,
+        SHUTTER_ONLINE = 0x8
+    };
+
+    // wall clock, microseconds since the epoch
+    int64_t timeUS;
+    double az;
+    double targetAz;
+    double shutterVolts;
+    uint16_t status;
+    uint8_t rotatorOp;
+    uint8_t shutterActivity;
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(TelemetryHeader) == 64, "telemetry header layout");
+static_assert(sizeof(TelemetryRecord) == 40, "telemetry record layout");
+
+namespace BeaverTelemetry
+{
+const char MAGIC[8] = {'B', 'V', 'R', 'T', 'E', 'L', 'E', 'M'};
+const uint32_t VERSION = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// record() is called from the INDI thread once per poll and only copies the
+/// record into a single producer / single consumer ring. A writer thread moves
+/// the ring into a memory mapped file; when the file is full it is rotated to
+/// <path>.1, <path>.2, ... and a new one is started.
+///////////////////////////////////////////////////////////////////////////////
+class TelemetryWriter
+{
+    public:
+        TelemetryWriter() = default;
+        ~TelemetryWriter();
+
+        TelemetryWriter(const TelemetryWriter &) = delete;
+        TelemetryWriter &operator=(const TelemetryWriter &) = delete;
+
+        // Rotates an existing file at path out of the way and starts a new one
+        bool start(const std::string &path);
+        // Writes out what is still in the ring and unmaps the file
+        void stop();
+        bool isRunning() const
+        {
+            return m_Running;
+        }
+
+        // Lock-free, no allocation; drops the record if the ring is full
+        void record(const TelemetryRecord &record);
+
+    private:
+        // Records per file, about 2.6 MB or 18 hours at one poll per second
+        static constexpr const uint64_t FILE_RECORDS {65536};
+        static constexpr const size_t FILE_SIZE {sizeof(TelemetryHeader) + FILE_RECORDS * sizeof(TelemetryRecord)};
+        // Rotated files kept besides the current one
+        static constexpr const int KEEP_FILES {3};
+        // Power of two, about a minute of polls at the fast rate
+        static constexpr const size_t RING_SIZE {256};
+        static constexpr const uint32_t FLUSH_INTERVAL_MS {500};
+
+        void writerThread();
+        void flushRing();
+        bool openFile();
+        void closeFile();
+        void rotateFiles();
+
+        std::string m_Path;
+        std::thread m_Thread;
+        std::atomic<bool> m_Running {false};
+        // wakes the writer thread early when it is stopped
+        std::mutex m_WakeLock;
+        std::condition_variable m_Wake;
+
+        TelemetryRecord m_Ring[RING_SIZE];
+        // written by the producer, read by the writer thread
+        std::atomic<size_t> m_Head {0};
+        // written by the writer thread, read by the producer
+        std::atomic<size_t> m_Tail {0};
+        std::atomic<uint64_t> m_Dropped {0};
+
+        // writer thread only
+        int m_FD {-1};
+        TelemetryHeader *m_Header {nullptr};
+        TelemetryRecord *m_Records {nullptr};
+};
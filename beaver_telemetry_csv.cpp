@@ -0,0 +1,107 @@
+/*
+    NexDome Beaver Controller - Telemetry to CSV
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_state.h"
+#include "beaver_telemetry.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+
+void printNumber(double value, bool valid)
+{
+    if (valid && !std::isnan(value))
+        printf(",%.3f", value);
+    else
+        printf(",");
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool convert(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror(path);
+        return false;
+    }
+
+    TelemetryHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, BeaverTelemetry::MAGIC, sizeof(header.magic)) ||
+            header.version != BeaverTelemetry::VERSION || header.recordSize != sizeof(TelemetryRecord))
+    {
+        fprintf(stderr, "%s: not a Beaver telemetry file\n", path);
+        fclose(fp);
+        return false;
+    }
+    if (header.dropped > 0)
+        fprintf(stderr, "%s: %llu records were dropped while recording\n", path,
+                static_cast<unsigned long long>(header.dropped));
+
+    TelemetryRecord record;
+    for (uint64_t i = 0; i < header.records && fread(&record, sizeof(record), 1, fp) == 1; i++)
+    {
+        const time_t secs = static_cast<time_t>(record.timeUS / 1000000);
+        struct tm utc;
+        gmtime_r(&secs, &utc);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+        printf("%s.%03dZ", stamp, static_cast<int>((record.timeUS / 1000) % 1000));
+
+        printNumber(record.az, record.flags & TelemetryRecord::AZ_VALID);
+        printNumber(record.targetAz, true);
+        if (record.flags & TelemetryRecord::STATUS_VALID)
+            printf(",0x%04x", record.status);
+        else
+            printf(",");
+        printf(",%s", record.rotatorOp < BeaverState::ROTATOR_OP_COUNT ?
+               BeaverState::rotatorText(static_cast<BeaverState::RotatorOperation>(record.rotatorOp)) : "");
+        printf(",%d", (record.flags & TelemetryRecord::SHUTTER_ONLINE) ? 1 : 0);
+        printf(",%s", record.shutterActivity < BeaverState::SHUTTER_ACT_COUNT ?
+               BeaverState::shutterText(static_cast<BeaverState::ShutterActivity>(record.shutterActivity)) : "");
+        printNumber(record.shutterVolts, record.flags & TelemetryRecord::VOLTS_VALID);
+        printf("\n");
+    }
+    fclose(fp);
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s file [file...]\n", argv[0]);
+        fprintf(stderr, "  give rotated files oldest first, e.g. telemetry.2 telemetry.1 telemetry\n");
+        return 1;
+    }
+
+    printf("time,az,target_az,status,rotator,shutter_online,shutter,shutter_volts\n");
+    bool ok = true;
+    for (int i = 1; i < argc; i++)
+        ok = convert(argv[i]) && ok;
+    return ok ? 0 : 1;
+}
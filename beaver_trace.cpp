@@ -0,0 +1,208 @@
+/*
+    NexDome Beaver Controller - Serial Trace Record and Replay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_trace.h"
+#include "beaver_protocol.h"
+
+#include <algorithm>
+#include <cstring>
+
+constexpr const uint32_t TraceWriter::FLUSH_INTERVAL_MS;
+constexpr const size_t TraceReplay::LOOKAHEAD;
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+bool TraceWriter::open(const std::string &path)
+{
+    close();
+    m_FP = fopen(path.c_str(), "wb");
+    if (m_FP == nullptr)
+        return false;
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BeaverTrace::MAGIC, sizeof(header.magic));
+    header.version = BeaverTrace::VERSION;
+    if (fwrite(&header, sizeof(header), 1, m_FP) != 1)
+    {
+        fclose(m_FP);
+        m_FP = nullptr;
+        return false;
+    }
+
+    m_Last = m_LastFlush = std::chrono::steady_clock::now();
+    m_Frames = 0;
+    return true;
+}
+
+void TraceWriter::close()
+{
+    if (m_FP == nullptr)
+        return;
+    fclose(m_FP);
+    m_FP = nullptr;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Hot path, one buffered write per frame
+/////////////////////////////////////////////////////////////////////////////
+void TraceWriter::frame(BeaverTrace::Direction direction, const char *data, size_t len)
+{
+    if (m_FP == nullptr)
+        return;
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const long long delta = std::chrono::duration_cast<std::chrono::microseconds>(now - m_Last).count();
+    m_Last = now;
+
+    TraceFrameHeader header;
+    header.deltaUS = static_cast<uint32_t>(std::max(0LL, std::min<long long>(delta, UINT32_MAX)));
+    header.direction = static_cast<uint8_t>(direction);
+    header.reserved = 0;
+    header.length = static_cast<uint16_t>(std::min<size_t>(len, UINT16_MAX));
+    fwrite(&header, sizeof(header), 1, m_FP);
+    fwrite(data, 1, header.length, m_FP);
+    m_Frames++;
+
+    if (now - m_LastFlush >= std::chrono::milliseconds(FLUSH_INTERVAL_MS))
+    {
+        fflush(m_FP);
+        m_LastFlush = now;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// A trace cut short by a crash loads up to its last complete frame
+/////////////////////////////////////////////////////////////////////////////
+bool loadTrace(const std::string &path, std::vector<TraceFrame> &frames)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr)
+        return false;
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, BeaverTrace::MAGIC, sizeof(header.magic)) ||
+            header.version != BeaverTrace::VERSION)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    frames.clear();
+    int64_t timeUS = 0;
+    TraceFrameHeader frameHeader;
+    while (fread(&frameHeader, sizeof(frameHeader), 1, fp) == 1)
+    {
+        TraceFrame frame;
+        frame.data.resize(frameHeader.length);
+        if (frameHeader.length > 0 && fread(&frame.data[0], 1, frameHeader.length, fp) != frameHeader.length)
+            break;
+        timeUS += frameHeader.deltaUS;
+        frame.timeUS = timeUS;
+        frame.direction = frameHeader.direction == BeaverTrace::TRACE_TX ? BeaverTrace::TRACE_TX : BeaverTrace::TRACE_RX;
+        frames.push_back(std::move(frame));
+    }
+    fclose(fp);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Replay
+/////////////////////////////////////////////////////////////////////////////
+TraceReplay::TraceReplay(const std::vector<TraceFrame> &frames) : m_Frames(frames)
+{
+    // the first answer to every request, for requests the session did not make in that order
+    for (size_t i = 0; i < m_Frames.size(); i++)
+    {
+        if (m_Frames[i].direction != BeaverTrace::TRACE_TX)
+            continue;
+        m_End = i + 1;
+        Answer answer;
+        if (m_Last.count(m_Frames[i].data) == 0 && replyTo(i, answer))
+            m_Last[m_Frames[i].data] = answer;
+    }
+}
+
+bool TraceReplay::handle(const char *request, size_t len, std::string &reply, double &delayS)
+{
+    const std::string key(request, len);
+
+    size_t skipped = 0;
+    for (size_t i = m_Cursor; i < m_Frames.size() && skipped <= LOOKAHEAD; i++)
+    {
+        if (m_Frames[i].direction != BeaverTrace::TRACE_TX)
+            continue;
+        if (m_Frames[i].data != key)
+        {
+            skipped++;
+            continue;
+        }
+
+        m_Cursor = i + 1;
+        Answer answer;
+        if (!replyTo(i, answer))
+        {
+            // it timed out when recorded, so it does now
+            m_Matched++;
+            return false;
+        }
+        m_Last[key] = answer;
+        m_Matched++;
+        reply = answer.reply;
+        delayS = answer.delayS;
+        return true;
+    }
+
+    m_Missed++;
+    const auto last = m_Last.find(key);
+    if (last == m_Last.end())
+        return false;
+    reply = last->second.reply;
+    delayS = last->second.delayS;
+    return true;
+}
+
+// The first frame after the request that echoes it, before the request is sent again
+bool TraceReplay::replyTo(size_t request, Answer &answer) const
+{
+    const TraceFrame &tx = m_Frames[request];
+    for (size_t i = request + 1; i < m_Frames.size(); i++)
+    {
+        const TraceFrame &frame = m_Frames[i];
+        if (frame.direction == BeaverTrace::TRACE_TX)
+        {
+            if (frame.data == tx.data)
+                return false;
+            continue;
+        }
+        if (BeaverProtocol::matchesRequest(tx.data.c_str(), frame.data.data(), frame.data.size()))
+        {
+            answer.reply = frame.data;
+            answer.delayS = (frame.timeUS - tx.timeUS) / 1e6;
+            return true;
+        }
+    }
+    return false;
+}
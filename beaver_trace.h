@@ -0,0 +1,164 @@
+/*
+    NexDome Beaver Controller - Serial Trace Record and Replay
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+/// On-disk layout: one header, then for every frame a TraceFrameHeader and
+/// `length` bytes of the frame as sent or received, stop char included.
+/// Times are steady clock microseconds since the previous frame, so a trace
+/// replays with the original pacing. Native byte order.
+///////////////////////////////////////////////////////////////////////////////
+struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct TraceFrameHeader
+{
+    // gaps of more than about 71 minutes are recorded as 71 minutes
+    uint32_t deltaUS;
+    uint8_t direction;
+    uint8_t reserved;
+    uint16_t length;
+};
+
+static_assert(sizeof(TraceHeader) == 16, "trace header layout");
+static_assert(sizeof(TraceFrameHeader) == 8, "trace frame layout");
+
+namespace BeaverTrace
+{
+const char MAGIC[8] = {'B', 'V', 'R', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t VERSION = 1;
+
+enum Direction
+{
+    // driver to controller
+    TRACE_TX,
+    // controller to driver
+    TRACE_RX
+};
+}
+
+struct TraceFrame
+{
+    BeaverTrace::Direction direction;
+    // since the start of the recording
+    int64_t timeUS;
+    std::string data;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Appends frames to a trace file. Buffered, flushed about once a second so a
+/// crash loses little. Used from the I/O thread only.
+///////////////////////////////////////////////////////////////////////////////
+class TraceWriter
+{
+    public:
+        TraceWriter() = default;
+        ~TraceWriter();
+
+        TraceWriter(const TraceWriter &) = delete;
+        TraceWriter &operator=(const TraceWriter &) = delete;
+
+        bool open(const std::string &path);
+        void close();
+        bool isOpen() const
+        {
+            return m_FP != nullptr;
+        }
+
+        void frame(BeaverTrace::Direction direction, const char *data, size_t len);
+        uint64_t frames() const
+        {
+            return m_Frames;
+        }
+
+    private:
+        static constexpr const uint32_t FLUSH_INTERVAL_MS {1000};
+
+        FILE *m_FP {nullptr};
+        std::chrono::steady_clock::time_point m_Last;
+        std::chrono::steady_clock::time_point m_LastFlush;
+        uint64_t m_Frames {0};
+};
+
+// Reads a whole trace, false if the file is missing or not a trace
+bool loadTrace(const std::string &path, std::vector<TraceFrame> &frames);
+
+///////////////////////////////////////////////////////////////////////////////
+/// Answers requests from a recorded session. Each request is looked up from
+/// where the last one matched, so the replayed driver walks through the
+/// recording in order; its reply is the first received frame after it that
+/// echoes the request, at the latency it had when recorded. A request the
+/// recording has nothing for nearby gets the last answer replayed for it, or
+/// its first one anywhere in the recording; with neither the driver sees a
+/// timeout.
+///////////////////////////////////////////////////////////////////////////////
+class TraceReplay
+{
+    public:
+        explicit TraceReplay(const std::vector<TraceFrame> &frames);
+
+        // True with the reply and its recorded delay if there is one
+        bool handle(const char *request, size_t len, std::string &reply, double &delayS);
+        // Sessions replay to the end and then go on from the fallback answers
+        bool finished() const
+        {
+            return m_Cursor >= m_End;
+        }
+        uint64_t matched() const
+        {
+            return m_Matched;
+        }
+        uint64_t missed() const
+        {
+            return m_Missed;
+        }
+
+    private:
+        // Requests skipped over when looking for the next match
+        static constexpr const size_t LOOKAHEAD {64};
+
+        struct Answer
+        {
+            std::string reply;
+            double delayS;
+        };
+
+        bool replyTo(size_t request, Answer &answer) const;
+
+        const std::vector<TraceFrame> &m_Frames;
+        size_t m_Cursor {0};
+        // one past the last request in the recording
+        size_t m_End {0};
+        std::map<std::string, Answer> m_Last;
+        uint64_t m_Matched {0};
+        uint64_t m_Missed {0};
+};
@@ -0,0 +1,362 @@
+/*
+    NexDome Beaver Controller - Framed Transport
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include "beaver_transport.h"
+#include "beaver_trace.h"
+
+#include "indicom.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr const size_t BeaverTransport::RING_SIZE;
+constexpr const size_t BeaverTransport::DATAGRAM_SIZE;
+
+BeaverTransport::BeaverTransport(char stopChar) : m_StopChar(stopChar)
+{
+    if (pipe(m_Wake) != 0)
+    {
+        m_Wake[0] = m_Wake[1] = -1;
+        return;
+    }
+    for (int fd : m_Wake)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+BeaverTransport::~BeaverTransport()
+{
+    for (int fd : m_Wake)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void BeaverTransport::interrupt()
+{
+    m_Interrupted = true;
+    const char wake = 1;
+    if (m_Wake[1] >= 0 && ::write(m_Wake[1], &wake, 1) < 0)
+    {
+        // pipe full, poll() is woken already
+    }
+}
+
+void BeaverTransport::clearInterrupt()
+{
+    m_Interrupted = false;
+    drainWake();
+}
+
+void BeaverTransport::drainWake()
+{
+    char buf[64];
+    while (m_Wake[0] >= 0 && read(m_Wake[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+void BeaverTransport::attach(int fd)
+{
+    m_FD = fd;
+    m_Head = m_Tail = m_Scanned = 0;
+    int type = 0;
+    socklen_t typeLen = sizeof(type);
+    m_Datagram = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typeLen) == 0 && type == SOCK_DGRAM;
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void BeaverTransport::detach()
+{
+    m_FD = -1;
+    m_Head = m_Tail = m_Scanned = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+int BeaverTransport::write(const char *cmd, TimePoint deadline)
+{
+    const size_t len = strlen(cmd);
+    size_t written = 0;
+    while (written < len)
+    {
+        const ssize_t n = ::write(m_FD, cmd + written, len - written);
+        if (n > 0)
+        {
+            written += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return TTY_WRITE_ERROR;
+
+        int rc = TTY_OK;
+        if (!wait(POLLOUT, deadline, rc))
+            return rc;
+    }
+    if (m_Trace != nullptr)
+        m_Trace->frame(BeaverTrace::TRACE_TX, cmd, len);
+    return TTY_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Frames already in the ring are returned without a syscall
+/////////////////////////////////////////////////////////////////////////////
+int BeaverTransport::readFrame(char *buf, size_t size, TimePoint deadline, int &nbytes)
+{
+    nbytes = 0;
+    for (;;)
+    {
+        for (; m_Scanned < used(); m_Scanned++)
+        {
+            if (m_Ring[(m_Tail + m_Scanned) % RING_SIZE] != m_StopChar)
+                continue;
+
+            const size_t len = m_Scanned + 1;
+            if (len > size)
+            {
+                // cannot be a reply of ours, drop it and carry on
+                m_Dropped += len;
+                m_Tail += len;
+                m_Scanned = 0;
+                return TTY_OVERFLOW;
+            }
+            for (size_t i = 0; i < len; i++)
+                buf[i] = m_Ring[(m_Tail + i) % RING_SIZE];
+            if (len < size)
+                buf[len] = 0;
+            m_Tail += len;
+            m_Scanned = 0;
+            m_Frames++;
+            nbytes = static_cast<int>(len);
+            if (m_Trace != nullptr)
+                m_Trace->frame(BeaverTrace::TRACE_RX, buf, len);
+            return TTY_OK;
+        }
+
+        // A full ring without a stop char is garbage
+        if (used() == RING_SIZE)
+        {
+            m_Dropped += used();
+            m_Tail = m_Head;
+            m_Scanned = 0;
+            return TTY_OVERFLOW;
+        }
+
+        const int n = fill();
+        if (n < 0)
+            return TTY_READ_ERROR;
+        if (n > 0)
+            continue;
+
+        int rc = TTY_OK;
+        if (!wait(POLLIN, deadline, rc))
+            return rc;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+///
+/////////////////////////////////////////////////////////////////////////////
+size_t BeaverTransport::drain()
+{
+    size_t dropped = used();
+    m_Tail = m_Head;
+    m_Scanned = 0;
+    for (;;)
+    {
+        const int n = fill();
+        if (n <= 0)
+            break;
+        dropped += used();
+        m_Tail = m_Head;
+    }
+    m_Dropped += dropped;
+    return dropped;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// Reads into the contiguous free space, a wrapped ring gets a second call
+/////////////////////////////////////////////////////////////////////////////
+int BeaverTransport::fill()
+{
+    // an empty ring starts over, reads then do not stop at the wrap point
+    if (used() == 0)
+        m_Head = m_Tail = m_Scanned = 0;
+    if (m_Datagram)
+        return fillDatagram();
+
+    const size_t space = RING_SIZE - used();
+    if (space == 0)
+        return 0;
+
+    const size_t head = m_Head % RING_SIZE;
+    const size_t chunk = std::min(space, RING_SIZE - head);
+    ssize_t n;
+    do
+    {
+        n = ::read(m_FD, m_Ring + head, chunk);
+    }
+    while (n < 0 && errno == EINTR);
+    m_Reads++;
+
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    m_Head += static_cast<size_t>(n);
+    return static_cast<int>(n);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// A datagram has to be taken in one read(), whatever the ring wrap point
+/////////////////////////////////////////////////////////////////////////////
+int BeaverTransport::fillDatagram()
+{
+    char datagram[DATAGRAM_SIZE];
+    for (;;)
+    {
+        const ssize_t n = ::recv(m_FD, datagram, sizeof(datagram), MSG_TRUNC);
+        m_Reads++;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        // longer than any reply, or no room left for it: not one of ours
+        const size_t len = static_cast<size_t>(n);
+        if (len > sizeof(datagram) || len > RING_SIZE - used())
+        {
+            m_Dropped += len;
+            continue;
+        }
+        if (len == 0)
+            continue;
+
+        const size_t head = m_Head % RING_SIZE;
+        const size_t first = std::min(len, RING_SIZE - head);
+        memcpy(m_Ring + head, datagram, first);
+        memcpy(m_Ring, datagram + first, len - first);
+        m_Head += len;
+        return static_cast<int>(len);
+    }
+}
+
+bool BeaverTransport::wait(short events, TimePoint deadline, int &rc)
+{
+    for (;;)
+    {
+        const long long remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                                        deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0 || m_Interrupted)
+        {
+            rc = TTY_TIME_OUT;
+            return false;
+        }
+
+        struct pollfd pfd[2];
+        pfd[0].fd = m_FD;
+        pfd[0].events = events;
+        pfd[0].revents = 0;
+        pfd[1].fd = m_Wake[0];
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        // rounded up so the wait does not end just short of the deadline
+        const int n = poll(pfd, m_Wake[0] >= 0 ? 2 : 1, static_cast<int>((remaining + 999) / 1000));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            rc = TTY_SELECT_ERROR;
+            return false;
+        }
+        if (n == 0)
+        {
+            rc = TTY_TIME_OUT;
+            return false;
+        }
+        // woken by interrupt(), or a wake left over from one already cleared
+        if (pfd[0].revents == 0)
+        {
+            drainWake();
+            continue;
+        }
+        if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+        {
+            rc = TTY_PORT_FAILURE;
+            return false;
+        }
+        return true;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/// RTT estimate
+/////////////////////////////////////////////////////////////////////////////
+void RttEstimator::sample(double ms)
+{
+    if (!m_HasSample)
+    {
+        m_SRTT = ms;
+        m_RTTVAR = ms / 2;
+        m_HasSample = true;
+    }
+    else
+    {
+        m_RTTVAR = 0.75 * m_RTTVAR + 0.25 * fabs(m_SRTT - ms);
+        m_SRTT = 0.875 * m_SRTT + 0.125 * ms;
+    }
+    m_Backoff = 0;
+    update();
+}
+
+void RttEstimator::backoff()
+{
+    if (m_HasSample && m_Backoff < 16)
+        m_Backoff++;
+    update();
+}
+
+void RttEstimator::reset()
+{
+    m_HasSample = false;
+    m_SRTT = m_RTTVAR = 0;
+    m_Backoff = 0;
+    m_RTO = m_MaxMS;
+}
+
+void RttEstimator::update()
+{
+    if (!m_HasSample)
+        return;
+    // at least 1 ms of variance, the clock granularity of the timeouts
+    const double rto = (m_SRTT + std::max(1.0, 4 * m_RTTVAR)) * (1u << m_Backoff);
+    m_RTO = static_cast<uint32_t>(std::max<double>(m_MinMS, std::min<double>(m_MaxMS, ceil(rto))));
+}
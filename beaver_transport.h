@@ -0,0 +1,169 @@
+/*
+    NexDome Beaver Controller - Framed Transport
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class TraceWriter;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Non-blocking framed I/O on the serial or UDP port. Each read takes all
+/// bytes available into a receive ring, replies are cut out on the stop char,
+/// and waits are poll() calls against absolute deadlines. Whatever arrived
+/// before a new request is drained so a late reply can never be taken as the
+/// answer to the next command. Returns TTY_* codes like the indicom calls.
+/// Used from the I/O thread only, apart from interrupt().
+///////////////////////////////////////////////////////////////////////////////
+class BeaverTransport
+{
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        explicit BeaverTransport(char stopChar);
+        ~BeaverTransport();
+        BeaverTransport(const BeaverTransport &) = delete;
+        BeaverTransport &operator=(const BeaverTransport &) = delete;
+
+        // Take over the port, switches it to non-blocking and empties the ring.
+        // A datagram socket (UDP) is read one whole datagram at a time.
+        void attach(int fd);
+        // Forget the port once it is closed, later I/O fails at once
+        void detach();
+        bool isDatagram() const
+        {
+            return m_Datagram;
+        }
+
+        int write(const char *cmd, TimePoint deadline);
+        // Copy the next frame including the stop char into buf
+        int readFrame(char *buf, size_t size, TimePoint deadline, int &nbytes);
+        // Throw away complete frames and partial bytes, returns bytes dropped
+        size_t drain();
+
+        // Any thread: the wait in progress and every later one end at once with
+        // TTY_TIME_OUT until clearInterrupt(), so an abort need not sit out the
+        // deadline of the exchange in flight
+        void interrupt();
+        void clearInterrupt();
+        bool interrupted() const
+        {
+            return m_Interrupted;
+        }
+
+        // Frames written and read are also appended to trace while it is open
+        void setTrace(TraceWriter *trace)
+        {
+            m_Trace = trace;
+        }
+
+        uint64_t reads() const
+        {
+            return m_Reads;
+        }
+        uint64_t frames() const
+        {
+            return m_Frames;
+        }
+        uint64_t dropped() const
+        {
+            return m_Dropped;
+        }
+
+    private:
+        static constexpr const size_t RING_SIZE {1024};
+        // Larger than any reply; a read() shorter than the datagram loses the rest of it
+        static constexpr const size_t DATAGRAM_SIZE {512};
+
+        // One read() of everything available, 0 when nothing was, < 0 on error
+        int fill();
+        int fillDatagram();
+        bool wait(short events, TimePoint deadline, int &rc);
+        void drainWake();
+        size_t used() const
+        {
+            return m_Head - m_Tail;
+        }
+
+        const char m_StopChar;
+        int m_FD {-1};
+        // self-pipe that wakes poll() on interrupt()
+        int m_Wake[2] {-1, -1};
+        std::atomic<bool> m_Interrupted {false};
+        bool m_Datagram {false};
+        TraceWriter *m_Trace {nullptr};
+        char m_Ring[RING_SIZE];
+        // free running indices, masked on access
+        size_t m_Head {0};
+        size_t m_Tail {0};
+        // bytes from m_Tail already known to hold no stop char
+        size_t m_Scanned {0};
+
+        uint64_t m_Reads {0};
+        uint64_t m_Frames {0};
+        uint64_t m_Dropped {0};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Round trip time estimate and retransmission timeout as in RFC 6298:
+/// RTO = SRTT + 4 * RTTVAR, doubled after each loss until the next sample.
+/// Only replies to a first transmission are sampled (Karn), a reply after a
+/// retransmit could belong to either copy.
+///////////////////////////////////////////////////////////////////////////////
+class RttEstimator
+{
+    public:
+        RttEstimator(uint32_t minMS, uint32_t maxMS) : m_MinMS(minMS), m_MaxMS(maxMS) {}
+
+        void sample(double ms);
+        void backoff();
+        void reset();
+
+        bool hasSample() const
+        {
+            return m_HasSample;
+        }
+        double srtt() const
+        {
+            return m_SRTT;
+        }
+        double rttvar() const
+        {
+            return m_RTTVAR;
+        }
+        // ms, within [minMS, maxMS]; maxMS until the first sample
+        uint32_t timeout() const
+        {
+            return m_RTO;
+        }
+
+    private:
+        void update();
+
+        const uint32_t m_MinMS;
+        const uint32_t m_MaxMS;
+        bool m_HasSample {false};
+        double m_SRTT {0};
+        double m_RTTVAR {0};
+        uint32_t m_Backoff {0};
+        uint32_t m_RTO {m_MaxMS};
+};